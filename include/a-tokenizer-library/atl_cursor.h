@@ -6,6 +6,7 @@
 #include <inttypes.h>
 #include "a-memory-library/aml_pool.h"
 #include "a-tokenizer-library/atl_token.h"
+#include "a-tokenizer-library/atl_token_ast.h"
 
 struct atl_cursor_s;
 typedef struct atl_cursor_s atl_cursor_t;
@@ -19,6 +20,10 @@ typedef atl_cursor_t *(*atl_cursor_custom_cb)(aml_pool_t *pool, atl_token_t *tok
    to get each id which matches the given query. */
 atl_cursor_t *atl_cursor_open(aml_pool_t *pool, atl_cursor_custom_cb cb, atl_token_t *t, void *arg);
 
+/* Like atl_cursor_open, but walks a compact ast (see atl_token_ast.h).  cb is given a
+   standalone token for each leaf (atl_token_ast_token). */
+atl_cursor_t *atl_cursor_open_ast(aml_pool_t *pool, atl_cursor_custom_cb cb, const atl_token_ast_t *ast, void *arg);
+
 /* This is generally meant to match a single document, but can also be used to see if there are any matches
     as it returns true if the first advance call succeeds. */
 bool atl_cursor_match(aml_pool_t *pool, atl_cursor_custom_cb cb, atl_token_t *t, void *arg);
@@ -28,9 +33,38 @@ bool atl_cursor_match(aml_pool_t *pool, atl_cursor_custom_cb cb, atl_token_t *t,
 */
 atl_cursor_t *atl_cursor_range(aml_pool_t *pool, uint32_t start, uint32_t end);
 
+/*
+    Create a cursor which will return each id in ids (which must be sorted ascending).  The ids
+    are not copied and must remain valid for the life of the cursor.
+*/
+atl_cursor_t *atl_cursor_array(aml_pool_t *pool, const uint32_t *ids, uint32_t num_ids);
+
+/*
+    Create a cursor which will return each id in [0, num_bits) whose bit is set (bit id%64 of
+    bits[id/64]).  The bits are not copied and must remain valid for the life of the cursor.
+*/
+atl_cursor_t *atl_cursor_bitmap(aml_pool_t *pool, const uint64_t *bits, uint32_t num_bits);
+
 typedef bool (*atl_cursor_advance_cb)( atl_cursor_t * c );
 typedef bool (*atl_cursor_advance_to_cb)( atl_cursor_t * c, uint32_t id );
 typedef void (*atl_cursor_add_cb)( atl_cursor_t *dest, atl_cursor_t *src );
+/* returns the score of the cursor at its current id */
+typedef double (*atl_cursor_score_cb)( atl_cursor_t * c );
+/* restores the cursor (and its children) to the state it was in when it was opened */
+typedef bool (*atl_cursor_rewind_cb)( atl_cursor_t * c );
+/* returns the number of ids the cursor has left to return (at most limit) */
+typedef uint32_t (*atl_cursor_count_cb)( atl_cursor_t * c, uint32_t limit );
+
+/* Per cursor counters which are only collected when the library (and the code calling
+   atl_cursor_advance / atl_cursor_advance_to) is built with ATL_CURSOR_STATS defined. */
+typedef struct {
+    uint64_t advance_calls;
+    uint64_t advance_to_calls;
+    uint64_t ids_returned;     /* calls which left the cursor on an id */
+    uint64_t ids_skipped;      /* id space passed over by advance_to */
+    uint64_t heap_ops;         /* OR heap pushes and pops */
+    uint64_t cycles;           /* spent in advance and advance_to, including children */
+} atl_cursor_stats_t;
 
 enum atl_cursor_type { EMPTY_CURSOR = 0, AND_CURSOR = 1, PHRASE_CURSOR = 2, OR_CURSOR = 3, NOT_CURSOR = 4,
                        NORMAL_CURSOR = 5, TERM_CURSOR = 6 };
@@ -42,6 +76,11 @@ struct atl_cursor_s {
     atl_cursor_advance_cb _advance;
 
     atl_cursor_add_cb add;
+    atl_cursor_score_cb score;
+    atl_cursor_rewind_cb rewind;
+    atl_cursor_count_cb count;
+
+    atl_cursor_stats_t *stats;
 
     enum atl_cursor_type type;
 
@@ -50,17 +89,123 @@ struct atl_cursor_s {
     uint32_t id;
 };
 
+#ifdef ATL_CURSOR_STATS
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+static inline uint64_t atl_cursor_ticks(void) {
+    return __rdtsc();
+}
+#else
+#include <time.h>
+static inline uint64_t atl_cursor_ticks(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+#endif
+
+static inline bool atl_cursor_advance(atl_cursor_t *c) {
+    atl_cursor_stats_t *s = c->stats;
+    if(!s)
+        return c->advance(c);
+    uint64_t start = atl_cursor_ticks();
+    bool r = c->advance(c);
+    s->cycles += atl_cursor_ticks() - start;
+    s->advance_calls++;
+    if(r)
+        s->ids_returned++;
+    return r;
+}
+
+static inline bool atl_cursor_advance_to(atl_cursor_t *c, uint32_t id) {
+    atl_cursor_stats_t *s = c->stats;
+    if(!s)
+        return c->advance_to(c, id);
+    uint32_t prev = c->id;
+    uint64_t start = atl_cursor_ticks();
+    bool r = c->advance_to(c, id);
+    s->cycles += atl_cursor_ticks() - start;
+    s->advance_to_calls++;
+    if(r) {
+        s->ids_returned++;
+        if(c->id > prev+1)
+            s->ids_skipped += c->id - prev - 1;
+    }
+    return r;
+}
+#else
+/* c->advance(c) and c->advance_to(c, id), counted when built with ATL_CURSOR_STATS */
+static inline bool atl_cursor_advance(atl_cursor_t *c) {
+    return c->advance(c);
+}
+
+static inline bool atl_cursor_advance_to(atl_cursor_t *c, uint32_t id) {
+    return c->advance_to(c, id);
+}
+#endif
+
 /* convert a query to an empty one */
 bool atl_cursor_empty(atl_cursor_t *c);
 
+/* Every cursor must be set up with atl_cursor_init before its own callbacks are set.  It sets
+   pool, advance and advance_to and clears everything else (type is NORMAL_CURSOR and the
+   optional add, score, rewind, count and stats are NULL), so that cursors which embed an
+   atl_cursor_t keep working as optional callbacks are added to it. */
+void atl_cursor_init(atl_cursor_t *c, aml_pool_t *pool,
+                     atl_cursor_advance_cb advance, atl_cursor_advance_to_cb advance_to);
+
 atl_cursor_t *atl_cursor_init_empty(aml_pool_t *pool);
 atl_cursor_t *atl_cursor_init_id(aml_pool_t *pool, uint32_t id);
 atl_cursor_t *atl_cursor_init_or(aml_pool_t *pool);
 atl_cursor_t *atl_cursor_init_and(aml_pool_t *pool);
 atl_cursor_t *atl_cursor_init_not(aml_pool_t *pool, atl_cursor_t *pos, atl_cursor_t *neg);
 
+/* The score of the cursor at its current id (0.0 if the cursor has no score callback).  AND and
+   phrase cursors sum the scores of their children, OR cursors sum the scores of the children
+   which matched the current id and NOT cursors return the score of the positive side.  Custom
+   cursors can set (or override) the score callback after atl_cursor_init. */
+double atl_cursor_score(atl_cursor_t *c);
+
+typedef struct {
+    double k1;               /* term frequency saturation (typically 1.2) */
+    double b;                /* document length normalization (typically 0.75) */
+    double avg_doc_len;      /* average document length across the collection */
+    uint32_t num_docs;       /* number of documents in the collection */
+    const uint32_t *doc_lens; /* document length indexed by id */
+} atl_cursor_bm25_t;
+
+/* A leaf cursor over a posting list which is scored with BM25.  tfs[i] is the term frequency of
+   ids[i] and the length of the posting list is used as the document frequency.  Neither the
+   postings nor params->doc_lens are copied. */
+atl_cursor_t *atl_cursor_bm25(aml_pool_t *pool, const uint32_t *ids, const uint32_t *tfs,
+                              uint32_t num_ids, const atl_cursor_bm25_t *params);
+
 atl_cursor_t ** atl_cursor_subs(atl_cursor_t *c, uint32_t *num_sub );
 
 void atl_cursor_reset(atl_cursor_t *c);
 
+/* Return the cursor tree to the state it was in when it was opened so that it can be run
+   again (for another page or a different id range) without reopening it.  No memory is
+   allocated.  To run over [start, end), rewind and call advance_to(start) before advancing
+   while id < end.  Custom cursors must set a rewind callback to support this, false is
+   returned (after rewinding what can be) if any cursor in the tree could not be rewound. */
+bool atl_cursor_rewind(atl_cursor_t *c);
+
+/* The number of ids the cursor has left to return.  Range, array and bitmap leaves are counted
+   without visiting each id, as are AND, OR and NOT cursors whose children are all unread
+   bitmaps (by popcount).  Anything else is advanced to the end.  Counting consumes the cursor,
+   rewind it to use it again.  Custom cursors can set a count callback to be counted directly. */
+uint32_t atl_cursor_count(atl_cursor_t *c);
+
+/* Like atl_cursor_count, but stops once limit ids have been found.  atl_cursor_count_upto(c, 1)
+   tests whether anything matches. */
+uint32_t atl_cursor_count_upto(atl_cursor_t *c, uint32_t limit);
+
+/* Print the cursor tree (one cursor per line, children indented by a tab) the way
+   atl_token_dump prints tokens.  When built with ATL_CURSOR_STATS, atl_cursor_open attaches
+   counters to every cursor and each line is annotated with them.  Advance the root with
+   atl_cursor_advance to have it counted as well.  cycles includes the children while self
+   does not. */
+void atl_cursor_explain(atl_cursor_t *c);
+
 #endif
\ No newline at end of file
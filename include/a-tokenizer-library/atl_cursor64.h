@@ -0,0 +1,130 @@
+// SPDX-FileCopyrightText:  2023 Andy Curtis <contactandyc@gmail.com>
+// SPDX-License-Identifier: Apache-2.0
+#ifndef _atl_cursor64_h
+#define _atl_cursor64_h
+
+#include <inttypes.h>
+#include "a-memory-library/aml_pool.h"
+#include "a-tokenizer-library/atl_token.h"
+#include "a-tokenizer-library/atl_token_ast.h"
+#include "a-tokenizer-library/atl_cursor.h"
+
+/*
+    The cursor engine with 64 bit ids.  Every function behaves like its atl_cursor_ counterpart
+    in atl_cursor.h (both are built from the same source), only the id (and counts of ids) are
+    uint64_t.  The cursor types, atl_cursor_stats_t and atl_cursor_bm25_t are shared.
+*/
+
+struct atl_cursor64_s;
+typedef struct atl_cursor64_s atl_cursor64_t;
+
+typedef atl_cursor64_t *(*atl_cursor64_custom_cb)(aml_pool_t *pool, atl_token_t *token, void *arg);
+
+atl_cursor64_t *atl_cursor64_open(aml_pool_t *pool, atl_cursor64_custom_cb cb, atl_token_t *t, void *arg);
+atl_cursor64_t *atl_cursor64_open_ast(aml_pool_t *pool, atl_cursor64_custom_cb cb, const atl_token_ast_t *ast, void *arg);
+bool atl_cursor64_match(aml_pool_t *pool, atl_cursor64_custom_cb cb, atl_token_t *t, void *arg);
+
+/* all ids in the range [start, end) */
+atl_cursor64_t *atl_cursor64_range(aml_pool_t *pool, uint64_t start, uint64_t end);
+
+/* each id in ids (sorted ascending, not copied) */
+atl_cursor64_t *atl_cursor64_array(aml_pool_t *pool, const uint64_t *ids, uint32_t num_ids);
+
+/* each id in [0, num_bits) whose bit is set (not copied) */
+atl_cursor64_t *atl_cursor64_bitmap(aml_pool_t *pool, const uint64_t *bits, uint64_t num_bits);
+
+typedef bool (*atl_cursor64_advance_cb)( atl_cursor64_t * c );
+typedef bool (*atl_cursor64_advance_to_cb)( atl_cursor64_t * c, uint64_t id );
+typedef void (*atl_cursor64_add_cb)( atl_cursor64_t *dest, atl_cursor64_t *src );
+typedef double (*atl_cursor64_score_cb)( atl_cursor64_t * c );
+typedef bool (*atl_cursor64_rewind_cb)( atl_cursor64_t * c );
+typedef uint64_t (*atl_cursor64_count_cb)( atl_cursor64_t * c, uint64_t limit );
+
+struct atl_cursor64_s {
+    aml_pool_t *pool;
+    atl_cursor64_advance_cb advance;
+    atl_cursor64_advance_to_cb advance_to;
+    atl_cursor64_advance_cb _advance;
+
+    atl_cursor64_add_cb add;
+    atl_cursor64_score_cb score;
+    atl_cursor64_rewind_cb rewind;
+    atl_cursor64_count_cb count;
+
+    atl_cursor_stats_t *stats;
+
+    enum atl_cursor_type type;
+
+    uint32_t tag;
+
+    uint64_t id;
+};
+
+#ifdef ATL_CURSOR_STATS
+static inline bool atl_cursor64_advance(atl_cursor64_t *c) {
+    atl_cursor_stats_t *s = c->stats;
+    if(!s)
+        return c->advance(c);
+    uint64_t start = atl_cursor_ticks();
+    bool r = c->advance(c);
+    s->cycles += atl_cursor_ticks() - start;
+    s->advance_calls++;
+    if(r)
+        s->ids_returned++;
+    return r;
+}
+
+static inline bool atl_cursor64_advance_to(atl_cursor64_t *c, uint64_t id) {
+    atl_cursor_stats_t *s = c->stats;
+    if(!s)
+        return c->advance_to(c, id);
+    uint64_t prev = c->id;
+    uint64_t start = atl_cursor_ticks();
+    bool r = c->advance_to(c, id);
+    s->cycles += atl_cursor_ticks() - start;
+    s->advance_to_calls++;
+    if(r) {
+        s->ids_returned++;
+        if(c->id > prev+1)
+            s->ids_skipped += c->id - prev - 1;
+    }
+    return r;
+}
+#else
+static inline bool atl_cursor64_advance(atl_cursor64_t *c) {
+    return c->advance(c);
+}
+
+static inline bool atl_cursor64_advance_to(atl_cursor64_t *c, uint64_t id) {
+    return c->advance_to(c, id);
+}
+#endif
+
+bool atl_cursor64_empty(atl_cursor64_t *c);
+
+/* see atl_cursor_init */
+void atl_cursor64_init(atl_cursor64_t *c, aml_pool_t *pool,
+                       atl_cursor64_advance_cb advance, atl_cursor64_advance_to_cb advance_to);
+
+atl_cursor64_t *atl_cursor64_init_empty(aml_pool_t *pool);
+atl_cursor64_t *atl_cursor64_init_id(aml_pool_t *pool, uint64_t id);
+atl_cursor64_t *atl_cursor64_init_or(aml_pool_t *pool);
+atl_cursor64_t *atl_cursor64_init_and(aml_pool_t *pool);
+atl_cursor64_t *atl_cursor64_init_not(aml_pool_t *pool, atl_cursor64_t *pos, atl_cursor64_t *neg);
+
+double atl_cursor64_score(atl_cursor64_t *c);
+
+atl_cursor64_t *atl_cursor64_bm25(aml_pool_t *pool, const uint64_t *ids, const uint32_t *tfs,
+                                  uint32_t num_ids, const atl_cursor_bm25_t *params);
+
+atl_cursor64_t ** atl_cursor64_subs(atl_cursor64_t *c, uint32_t *num_sub );
+
+void atl_cursor64_reset(atl_cursor64_t *c);
+bool atl_cursor64_rewind(atl_cursor64_t *c);
+
+uint64_t atl_cursor64_count(atl_cursor64_t *c);
+uint64_t atl_cursor64_count_upto(atl_cursor64_t *c, uint64_t limit);
+
+void atl_cursor64_explain(atl_cursor64_t *c);
+
+#endif
@@ -0,0 +1,34 @@
+// SPDX-FileCopyrightText:  2023 Andy Curtis <contactandyc@gmail.com>
+// SPDX-License-Identifier: Apache-2.0
+#ifndef _atl_cursor_batch_h
+#define _atl_cursor_batch_h
+
+#include <inttypes.h>
+#include "a-memory-library/aml_pool.h"
+#include "a-tokenizer-library/atl_token.h"
+#include "a-tokenizer-library/atl_cursor.h"
+
+typedef struct {
+    uint32_t *ids;
+    uint32_t num_ids;
+} atl_cursor_batch_result_t;
+
+/*
+    Run a batch of expressions against the same index.  Each expression is parsed with
+    parse_cb/parse_arg (see atl_token_parse_expression) and optimized.  Subtrees which appear
+    more than once across the batch (compared with atl_token_canonical_ex keeping case, so cb
+    may be case sensitive) are evaluated once into an id array or bitmap and every query then
+    reads the shared result in place of the subtree.  The shared subtrees and then the queries
+    are run on num_threads threads (0 uses one per cpu), so cb must be safe to call from
+    multiple threads at once.
+
+    One result is returned for each expression (allocated from pool) with the matching ids in
+    order.
+*/
+atl_cursor_batch_result_t *atl_cursor_batch(aml_pool_t *pool,
+                                            const char **expressions, uint32_t num_expressions,
+                                            atl_token_set_var_cb parse_cb, void *parse_arg,
+                                            atl_cursor_custom_cb cb, void *arg,
+                                            uint32_t num_threads);
+
+#endif
@@ -0,0 +1,46 @@
+// SPDX-FileCopyrightText:  2023 Andy Curtis <contactandyc@gmail.com>
+// SPDX-License-Identifier: Apache-2.0
+#ifndef _atl_cursor_cache_h
+#define _atl_cursor_cache_h
+
+#include <inttypes.h>
+#include "a-memory-library/aml_pool.h"
+#include "a-tokenizer-library/atl_token.h"
+#include "a-tokenizer-library/atl_cursor.h"
+
+/*
+    A size bounded LRU cache of query results.  Expressions are keyed by atl_token_canonical
+    (so the leaf callback is expected to be case insensitive) and the matching ids are stored
+    delta and varint encoded.  The cache is not thread safe.
+*/
+struct atl_cursor_cache_s;
+typedef struct atl_cursor_cache_s atl_cursor_cache_t;
+
+/* max_bytes bounds the memory used by the cached results (including the keys) */
+atl_cursor_cache_t *atl_cursor_cache_init(size_t max_bytes);
+void atl_cursor_cache_destroy(atl_cursor_cache_t *cache);
+
+/* Open a cursor for t.  If t (or an equivalent expression) is cached, an array cursor is
+   returned over the cached ids without calling cb.  Otherwise, the cursor is opened with
+   atl_cursor_open, run to completion and its ids are cached before an array cursor over them
+   is returned.  The cursors returned do not carry scores. */
+atl_cursor_t *atl_cursor_cache_open(atl_cursor_cache_t *cache, aml_pool_t *pool,
+                                    atl_cursor_custom_cb cb, atl_token_t *t, void *arg);
+
+/* invalidation hooks for index updates */
+
+/* remove every cached result */
+void atl_cursor_cache_clear(atl_cursor_cache_t *cache);
+
+/* remove the cached result for t (returns false if it was not cached) */
+bool atl_cursor_cache_invalidate(atl_cursor_cache_t *cache, atl_token_t *t);
+
+/* remove every cached result whose expression references term and return how many were
+   removed */
+uint32_t atl_cursor_cache_invalidate_term(atl_cursor_cache_t *cache, const char *term);
+
+/* counters since the cache was created */
+void atl_cursor_cache_stats(atl_cursor_cache_t *cache, size_t *hits, size_t *misses,
+                            size_t *bytes_used);
+
+#endif
@@ -0,0 +1,31 @@
+// SPDX-FileCopyrightText:  2023 Andy Curtis <contactandyc@gmail.com>
+// SPDX-License-Identifier: Apache-2.0
+#ifndef _atl_cursor_numeric_h
+#define _atl_cursor_numeric_h
+
+#include <inttypes.h>
+#include "a-memory-library/aml_pool.h"
+#include "a-tokenizer-library/atl_cursor.h"
+
+/*
+    A numeric column (one value per id) indexed for range queries.  The ids are split into
+    blocks of 128 in id order and each block keeps its min and max value along with its
+    values sorted (and the position of the id each came from).  A range cursor skips the
+    blocks outside the range, takes every id of a block inside it and binary searches the
+    sorted values of the blocks it overlaps, so ids are returned in order and advance_to only
+    touches the blocks it lands in.
+*/
+struct atl_cursor_numeric_s;
+typedef struct atl_cursor_numeric_s atl_cursor_numeric_t;
+
+/* ids must be sorted ascending without repeats and values[i] is the value of ids[i].  Both
+   are copied.  NaN values never match. */
+atl_cursor_numeric_t *atl_cursor_numeric_init(const uint32_t *ids, const double *values,
+                                              uint32_t num_ids);
+void atl_cursor_numeric_destroy(atl_cursor_numeric_t *h);
+
+/* A cursor over the ids whose value is in [min, max] (see atl_token_range). */
+atl_cursor_t *atl_cursor_numeric_open(aml_pool_t *pool, atl_cursor_numeric_t *h,
+                                      double min, double max);
+
+#endif
@@ -0,0 +1,36 @@
+// SPDX-FileCopyrightText:  2023 Andy Curtis <contactandyc@gmail.com>
+// SPDX-License-Identifier: Apache-2.0
+#ifndef _atl_cursor_parallel_h
+#define _atl_cursor_parallel_h
+
+#include <inttypes.h>
+#include "a-memory-library/aml_pool.h"
+#include "a-tokenizer-library/atl_token.h"
+#include "a-tokenizer-library/atl_cursor.h"
+
+/*
+    Called for each task.  thread is in [0, num_threads) and no two tasks run on the same
+    thread at the same time, so it can be used to index per thread state.
+*/
+typedef void (*atl_cursor_task_cb)(void *arg, uint32_t task, uint32_t thread);
+
+/* Run fn for every task in [0, num_tasks) on a work stealing pool of num_threads threads
+   (0 uses one thread per online cpu).  Each thread starts with a contiguous block of tasks
+   which it runs in order and then steals from the end of the other threads' blocks.  Returns
+   once every task has completed. */
+void atl_cursor_parallel_for(uint32_t num_tasks, uint32_t num_threads,
+                             atl_cursor_task_cb fn, void *arg);
+
+/* the number of threads used when 0 is passed as num_threads */
+uint32_t atl_cursor_parallel_threads(void);
+
+/* Find the ids in [start, end) which match t using num_threads threads.  The range is split
+   into chunks and each thread opens its own cursor tree (in its own pool) with cb, which
+   must be safe to call from multiple threads at once.  A thread moves its tree between
+   chunks with atl_cursor_rewind and advance_to, so it is only reopened if a custom cursor
+   cannot be rewound.  The matching ids are returned in order (allocated from pool). */
+uint32_t *atl_cursor_parallel(aml_pool_t *pool, atl_cursor_custom_cb cb, atl_token_t *t, void *arg,
+                              uint32_t start, uint32_t end, uint32_t num_threads,
+                              uint32_t *num_ids);
+
+#endif
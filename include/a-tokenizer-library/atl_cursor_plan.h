@@ -0,0 +1,40 @@
+// SPDX-FileCopyrightText:  2023 Andy Curtis <contactandyc@gmail.com>
+// SPDX-License-Identifier: Apache-2.0
+#ifndef _atl_cursor_plan_h
+#define _atl_cursor_plan_h
+
+#include <inttypes.h>
+#include "a-memory-library/aml_pool.h"
+#include "a-tokenizer-library/atl_token.h"
+#include "a-tokenizer-library/atl_cursor.h"
+
+/*
+    A plan is an expression which is parsed (and optimized) once and then opened many times
+    with different values.  Placeholders are written as $1, $2, ... and can be used as a term
+    (category:X AND "$2" NOT $3) or as an attribute value (category:$1).
+
+    The plan is immutable once it is created, so it can be opened from multiple threads at the
+    same time.
+*/
+struct atl_cursor_plan_s;
+typedef struct atl_cursor_plan_s atl_cursor_plan_t;
+
+/* cb and arg are passed to atl_token_parse_expression (eg atl_token_dict_cb) */
+atl_cursor_plan_t *atl_cursor_plan_init(const char *expression, atl_token_set_var_cb cb, void *arg);
+void atl_cursor_plan_destroy(atl_cursor_plan_t *plan);
+
+/* the highest placeholder number referenced by the plan */
+uint32_t atl_cursor_plan_num_params(atl_cursor_plan_t *plan);
+
+/* the parsed tree (which must not be modified) */
+atl_token_t *atl_cursor_plan_token(atl_cursor_plan_t *plan);
+
+/* Open a cursor for the plan where $n is replaced by params[n-1] (including placeholders in
+   the attr chain of a leaf).  Each value replaces the placeholder as a single literal term (it
+   is not parsed or passed to the parse callback).  Returns NULL if a placeholder references a
+   missing (or NULL) param. */
+atl_cursor_t *atl_cursor_plan_open(atl_cursor_plan_t *plan, aml_pool_t *pool,
+                                   atl_cursor_custom_cb cb, void *arg,
+                                   const char **params, uint32_t num_params);
+
+#endif
@@ -0,0 +1,56 @@
+// SPDX-FileCopyrightText:  2023 Andy Curtis <contactandyc@gmail.com>
+// SPDX-License-Identifier: Apache-2.0
+#ifndef _atl_cursor_terms_h
+#define _atl_cursor_terms_h
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "a-memory-library/aml_pool.h"
+#include "a-tokenizer-library/atl_token.h"
+#include "a-tokenizer-library/atl_cursor.h"
+
+/*
+    A sorted term dictionary mapping each term to its posting list.  Once frozen, the terms
+    sharing a prefix are a contiguous range found with two binary searches, which is what
+    wildcard terms (foo*, which the parser returns as ATL_TOKEN_MODIFIER tokens) are expanded
+    from.  Terms are compared bytewise, so they should be normalized (for example lowercased)
+    the same way the query is.
+*/
+struct atl_cursor_terms_s;
+typedef struct atl_cursor_terms_s atl_cursor_terms_t;
+
+atl_cursor_terms_t *atl_cursor_terms_init(void);
+void atl_cursor_terms_destroy(atl_cursor_terms_t *h);
+
+/* term is copied, ids must be sorted ascending and are not copied.  Terms should be unique. */
+void atl_cursor_terms_add(atl_cursor_terms_t *h, const char *term,
+                          const uint32_t *ids, uint32_t num_ids);
+
+/* Sort the terms.  This must be called after the last add and before anything below. */
+void atl_cursor_terms_freeze(atl_cursor_terms_t *h);
+
+uint32_t atl_cursor_terms_size(atl_cursor_terms_t *h);
+const char *atl_cursor_terms_term(atl_cursor_terms_t *h, uint32_t index);
+const uint32_t *atl_cursor_terms_ids(atl_cursor_terms_t *h, uint32_t index, uint32_t *num_ids);
+
+/* Sets index to the position of term, returns false if it isn't in the dictionary. */
+bool atl_cursor_terms_find(atl_cursor_terms_t *h, const char *term, uint32_t *index);
+
+/* Sets [*start, *end) to the terms which begin with the first len bytes of prefix and returns
+   the number of them. */
+uint32_t atl_cursor_terms_prefix(atl_cursor_terms_t *h, const char *prefix, size_t len,
+                                 uint32_t *start, uint32_t *end);
+
+/* A cursor over the union of the postings of every term matching pattern, where '*' matches
+   any run of bytes and '?' any one byte.  The terms are narrowed to the prefix before the
+   first wildcard and the rest is matched against each of them.  A few terms are merged with
+   an OR cursor while larger expansions are accumulated into a bitmap (or, when the ids are
+   sparse, a sorted array) up front. */
+atl_cursor_t *atl_cursor_terms_open(aml_pool_t *pool, atl_cursor_terms_t *h, const char *pattern);
+
+/* An atl_cursor_custom_cb which opens each leaf with atl_cursor_terms_open (arg is the
+   atl_cursor_terms_t). */
+atl_cursor_t *atl_cursor_terms_cb(aml_pool_t *pool, atl_token_t *t, void *arg);
+
+#endif
@@ -44,6 +44,11 @@ struct atl_token_s {
 
     atl_token_cb_t attr_type;
     bool no_params;
+    /* the token belongs to a dictionary and is shared by every expression which expanded it,
+       it (and everything below it) must not be modified */
+    bool read_only;
+    /* an ATL_TOKEN_NUMBER token with a fraction or exponent, value.d is set instead of value.i */
+    bool is_double;
 
     char **attrs;
     uint32_t num_attrs;
@@ -57,8 +62,16 @@ struct atl_token_s {
 
     size_t pos;  /* offset in the original string */
     size_t len;  /* length in the original string */
+
+    /* the value of an ATL_TOKEN_NUMBER token (see ATL_TOKEN_PARSE_NUMBERS) */
+    union {
+        int64_t i;
+        double d;
+    } value;
 };
 
+/* A copy of t and its siblings with their children, attrs and attr chains (in a single
+   allocation from pool).  The copy is never read only. */
 atl_token_t *atl_token_clone(aml_pool_t *pool, atl_token_t *t);
 
 void atl_token_dump(atl_token_t *t);
@@ -66,12 +79,23 @@ atl_token_t *atl_token_parse(aml_pool_t *pool, const char *s);
 size_t atl_token_count(const char *s);
 const char *atl_token_skip(const char *s, size_t n);
 
+typedef struct {
+    const char *text;
+    size_t len;
+} atl_token_span_t;
+
 typedef struct {
     aml_pool_t *pool;
     char *param;
     char **attrs;
     uint32_t num_attrs;
 
+    /* the token as it appears in the expression (not NUL terminated), with
+       ATL_TOKEN_PARSE_SPANS param and attrs are NULL and attr_spans has the attrs */
+    const char *text;
+    size_t len;
+    atl_token_span_t *attr_spans;
+
     bool no_params;
     bool strip;
     atl_token_t *alt_token;
@@ -83,17 +107,86 @@ typedef atl_token_cb_t (*atl_token_set_var_cb)(void *arg, atl_token_cb_data_t *d
 atl_token_t *atl_token_parse_expression(aml_pool_t *pool, const char *s,
                                         atl_token_set_var_cb cb, void *arg);
 
+/* The callback gets spans of the expression instead of copies of each token and attr.  The
+   callback may shorten len for a token followed by a colon (a parameter).  Text is only
+   copied for the tokens which are kept. */
+#define ATL_TOKEN_PARSE_SPANS 1
+
+/* Unquoted numbers (digits with an optional fraction and exponent, not followed by a letter
+   or digit) become ATL_TOKEN_NUMBER tokens with their value set.  A sign is left as an
+   operator.  Integers which don't fit in an int64_t are stored as doubles. */
+#define ATL_TOKEN_PARSE_NUMBERS 2
+
+atl_token_t *atl_token_parse_expression_ex(aml_pool_t *pool, const char *s,
+                                           atl_token_set_var_cb cb, void *arg, uint32_t flags);
+
+/* Simplify a tree returned from atl_token_parse_expression before it is passed to
+   atl_cursor_open.  Nested groups of the same type are flattened, identical siblings within
+   AND/OR groups are removed, groups with a single child are replaced by the child and branches
+   which can never match (empty groups, AND with an empty member, NOT of an empty positive
+   side) are pruned.  The tree is modified in place and the new root is returned.  NULL is
+   returned if the whole expression can never match.  Phrases and subtrees shared with a
+   dictionary (read_only) are left untouched. */
+atl_token_t *atl_token_optimize(aml_pool_t *pool, atl_token_t *t);
+
+/* A canonical string for the expression rooted at t.  Tokens are lowercased and the children
+   of AND/OR groups are sorted (and repeats removed), so that equivalent expressions such as
+   "B a" and "A b" produce the same string.  Phrases and NOT keep their order. */
+char *atl_token_canonical(aml_pool_t *pool, atl_token_t *t);
+
+/* Keep the case of tokens and attrs in the canonical string, for callers whose leaves are
+   case sensitive. */
+#define ATL_TOKEN_CANONICAL_CASE 1
+
+char *atl_token_canonical_ex(aml_pool_t *pool, atl_token_t *t, uint32_t flags);
+
+typedef struct {
+    atl_token_span_t field;  /* the token without its trailing ':' */
+    double min;              /* -INFINITY if open */
+    double max;              /* INFINITY if open */
+} atl_token_range_t;
+
+/* Interpret t as a numeric range on a field.  The attr of the token may be a..b (as in
+   price:[10..20]), a.. or ..b, a comparison (>a, >=a, <b or <=b, as in price:>=10) or a
+   single value.  Bounds are inclusive, exclusive comparisons are converted to the next
+   representable double.  Returns false if t has no attr or the attr isn't a range. */
+bool atl_token_range(atl_token_t *t, atl_token_range_t *r);
+
 struct atl_token_dict_s;
 typedef struct atl_token_dict_s atl_token_dict_t;
 atl_token_dict_t *atl_token_dict_init();
 atl_token_dict_t *atl_token_dict_load(const char *filename);
 void atl_token_dict_destroy(atl_token_dict_t *h);
 
+/* the number of distinct names in the dictionary */
+uint32_t atl_token_dict_size(atl_token_dict_t *h);
+
 /* name: global|next|skip|normal|number [no_params] [strip] string */
 bool atl_token_dict_add(atl_token_dict_t *h, const char *config_line);
 const char *atl_token_dict_value(atl_token_dict_t *h, const char *param);
 char **atl_token_dict_values(atl_token_dict_t *h, uint32_t *num_values, const char *param);
 
+/* Build a minimal perfect hash over the entries so that each lookup is one probe and one key
+   comparison.  Entries cannot be added once the dictionary is frozen.  Returns false if the
+   hash could not be built, in which case the dictionary is unchanged. */
+bool atl_token_dict_freeze(atl_token_dict_t *h);
+
+/* Write the dictionary (frozen first if needed) as a binary image which atl_token_dict_map
+   can use without parsing anything.  The image is specific to the architecture and version
+   of the library which wrote it. */
+bool atl_token_dict_save(atl_token_dict_t *h, const char *filename);
+
+/* Map an image written by atl_token_dict_save.  The mapping is private, so fixing up the
+   pointers in the nodes, tokens and hash table gives this process its own copy of those pages,
+   while the strings and hash seeds stay shared with other processes mapping the same file.
+   The dictionary is frozen.  Returns NULL if the file is missing or isn't a compatible image,
+   or if any pointer, count or key length in it doesn't fit the section it belongs to. */
+atl_token_dict_t *atl_token_dict_map(const char *filename);
+
+/* true if filename starts like an image written by atl_token_dict_save (whether or not it
+   can be mapped) */
+bool atl_token_dict_is_image(const char *filename);
+
 atl_token_cb_t atl_token_dict_cb(void *arg, atl_token_cb_data_t *d);
 
 #endif
\ No newline at end of file
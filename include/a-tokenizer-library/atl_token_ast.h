@@ -0,0 +1,87 @@
+// SPDX-FileCopyrightText:  2023 Andy Curtis <contactandyc@gmail.com>
+// SPDX-License-Identifier: Apache-2.0
+#ifndef _atl_token_ast_h
+#define _atl_token_ast_h
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "a-memory-library/aml_pool.h"
+#include "a-tokenizer-library/atl_token.h"
+
+/*
+    A compact form of a token tree.  The nodes are stored in one array in pre-order (so the
+    first node is the root and a child or next sibling always follows its parent) and refer
+    to each other by index.  0 is used for no child, sibling or attr.  The token text and
+    attrs of every node are NUL terminated strings in one arena.
+*/
+
+typedef struct {
+    uint64_t value;     /* the bits of atl_token_t value */
+    uint32_t token;     /* offset in strings */
+    uint32_t child;
+    uint32_t next;
+    uint32_t attr;      /* first token of the attr chain */
+    uint32_t attrs;     /* index of the first attr in attrs */
+    uint32_t num_attrs;
+    uint32_t pos;
+    uint32_t len;
+    uint8_t type;       /* atl_token_type_t */
+    uint8_t attr_type;  /* atl_token_cb_t */
+    uint8_t no_params;
+    uint8_t is_double;
+    uint32_t reserved;
+} atl_token_ast_node_t;
+
+typedef struct {
+    atl_token_ast_node_t *nodes;
+    uint32_t num_nodes;
+
+    uint32_t *attrs;    /* offsets in strings */
+    uint32_t num_attrs;
+
+    char *strings;
+    uint32_t strings_len;
+} atl_token_ast_t;
+
+/* The ast for t and its siblings, allocated from pool.  Returns NULL if t is NULL. */
+atl_token_ast_t *atl_token_ast_init(aml_pool_t *pool, atl_token_t *t);
+
+/* A token tree for the ast (in a single allocation from pool). */
+atl_token_t *atl_token_ast_tree(aml_pool_t *pool, const atl_token_ast_t *ast);
+
+/* A standalone token for node (its attr chain is converted, but not its children or
+   siblings).  The token text is not copied.  This is what custom cursor callbacks are given
+   by atl_cursor_open_ast. */
+atl_token_t *atl_token_ast_token(aml_pool_t *pool, const atl_token_ast_t *ast, uint32_t node);
+
+/*
+    Encoding
+
+    header | nodes | attrs | strings
+
+    The sections are the arrays of the ast as they are in memory, so decoding only checks the
+    header and links and points an ast at the buffer.  The header records the version, byte
+    order and node size and a buffer written by a different build is rejected rather than
+    converted.  Every link must refer to a later node and every node other than the first
+    must be referred to exactly once, so a decoded ast is always a tree.
+*/
+
+/* The number of bytes atl_token_ast_encode writes for ast. */
+size_t atl_token_ast_encoded_size(const atl_token_ast_t *ast);
+
+/* Write ast to buf (which must have room for atl_token_ast_encoded_size bytes), returns the
+   number of bytes written. */
+size_t atl_token_ast_encode(void *buf, const atl_token_ast_t *ast);
+
+/* Point ast at the encoding in buf (which must be 8 byte aligned).  Nothing is copied, so
+   buf must outlive ast and neither should be modified.  Returns false if buf isn't a valid
+   encoding. */
+bool atl_token_ast_decode(atl_token_ast_t *ast, const void *buf, size_t len);
+
+static inline
+const char *atl_token_ast_text(const atl_token_ast_t *ast, uint32_t node) {
+    return ast->strings + ast->nodes[node].token;
+}
+
+#endif
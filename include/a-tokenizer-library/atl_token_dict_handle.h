@@ -0,0 +1,54 @@
+// SPDX-FileCopyrightText:  2023 Andy Curtis <contactandyc@gmail.com>
+// SPDX-License-Identifier: Apache-2.0
+#ifndef _atl_token_dict_handle_h
+#define _atl_token_dict_handle_h
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include "a-tokenizer-library/atl_token.h"
+
+/*
+    A dictionary which can be replaced while other threads are using it.  Readers pin the
+    current dictionary without taking a lock (an atomic increment between two loads of the
+    epoch, retried if a publisher moved it, then a load of the dictionary), use it (for
+    example as the arg to atl_token_dict_cb) and unpin it (an atomic decrement).  Tokens returned from the
+    dictionary share its memory, so anything parsed with it must not be used after the
+    matching unpin.
+
+    A new dictionary is published by swapping a pointer.  The previous one is destroyed once
+    every reader which could have pinned it has unpinned (a grace period), which only the
+    publishing thread waits for.  atl_token_dict_handle_reload does the loading, publishing
+    and waiting on a background thread.
+*/
+
+struct atl_token_dict_handle_s;
+typedef struct atl_token_dict_handle_s atl_token_dict_handle_t;
+
+/* dict (which may be NULL) is owned by the handle from now on */
+atl_token_dict_handle_t *atl_token_dict_handle_init(atl_token_dict_t *dict);
+
+/* waits for a pending reload, no dictionary may be pinned */
+void atl_token_dict_handle_destroy(atl_token_dict_handle_t *h);
+
+/* The current dictionary (possibly NULL).  pin must be passed to atl_token_dict_handle_unpin
+   once the dictionary (and anything parsed with it) is no longer needed. */
+atl_token_dict_t *atl_token_dict_handle_pin(atl_token_dict_handle_t *h, uint32_t *pin);
+void atl_token_dict_handle_unpin(atl_token_dict_handle_t *h, uint32_t pin);
+
+/* Make dict current, wait for the readers of the previous dictionary and destroy it. */
+void atl_token_dict_handle_publish(atl_token_dict_handle_t *h, atl_token_dict_t *dict);
+
+/* Load filename (an image written by atl_token_dict_save or a config file which is loaded
+   and frozen) on a background thread and publish it.  An image which can't be mapped or a
+   config without any valid entries fails the reload and the current dictionary is kept.
+   Returns false if a reload is already running.  reload, wait and destroy should be called
+   from one thread. */
+bool atl_token_dict_handle_reload(atl_token_dict_handle_t *h, const char *filename);
+
+/* Wait for a pending reload, returns false if the last reload failed to load its file. */
+bool atl_token_dict_handle_wait(atl_token_dict_handle_t *h);
+
+/* incremented each time a dictionary is published */
+uint64_t atl_token_dict_handle_version(atl_token_dict_handle_t *h);
+
+#endif
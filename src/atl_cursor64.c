@@ -0,0 +1,18 @@
+// SPDX-FileCopyrightText:  2023 Andy Curtis <contactandyc@gmail.com>
+// SPDX-License-Identifier: Apache-2.0
+#include "a-tokenizer-library/atl_cursor64.h"
+
+#include "a-memory-library/aml_alloc.h"
+#include "a-memory-library/aml_pool.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <math.h>
+
+#define CURSOR_T atl_cursor64_t
+#define CURSOR_ID_T uint64_t
+#define CURSOR_FN(name) atl_cursor64_##name
+
+#include "atl_cursor_template.h"
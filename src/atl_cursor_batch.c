@@ -0,0 +1,309 @@
+// SPDX-FileCopyrightText:  2023 Andy Curtis <contactandyc@gmail.com>
+// SPDX-License-Identifier: Apache-2.0
+#include "a-tokenizer-library/atl_cursor_batch.h"
+#include "a-tokenizer-library/atl_cursor_parallel.h"
+
+#include "a-memory-library/aml_alloc.h"
+#include "a-memory-library/aml_buffer.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+
+typedef struct {
+    atl_token_t *token;
+    char *key;
+    uint64_t hash;
+} batch_subtree_t;
+
+typedef struct {
+    batch_subtree_t *subtree; /* first occurrence */
+    uint32_t count;
+    int32_t shared;           /* index into shared or -1 */
+} batch_key_t;
+
+typedef struct {
+    atl_token_t *token;
+    uint32_t *ids;
+    uint32_t num_ids;
+    uint64_t *bits;           /* used instead of ids when the result is dense */
+    uint32_t num_bits;
+} batch_shared_t;
+
+typedef struct {
+    aml_pool_t *pool;
+    atl_cursor_custom_cb cb;
+    void *arg;
+
+    atl_token_t **roots;
+    uint32_t num_roots;
+
+    batch_subtree_t *subtrees; /* sorted by token */
+    uint32_t num_subtrees;
+
+    batch_key_t *keys;         /* open addressing table */
+    uint32_t keys_mask;
+
+    batch_shared_t *shared;
+    uint32_t num_shared;
+
+    /* leaf tokens which stand in for shared subtrees */
+    atl_token_t *subs;
+    uint32_t *sub_shared;
+    uint32_t num_subs;
+
+    aml_pool_t **thread_pools;
+    aml_buffer_t **results;
+} batch_t;
+
+static inline
+bool batch_candidate(atl_token_t *t) {
+    return t->child && (t->type == ATL_TOKEN_OPEN_PAREN || t->type == ATL_TOKEN_OR ||
+                        t->type == ATL_TOKEN_NOT || t->type == ATL_TOKEN_DQUOTE);
+}
+
+static
+uint64_t hash_key(const char *key) {
+    uint64_t h = 14695981039346656037ULL;
+    for( ; *key; key++ )
+        h = (h ^ (unsigned char)*key) * 1099511628211ULL;
+    return h;
+}
+
+static
+void collect_subtrees(batch_t *b, aml_buffer_t *bh, atl_token_t *t) {
+    for( ; t; t=t->next ) {
+        if(!batch_candidate(t))
+            continue;
+        batch_subtree_t st;
+        st.token = t;
+        st.key = atl_token_canonical_ex(b->pool, t, ATL_TOKEN_CANONICAL_CASE);
+        st.hash = hash_key(st.key);
+        aml_buffer_append(bh, &st, sizeof(st));
+        collect_subtrees(b, bh, t->child);
+    }
+}
+
+static
+int compare_subtrees(const void *a, const void *b) {
+    const batch_subtree_t *sa = (const batch_subtree_t *)a;
+    const batch_subtree_t *sb = (const batch_subtree_t *)b;
+    if(sa->token == sb->token)
+        return 0;
+    return (uintptr_t)sa->token < (uintptr_t)sb->token ? -1 : 1;
+}
+
+static
+batch_subtree_t *find_subtree(batch_t *b, atl_token_t *t) {
+    uint32_t lo = 0, hi = b->num_subtrees;
+    while(lo < hi) {
+        uint32_t mid = lo + ((hi-lo) >> 1);
+        if((uintptr_t)b->subtrees[mid].token < (uintptr_t)t)
+            lo = mid+1;
+        else
+            hi = mid;
+    }
+    return lo < b->num_subtrees && b->subtrees[lo].token == t ? b->subtrees + lo : NULL;
+}
+
+static
+batch_key_t *find_key(batch_t *b, batch_subtree_t *st) {
+    uint32_t slot = (uint32_t)st->hash & b->keys_mask;
+    while(b->keys[slot].subtree) {
+        batch_subtree_t *o = b->keys[slot].subtree;
+        if(o->hash == st->hash && !strcmp(o->key, st->key))
+            return b->keys + slot;
+        slot = (slot+1) & b->keys_mask;
+    }
+    return b->keys + slot;
+}
+
+static
+void count_keys(batch_t *b) {
+    uint32_t size = 16;
+    while(size < b->num_subtrees * 2)
+        size <<= 1;
+    b->keys_mask = size-1;
+    b->keys = (batch_key_t *)aml_pool_zalloc(b->pool, sizeof(batch_key_t) * size);
+    for( uint32_t i=0; i<b->num_subtrees; i++ ) {
+        batch_key_t *k = find_key(b, b->subtrees + i);
+        if(!k->subtree) {
+            k->subtree = b->subtrees + i;
+            k->shared = -1;
+        }
+        k->count++;
+    }
+}
+
+/* replace the largest repeated subtrees with leaf tokens which refer to a shared result */
+static
+atl_token_t *substitute(batch_t *b, atl_token_t *t) {
+    if(!batch_candidate(t))
+        return t;
+    batch_subtree_t *st = find_subtree(b, t);
+    batch_key_t *k = find_key(b, st);
+    if(k->count > 1) {
+        if(k->shared < 0) {
+            k->shared = b->num_shared;
+            b->shared[b->num_shared].token = k->subtree->token;
+            b->num_shared++;
+        }
+        atl_token_t *sub = b->subs + b->num_subs;
+        b->sub_shared[b->num_subs] = k->shared;
+        b->num_subs++;
+        sub->token = (char *)"";
+        sub->type = ATL_TOKEN_TOKEN;
+        sub->parent = t->parent;
+        sub->prev = t->prev;
+        sub->next = t->next;
+        return sub;
+    }
+    /* children shared with a dictionary can't be relinked */
+    if(t->child->read_only)
+        return t;
+
+    atl_token_t *n = t->child;
+    while(n) {
+        atl_token_t *next = n->next;
+        atl_token_t *r = substitute(b, n);
+        if(r != n) {
+            if(r->prev)
+                r->prev->next = r;
+            else
+                t->child = r;
+            if(r->next)
+                r->next->prev = r;
+        }
+        n = next;
+    }
+    return t;
+}
+
+static
+atl_cursor_t *batch_leaf(aml_pool_t *pool, atl_token_t *t, void *arg) {
+    batch_t *b = (batch_t *)arg;
+    if(t >= b->subs && t < b->subs + b->num_subs) {
+        batch_shared_t *s = b->shared + b->sub_shared[t - b->subs];
+        if(s->bits)
+            return atl_cursor_bitmap(pool, s->bits, s->num_bits);
+        return atl_cursor_array(pool, s->ids, s->num_ids);
+    }
+    return b->cb(pool, t, b->arg);
+}
+
+static
+aml_pool_t *batch_thread_pool(batch_t *b, uint32_t thread) {
+    if(!b->thread_pools[thread])
+        b->thread_pools[thread] = aml_pool_init(16384);
+    else
+        aml_pool_clear(b->thread_pools[thread]);
+    return b->thread_pools[thread];
+}
+
+static
+void materialize(void *arg, uint32_t task, uint32_t thread) {
+    batch_t *b = (batch_t *)arg;
+    batch_shared_t *s = b->shared + task;
+    aml_pool_t *pool = batch_thread_pool(b, thread);
+    atl_cursor_t *c = atl_cursor_open(pool, b->cb, s->token, b->arg);
+    aml_buffer_t *bh = aml_buffer_pool_init(pool, 256 * sizeof(uint32_t));
+    while(c->advance(c))
+        aml_buffer_append(bh, &c->id, sizeof(c->id));
+
+    uint32_t *ids = (uint32_t *)aml_buffer_data(bh);
+    uint32_t num_ids = aml_buffer_length(bh) / sizeof(uint32_t);
+    uint32_t num_bits = num_ids ? ids[num_ids-1] + 1 : 0;
+    size_t bitmap_bytes = ((num_bits + 63) >> 6) * sizeof(uint64_t);
+    if(num_ids && bitmap_bytes < num_ids * sizeof(uint32_t)) {
+        s->bits = (uint64_t *)aml_malloc(bitmap_bytes);
+        memset(s->bits, 0, bitmap_bytes);
+        for( uint32_t i=0; i<num_ids; i++ )
+            s->bits[ids[i] >> 6] |= 1ULL << (ids[i] & 63);
+        s->num_bits = num_bits;
+    }
+    else {
+        s->ids = (uint32_t *)aml_malloc(sizeof(uint32_t) * (num_ids+1));
+        memcpy(s->ids, ids, sizeof(uint32_t) * num_ids);
+        s->num_ids = num_ids;
+    }
+}
+
+static
+void run_query(void *arg, uint32_t task, uint32_t thread) {
+    batch_t *b = (batch_t *)arg;
+    aml_buffer_t *bh = aml_buffer_init(256 * sizeof(uint32_t));
+    b->results[task] = bh;
+    if(!b->roots[task])
+        return;
+    aml_pool_t *pool = batch_thread_pool(b, thread);
+    atl_cursor_t *c = atl_cursor_open(pool, batch_leaf, b->roots[task], b);
+    while(c->advance(c))
+        aml_buffer_append(bh, &c->id, sizeof(c->id));
+}
+
+atl_cursor_batch_result_t *atl_cursor_batch(aml_pool_t *pool,
+                                            const char **expressions, uint32_t num_expressions,
+                                            atl_token_set_var_cb parse_cb, void *parse_arg,
+                                            atl_cursor_custom_cb cb, void *arg,
+                                            uint32_t num_threads) {
+    atl_cursor_batch_result_t *results =
+        (atl_cursor_batch_result_t *)aml_pool_zalloc(pool, sizeof(*results) * (num_expressions+1));
+    if(!num_expressions)
+        return results;
+    if(!num_threads)
+        num_threads = atl_cursor_parallel_threads();
+
+    batch_t b;
+    memset(&b, 0, sizeof(b));
+    b.pool = aml_pool_init(16384);
+    b.cb = cb;
+    b.arg = arg;
+    b.num_roots = num_expressions;
+    b.roots = (atl_token_t **)aml_pool_alloc(b.pool, sizeof(atl_token_t *) * num_expressions);
+
+    aml_buffer_t *bh = aml_buffer_pool_init(b.pool, 64 * sizeof(batch_subtree_t));
+    for( uint32_t i=0; i<num_expressions; i++ ) {
+        atl_token_t *t = atl_token_parse_expression(b.pool, expressions[i], parse_cb, parse_arg);
+        b.roots[i] = atl_token_optimize(b.pool, t);
+        if(b.roots[i])
+            collect_subtrees(&b, bh, b.roots[i]);
+    }
+    b.num_subtrees = aml_buffer_length(bh) / sizeof(batch_subtree_t);
+    b.subtrees = (batch_subtree_t *)aml_buffer_data(bh);
+    qsort(b.subtrees, b.num_subtrees, sizeof(batch_subtree_t), compare_subtrees);
+    count_keys(&b);
+
+    b.shared = (batch_shared_t *)aml_pool_zalloc(b.pool, sizeof(batch_shared_t) * (b.num_subtrees+1));
+    b.subs = (atl_token_t *)aml_pool_zalloc(b.pool, sizeof(atl_token_t) * (b.num_subtrees+1));
+    b.sub_shared = (uint32_t *)aml_pool_alloc(b.pool, sizeof(uint32_t) * (b.num_subtrees+1));
+    for( uint32_t i=0; i<num_expressions; i++ ) {
+        if(b.roots[i]) {
+            b.roots[i] = substitute(&b, b.roots[i]);
+            b.roots[i]->parent = b.roots[i]->prev = b.roots[i]->next = NULL;
+        }
+    }
+
+    b.thread_pools = (aml_pool_t **)aml_pool_zalloc(b.pool, sizeof(aml_pool_t *) * num_threads);
+    b.results = (aml_buffer_t **)aml_pool_zalloc(b.pool, sizeof(aml_buffer_t *) * num_expressions);
+    atl_cursor_parallel_for(b.num_shared, num_threads, materialize, &b);
+    atl_cursor_parallel_for(num_expressions, num_threads, run_query, &b);
+
+    for( uint32_t i=0; i<num_expressions; i++ ) {
+        uint32_t num_ids = aml_buffer_length(b.results[i]) / sizeof(uint32_t);
+        results[i].num_ids = num_ids;
+        results[i].ids = (uint32_t *)aml_pool_alloc(pool, sizeof(uint32_t) * (num_ids+1));
+        memcpy(results[i].ids, aml_buffer_data(b.results[i]), sizeof(uint32_t) * num_ids);
+        aml_buffer_destroy(b.results[i]);
+    }
+    for( uint32_t i=0; i<b.num_shared; i++ ) {
+        if(b.shared[i].bits)
+            aml_free(b.shared[i].bits);
+        if(b.shared[i].ids)
+            aml_free(b.shared[i].ids);
+    }
+    for( uint32_t i=0; i<num_threads; i++ )
+        if(b.thread_pools[i])
+            aml_pool_destroy(b.thread_pools[i]);
+    aml_pool_destroy(b.pool);
+    return results;
+}
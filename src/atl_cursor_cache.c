@@ -0,0 +1,331 @@
+// SPDX-FileCopyrightText:  2023 Andy Curtis <contactandyc@gmail.com>
+// SPDX-License-Identifier: Apache-2.0
+#include "a-tokenizer-library/atl_cursor_cache.h"
+
+#include "a-memory-library/aml_alloc.h"
+#include "a-memory-library/aml_buffer.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+
+struct cache_entry_s;
+typedef struct cache_entry_s cache_entry_t;
+
+struct cache_entry_s {
+    cache_entry_t *hash_next;
+    cache_entry_t *lru_prev;
+    cache_entry_t *lru_next;
+
+    uint64_t hash;
+    size_t size;
+    uint32_t num_ids;
+    uint32_t key_len;
+    uint32_t data_len;
+    /* key (zero terminated) followed by encoded ids */
+};
+
+struct atl_cursor_cache_s {
+    cache_entry_t **buckets;
+    uint32_t num_buckets;
+    uint32_t num_entries;
+
+    cache_entry_t *lru_head; /* most recently used */
+    cache_entry_t *lru_tail;
+
+    size_t max_bytes;
+    size_t bytes_used;
+
+    size_t hits;
+    size_t misses;
+};
+
+static inline
+char *entry_key(cache_entry_t *e) {
+    return (char *)(e+1);
+}
+
+static inline
+uint8_t *entry_data(cache_entry_t *e) {
+    return (uint8_t *)(e+1) + e->key_len + 1;
+}
+
+static
+uint64_t hash_key(const char *key) {
+    uint64_t h = 14695981039346656037ULL;
+    for( ; *key; key++ )
+        h = (h ^ (unsigned char)*key) * 1099511628211ULL;
+    return h;
+}
+
+atl_cursor_cache_t *atl_cursor_cache_init(size_t max_bytes) {
+    atl_cursor_cache_t *cache = (atl_cursor_cache_t *)aml_malloc(sizeof(*cache));
+    memset(cache, 0, sizeof(*cache));
+    cache->num_buckets = 64;
+    cache->buckets = (cache_entry_t **)aml_malloc(sizeof(cache_entry_t *) * cache->num_buckets);
+    memset(cache->buckets, 0, sizeof(cache_entry_t *) * cache->num_buckets);
+    cache->max_bytes = max_bytes;
+    return cache;
+}
+
+void atl_cursor_cache_clear(atl_cursor_cache_t *cache) {
+    cache_entry_t *e = cache->lru_head;
+    while(e) {
+        cache_entry_t *next = e->lru_next;
+        aml_free(e);
+        e = next;
+    }
+    memset(cache->buckets, 0, sizeof(cache_entry_t *) * cache->num_buckets);
+    cache->lru_head = cache->lru_tail = NULL;
+    cache->num_entries = 0;
+    cache->bytes_used = 0;
+}
+
+void atl_cursor_cache_destroy(atl_cursor_cache_t *cache) {
+    atl_cursor_cache_clear(cache);
+    aml_free(cache->buckets);
+    aml_free(cache);
+}
+
+static
+void lru_unlink(atl_cursor_cache_t *cache, cache_entry_t *e) {
+    if(e->lru_prev)
+        e->lru_prev->lru_next = e->lru_next;
+    else
+        cache->lru_head = e->lru_next;
+    if(e->lru_next)
+        e->lru_next->lru_prev = e->lru_prev;
+    else
+        cache->lru_tail = e->lru_prev;
+    e->lru_prev = e->lru_next = NULL;
+}
+
+static
+void lru_push_front(atl_cursor_cache_t *cache, cache_entry_t *e) {
+    e->lru_prev = NULL;
+    e->lru_next = cache->lru_head;
+    if(cache->lru_head)
+        cache->lru_head->lru_prev = e;
+    else
+        cache->lru_tail = e;
+    cache->lru_head = e;
+}
+
+static
+cache_entry_t *cache_find(atl_cursor_cache_t *cache, const char *key, uint64_t hash) {
+    cache_entry_t *e = cache->buckets[hash & (cache->num_buckets-1)];
+    while(e) {
+        if(e->hash == hash && !strcmp(entry_key(e), key))
+            return e;
+        e = e->hash_next;
+    }
+    return NULL;
+}
+
+static
+void cache_remove(atl_cursor_cache_t *cache, cache_entry_t *e) {
+    cache_entry_t **p = cache->buckets + (e->hash & (cache->num_buckets-1));
+    while(*p != e)
+        p = &((*p)->hash_next);
+    *p = e->hash_next;
+    lru_unlink(cache, e);
+    cache->num_entries--;
+    cache->bytes_used -= e->size;
+    aml_free(e);
+}
+
+static
+void cache_grow(atl_cursor_cache_t *cache) {
+    uint32_t num_buckets = cache->num_buckets * 2;
+    cache_entry_t **buckets = (cache_entry_t **)aml_malloc(sizeof(cache_entry_t *) * num_buckets);
+    memset(buckets, 0, sizeof(cache_entry_t *) * num_buckets);
+    for( uint32_t i=0; i<cache->num_buckets; i++ ) {
+        cache_entry_t *e = cache->buckets[i];
+        while(e) {
+            cache_entry_t *next = e->hash_next;
+            cache_entry_t **b = buckets + (e->hash & (num_buckets-1));
+            e->hash_next = *b;
+            *b = e;
+            e = next;
+        }
+    }
+    aml_free(cache->buckets);
+    cache->buckets = buckets;
+    cache->num_buckets = num_buckets;
+}
+
+/* ids are stored as varint encoded deltas from the previous id */
+static
+uint32_t encode_ids(uint8_t *dest, const uint32_t *ids, uint32_t num_ids) {
+    uint8_t *p = dest;
+    uint32_t prev = 0;
+    for( uint32_t i=0; i<num_ids; i++ ) {
+        uint32_t v = ids[i] - prev;
+        prev = ids[i];
+        while(v >= 0x80) {
+            *p++ = (uint8_t)(v | 0x80);
+            v >>= 7;
+        }
+        *p++ = (uint8_t)v;
+    }
+    return p - dest;
+}
+
+static
+uint32_t encoded_size(const uint32_t *ids, uint32_t num_ids) {
+    uint32_t len = 0;
+    uint32_t prev = 0;
+    for( uint32_t i=0; i<num_ids; i++ ) {
+        uint32_t v = ids[i] - prev;
+        prev = ids[i];
+        len++;
+        while(v >= 0x80) {
+            len++;
+            v >>= 7;
+        }
+    }
+    return len;
+}
+
+static
+void decode_ids(uint32_t *ids, const uint8_t *p, uint32_t num_ids) {
+    uint32_t prev = 0;
+    for( uint32_t i=0; i<num_ids; i++ ) {
+        uint32_t v = 0;
+        int shift = 0;
+        while(*p & 0x80) {
+            v |= (uint32_t)(*p++ & 0x7F) << shift;
+            shift += 7;
+        }
+        v |= (uint32_t)(*p++) << shift;
+        prev += v;
+        ids[i] = prev;
+    }
+}
+
+static
+void cache_insert(atl_cursor_cache_t *cache, const char *key, uint64_t hash,
+                  const uint32_t *ids, uint32_t num_ids) {
+    uint32_t key_len = strlen(key);
+    uint32_t data_len = encoded_size(ids, num_ids);
+    size_t size = sizeof(cache_entry_t) + key_len + 1 + data_len;
+    if(size > cache->max_bytes)
+        return;
+
+    while(cache->lru_tail && cache->bytes_used + size > cache->max_bytes)
+        cache_remove(cache, cache->lru_tail);
+
+    cache_entry_t *e = (cache_entry_t *)aml_malloc(size);
+    e->hash = hash;
+    e->size = size;
+    e->num_ids = num_ids;
+    e->key_len = key_len;
+    e->data_len = data_len;
+    memcpy(entry_key(e), key, key_len+1);
+    encode_ids(entry_data(e), ids, num_ids);
+
+    if(cache->num_entries >= cache->num_buckets)
+        cache_grow(cache);
+    cache_entry_t **b = cache->buckets + (hash & (cache->num_buckets-1));
+    e->hash_next = *b;
+    *b = e;
+    lru_push_front(cache, e);
+    cache->num_entries++;
+    cache->bytes_used += size;
+}
+
+atl_cursor_t *atl_cursor_cache_open(atl_cursor_cache_t *cache, aml_pool_t *pool,
+                                    atl_cursor_custom_cb cb, atl_token_t *t, void *arg) {
+    if(!t)
+        return atl_cursor_init_empty(pool);
+
+    char *key = atl_token_canonical(pool, t);
+    uint64_t hash = hash_key(key);
+    cache_entry_t *e = cache_find(cache, key, hash);
+    if(e) {
+        cache->hits++;
+        if(e != cache->lru_head) {
+            lru_unlink(cache, e);
+            lru_push_front(cache, e);
+        }
+        uint32_t *ids = (uint32_t *)aml_pool_alloc(pool, sizeof(uint32_t) * (e->num_ids+1));
+        decode_ids(ids, entry_data(e), e->num_ids);
+        return atl_cursor_array(pool, ids, e->num_ids);
+    }
+    cache->misses++;
+
+    atl_cursor_t *c = atl_cursor_open(pool, cb, t, arg);
+    aml_buffer_t *bh = aml_buffer_pool_init(pool, 256 * sizeof(uint32_t));
+    while(c->advance(c))
+        aml_buffer_append(bh, &c->id, sizeof(c->id));
+
+    uint32_t num_ids = aml_buffer_length(bh) / sizeof(uint32_t);
+    uint32_t *ids = (uint32_t *)aml_pool_alloc(pool, sizeof(uint32_t) * (num_ids+1));
+    memcpy(ids, aml_buffer_data(bh), sizeof(uint32_t) * num_ids);
+    cache_insert(cache, key, hash, ids, num_ids);
+    return atl_cursor_array(pool, ids, num_ids);
+}
+
+bool atl_cursor_cache_invalidate(atl_cursor_cache_t *cache, atl_token_t *t) {
+    if(!t)
+        return false;
+    aml_pool_t *pool = aml_pool_init(1024);
+    char *key = atl_token_canonical(pool, t);
+    cache_entry_t *e = cache_find(cache, key, hash_key(key));
+    if(e)
+        cache_remove(cache, e);
+    aml_pool_destroy(pool);
+    return e ? true : false;
+}
+
+static inline
+bool is_key_delimiter(char ch) {
+    return ch == 0 || ch == ' ' || ch == '(' || ch == ')' || ch == '[' || ch == ']' ||
+           ch == '{' || ch == '}' || ch == ',' || ch == ':' || ch == '#';
+}
+
+/* true if key contains term as a whole (canonical) token */
+static
+bool key_has_term(const char *key, const char *term, size_t term_len) {
+    const char *p = key;
+    while((p = strstr(p, term)) != NULL) {
+        bool starts = p == key || (is_key_delimiter(p[-1]) && (p == key+1 || p[-2] != '\\'));
+        if(starts && is_key_delimiter(p[term_len]))
+            return true;
+        p++;
+    }
+    return false;
+}
+
+uint32_t atl_cursor_cache_invalidate_term(atl_cursor_cache_t *cache, const char *term) {
+    /* build the canonical form of the term by parsing it as a single token */
+    aml_pool_t *pool = aml_pool_init(1024);
+    atl_token_t tok;
+    memset(&tok, 0, sizeof(tok));
+    tok.token = (char *)term;
+    char *key = atl_token_canonical(pool, &tok);
+    size_t key_len = strlen(key);
+
+    uint32_t removed = 0;
+    cache_entry_t *e = cache->lru_head;
+    while(e && key_len) {
+        cache_entry_t *next = e->lru_next;
+        if(key_has_term(entry_key(e), key, key_len)) {
+            cache_remove(cache, e);
+            removed++;
+        }
+        e = next;
+    }
+    aml_pool_destroy(pool);
+    return removed;
+}
+
+void atl_cursor_cache_stats(atl_cursor_cache_t *cache, size_t *hits, size_t *misses,
+                            size_t *bytes_used) {
+    if(hits)
+        *hits = cache->hits;
+    if(misses)
+        *misses = cache->misses;
+    if(bytes_used)
+        *bytes_used = cache->bytes_used;
+}
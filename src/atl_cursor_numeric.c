@@ -0,0 +1,217 @@
+// SPDX-FileCopyrightText:  2023 Andy Curtis <contactandyc@gmail.com>
+// SPDX-License-Identifier: Apache-2.0
+#include "a-tokenizer-library/atl_cursor_numeric.h"
+
+#include "a-memory-library/aml_alloc.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <math.h>
+
+#define NUMERIC_BLOCK_SHIFT 7
+#define NUMERIC_BLOCK_SIZE (1 << NUMERIC_BLOCK_SHIFT)
+
+struct atl_cursor_numeric_s {
+    uint32_t *ids;
+    uint32_t num_ids;
+
+    /* the values of each block sorted (NaN values are left out) and the position in the
+       block of the id each came from */
+    double *sorted;
+    uint8_t *positions;
+
+    double *block_min;
+    double *block_max;
+    uint32_t *block_values;  /* the number of sorted values in the block */
+    uint32_t num_blocks;
+};
+
+typedef struct {
+    double value;
+    uint32_t pos;
+} numeric_value_t;
+
+static
+int compare_values(const void *p1, const void *p2) {
+    const numeric_value_t *a = (const numeric_value_t *)p1;
+    const numeric_value_t *b = (const numeric_value_t *)p2;
+    if(a->value != b->value)
+        return a->value < b->value ? -1 : 1;
+    return a->pos < b->pos ? -1 : a->pos > b->pos ? 1 : 0;
+}
+
+atl_cursor_numeric_t *atl_cursor_numeric_init(const uint32_t *ids, const double *values,
+                                              uint32_t num_ids) {
+    uint32_t num_blocks = (num_ids + NUMERIC_BLOCK_SIZE - 1) >> NUMERIC_BLOCK_SHIFT;
+    size_t len = sizeof(atl_cursor_numeric_t) +
+                 sizeof(double) * (num_ids + num_blocks * 2) +
+                 sizeof(uint32_t) * (num_ids + num_blocks) + num_ids;
+    atl_cursor_numeric_t *h = (atl_cursor_numeric_t *)aml_malloc(len);
+    h->num_ids = num_ids;
+    h->num_blocks = num_blocks;
+    h->sorted = (double *)(h+1);
+    h->block_min = h->sorted + num_ids;
+    h->block_max = h->block_min + num_blocks;
+    h->ids = (uint32_t *)(h->block_max + num_blocks);
+    h->block_values = h->ids + num_ids;
+    h->positions = (uint8_t *)(h->block_values + num_blocks);
+    memcpy(h->ids, ids, sizeof(uint32_t) * num_ids);
+
+    numeric_value_t block[NUMERIC_BLOCK_SIZE];
+    for( uint32_t b=0; b<num_blocks; b++ ) {
+        uint32_t start = b << NUMERIC_BLOCK_SHIFT;
+        uint32_t end = start + NUMERIC_BLOCK_SIZE;
+        if(end > num_ids)
+            end = num_ids;
+        uint32_t n = 0;
+        for( uint32_t i=start; i<end; i++ ) {
+            if(isnan(values[i]))
+                continue;
+            block[n].value = values[i];
+            block[n].pos = i - start;
+            n++;
+        }
+        qsort(block, n, sizeof(numeric_value_t), compare_values);
+        for( uint32_t i=0; i<n; i++ ) {
+            h->sorted[start+i] = block[i].value;
+            h->positions[start+i] = (uint8_t)block[i].pos;
+        }
+        h->block_values[b] = n;
+        h->block_min[b] = n ? block[0].value : INFINITY;
+        h->block_max[b] = n ? block[n-1].value : -INFINITY;
+    }
+    return h;
+}
+
+void atl_cursor_numeric_destroy(atl_cursor_numeric_t *h) {
+    aml_free(h);
+}
+
+typedef struct {
+    atl_cursor_t cursor;
+    atl_cursor_numeric_t *h;
+    double min;
+    double max;
+
+    /* the positions in block next_block-1 which are still to be returned */
+    uint64_t mask[2];
+    uint32_t next_block;
+} numeric_cursor_t;
+
+/* the first of the n sorted values which is not less than (or greater than, if upper) v */
+static inline
+uint32_t numeric_bound(const double *sorted, uint32_t n, double v, bool upper) {
+    uint32_t lo = 0, hi = n;
+    while(lo < hi) {
+        uint32_t mid = lo + ((hi - lo) >> 1);
+        if(sorted[mid] < v || (upper && sorted[mid] == v))
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+static
+void numeric_load(numeric_cursor_t *c, uint32_t b) {
+    atl_cursor_numeric_t *h = c->h;
+    c->mask[0] = c->mask[1] = 0;
+    c->next_block = b + 1;
+    if(h->block_max[b] < c->min || h->block_min[b] > c->max)
+        return;
+
+    uint32_t start = b << NUMERIC_BLOCK_SHIFT;
+    const double *sorted = h->sorted + start;
+    const uint8_t *positions = h->positions + start;
+    uint32_t n = h->block_values[b];
+    uint32_t lo = 0, hi = n;
+    if(h->block_min[b] < c->min)
+        lo = numeric_bound(sorted, n, c->min, false);
+    if(h->block_max[b] > c->max)
+        hi = numeric_bound(sorted, n, c->max, true);
+    for( uint32_t i=lo; i<hi; i++ )
+        c->mask[positions[i] >> 6] |= 1ULL << (positions[i] & 63);
+}
+
+static
+bool advance_numeric(numeric_cursor_t *c) {
+    while(!(c->mask[0] | c->mask[1])) {
+        if(c->next_block >= c->h->num_blocks)
+            return atl_cursor_empty(&c->cursor);
+        numeric_load(c, c->next_block);
+    }
+    uint32_t word = c->mask[0] ? 0 : 1;
+    uint32_t pos = (word << 6) + __builtin_ctzll(c->mask[word]);
+    c->mask[word] &= c->mask[word] - 1;
+    c->cursor.id = c->h->ids[((c->next_block-1) << NUMERIC_BLOCK_SHIFT) + pos];
+    return true;
+}
+
+static
+bool advance_numeric_to(numeric_cursor_t *c, uint32_t id) {
+    /* the next advance should move past the current id even if it was reset */
+    c->cursor.advance = (atl_cursor_advance_cb)advance_numeric;
+    if(c->next_block && id <= c->cursor.id)
+        return true;
+
+    /* the last block starting at or before id */
+    atl_cursor_numeric_t *h = c->h;
+    uint32_t lo = c->next_block ? c->next_block-1 : 0, hi = h->num_blocks;
+    while(hi - lo > 1) {
+        uint32_t mid = lo + ((hi - lo) >> 1);
+        if(h->ids[mid << NUMERIC_BLOCK_SHIFT] <= id)
+            lo = mid;
+        else
+            hi = mid;
+    }
+    if(lo+1 != c->next_block)
+        numeric_load(c, lo);
+
+    /* drop the positions before id */
+    uint32_t start = lo << NUMERIC_BLOCK_SHIFT;
+    uint32_t end = start + NUMERIC_BLOCK_SIZE;
+    if(end > h->num_ids)
+        end = h->num_ids;
+    uint32_t p = 0, n = end - start;
+    const uint32_t *ids = h->ids + start;
+    while(p < n) {
+        uint32_t mid = p + ((n - p) >> 1);
+        if(ids[mid] < id)
+            p = mid + 1;
+        else
+            n = mid;
+    }
+    if(p >= 64) {
+        c->mask[0] = 0;
+        c->mask[1] &= p >= 128 ? 0 : ~0ULL << (p - 64);
+    }
+    else
+        c->mask[0] &= ~0ULL << p;
+    return advance_numeric(c);
+}
+
+static
+bool rewind_numeric(numeric_cursor_t *c) {
+    c->mask[0] = c->mask[1] = 0;
+    c->next_block = 0;
+    c->cursor.id = 0;
+    c->cursor.advance = (atl_cursor_advance_cb)advance_numeric;
+    c->cursor.advance_to = (atl_cursor_advance_to_cb)advance_numeric_to;
+    return true;
+}
+
+atl_cursor_t *atl_cursor_numeric_open(aml_pool_t *pool, atl_cursor_numeric_t *h,
+                                      double min, double max) {
+    if(!h->num_blocks || !(min <= max))
+        return atl_cursor_init_empty(pool);
+    numeric_cursor_t *c = (numeric_cursor_t *)aml_pool_zalloc(pool, sizeof(numeric_cursor_t));
+    atl_cursor_init(&c->cursor, pool, (atl_cursor_advance_cb)advance_numeric,
+                    (atl_cursor_advance_to_cb)advance_numeric_to);
+    c->cursor.rewind = (atl_cursor_rewind_cb)rewind_numeric;
+    c->h = h;
+    c->min = min;
+    c->max = max;
+    rewind_numeric(c);
+    return &c->cursor;
+}
@@ -0,0 +1,243 @@
+// SPDX-FileCopyrightText:  2023 Andy Curtis <contactandyc@gmail.com>
+// SPDX-License-Identifier: Apache-2.0
+#include "a-tokenizer-library/atl_cursor_parallel.h"
+
+#include "a-memory-library/aml_alloc.h"
+#include "a-memory-library/aml_buffer.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <unistd.h>
+
+/* the tasks which remain in a queue are [lo, hi) packed as lo | hi << 32 so that the owner
+   (taking from lo) and thieves (taking from hi) only need a single compare and swap */
+typedef struct {
+    _Atomic uint64_t range;
+    char pad[56];
+} task_queue_t;
+
+typedef struct {
+    task_queue_t *queues;
+    uint32_t num_threads;
+    atl_cursor_task_cb fn;
+    void *arg;
+} task_pool_t;
+
+typedef struct {
+    task_pool_t *tp;
+    uint32_t thread;
+} task_worker_t;
+
+static
+bool queue_pop_front(task_queue_t *q, uint32_t *task) {
+    uint64_t v = atomic_load(&q->range);
+    while(true) {
+        uint32_t lo = (uint32_t)v, hi = (uint32_t)(v >> 32);
+        if(lo >= hi)
+            return false;
+        uint64_t nv = (uint64_t)(lo+1) | ((uint64_t)hi << 32);
+        if(atomic_compare_exchange_weak(&q->range, &v, nv)) {
+            *task = lo;
+            return true;
+        }
+    }
+}
+
+static
+bool queue_pop_back(task_queue_t *q, uint32_t *task) {
+    uint64_t v = atomic_load(&q->range);
+    while(true) {
+        uint32_t lo = (uint32_t)v, hi = (uint32_t)(v >> 32);
+        if(lo >= hi)
+            return false;
+        uint64_t nv = (uint64_t)lo | ((uint64_t)(hi-1) << 32);
+        if(atomic_compare_exchange_weak(&q->range, &v, nv)) {
+            *task = hi-1;
+            return true;
+        }
+    }
+}
+
+static
+void *task_worker(void *arg) {
+    task_worker_t *w = (task_worker_t *)arg;
+    task_pool_t *tp = w->tp;
+    uint32_t task;
+    while(queue_pop_front(tp->queues + w->thread, &task))
+        tp->fn(tp->arg, task, w->thread);
+
+    for( uint32_t i=1; i<tp->num_threads; i++ ) {
+        task_queue_t *victim = tp->queues + ((w->thread + i) % tp->num_threads);
+        while(queue_pop_back(victim, &task))
+            tp->fn(tp->arg, task, w->thread);
+    }
+    return NULL;
+}
+
+uint32_t atl_cursor_parallel_threads(void) {
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return n > 0 ? (uint32_t)n : 1;
+}
+
+void atl_cursor_parallel_for(uint32_t num_tasks, uint32_t num_threads,
+                             atl_cursor_task_cb fn, void *arg) {
+    if(!num_threads)
+        num_threads = atl_cursor_parallel_threads();
+    if(num_threads > num_tasks)
+        num_threads = num_tasks;
+    if(num_threads <= 1) {
+        for( uint32_t i=0; i<num_tasks; i++ )
+            fn(arg, i, 0);
+        return;
+    }
+
+    task_pool_t tp;
+    tp.num_threads = num_threads;
+    tp.fn = fn;
+    tp.arg = arg;
+    tp.queues = (task_queue_t *)aml_malloc(sizeof(task_queue_t) * num_threads);
+    task_worker_t *workers = (task_worker_t *)aml_malloc(sizeof(task_worker_t) * num_threads);
+    pthread_t *threads = (pthread_t *)aml_malloc(sizeof(pthread_t) * num_threads);
+
+    uint32_t lo = 0;
+    for( uint32_t i=0; i<num_threads; i++ ) {
+        uint32_t hi = (uint32_t)(((uint64_t)num_tasks * (i+1)) / num_threads);
+        atomic_init(&tp.queues[i].range, (uint64_t)lo | ((uint64_t)hi << 32));
+        workers[i].tp = &tp;
+        workers[i].thread = i;
+        lo = hi;
+    }
+
+    /* the calling thread acts as worker 0 */
+    for( uint32_t i=1; i<num_threads; i++ )
+        pthread_create(threads+i, NULL, task_worker, workers+i);
+    task_worker(workers);
+    for( uint32_t i=1; i<num_threads; i++ )
+        pthread_join(threads[i], NULL);
+
+    aml_free(threads);
+    aml_free(workers);
+    aml_free(tp.queues);
+}
+
+typedef struct {
+    aml_pool_t *pool;
+    atl_cursor_t *cursor;
+    uint32_t last_end; /* where the cursor was left by the previous chunk */
+} parallel_thread_t;
+
+typedef struct {
+    aml_buffer_t *ids;
+} parallel_chunk_t;
+
+typedef struct {
+    atl_cursor_custom_cb cb;
+    atl_token_t *t;
+    void *arg;
+
+    uint32_t start;
+    uint32_t end;
+    uint32_t chunk_size;
+
+    parallel_thread_t *threads;
+    parallel_chunk_t *chunks;
+} parallel_query_t;
+
+/* position the thread's cursor on the first id >= start */
+static
+bool parallel_seek(parallel_query_t *q, parallel_thread_t *th, uint32_t start) {
+    atl_cursor_t *c = th->cursor;
+    if(c && start < th->last_end && !atl_cursor_rewind(c))
+        c = NULL;
+    if(!c) {
+        aml_pool_clear(th->pool);
+        c = th->cursor = atl_cursor_open(th->pool, q->cb, q->t, q->arg);
+    }
+    if(start == 0)
+        return c->advance(c);
+    return c->advance_to(c, start);
+}
+
+static
+void parallel_chunk(void *arg, uint32_t chunk, uint32_t thread) {
+    parallel_query_t *q = (parallel_query_t *)arg;
+    parallel_thread_t *th = q->threads + thread;
+    uint32_t start = q->start + chunk * q->chunk_size;
+    uint32_t end = start + q->chunk_size;
+    if(end > q->end || end < start)
+        end = q->end;
+
+    if(!th->pool)
+        th->pool = aml_pool_init(16384);
+
+    aml_buffer_t *bh = aml_buffer_init(256 * sizeof(uint32_t));
+    q->chunks[chunk].ids = bh;
+    /* an exhausted cursor can't move forward, so the next chunk always rewinds */
+    th->last_end = (uint32_t)-1;
+    if(!parallel_seek(q, th, start))
+        return;
+
+    atl_cursor_t *c = th->cursor;
+    do {
+        if(c->id >= end) {
+            th->last_end = end;
+            return;
+        }
+        aml_buffer_append(bh, &c->id, sizeof(c->id));
+    } while(c->advance(c));
+}
+
+uint32_t *atl_cursor_parallel(aml_pool_t *pool, atl_cursor_custom_cb cb, atl_token_t *t, void *arg,
+                              uint32_t start, uint32_t end, uint32_t num_threads,
+                              uint32_t *num_ids) {
+    *num_ids = 0;
+    if(!t || start >= end)
+        return NULL;
+    if(!num_threads)
+        num_threads = atl_cursor_parallel_threads();
+
+    /* several chunks per thread so that uneven chunks can be stolen */
+    uint32_t num_chunks = num_threads * 16;
+    uint32_t chunk_size = (uint32_t)(((uint64_t)(end - start) + num_chunks - 1) / num_chunks);
+    if(chunk_size < 4096)
+        chunk_size = 4096;
+    num_chunks = (uint32_t)(((uint64_t)(end - start) + chunk_size - 1) / chunk_size);
+
+    parallel_query_t q;
+    q.cb = cb;
+    q.t = t;
+    q.arg = arg;
+    q.start = start;
+    q.end = end;
+    q.chunk_size = chunk_size;
+    q.threads = (parallel_thread_t *)aml_malloc(sizeof(parallel_thread_t) * num_threads);
+    memset(q.threads, 0, sizeof(parallel_thread_t) * num_threads);
+    q.chunks = (parallel_chunk_t *)aml_malloc(sizeof(parallel_chunk_t) * num_chunks);
+    memset(q.chunks, 0, sizeof(parallel_chunk_t) * num_chunks);
+
+    atl_cursor_parallel_for(num_chunks, num_threads, parallel_chunk, &q);
+
+    /* chunks are disjoint and ordered, so merging is concatenation */
+    size_t total = 0;
+    for( uint32_t i=0; i<num_chunks; i++ )
+        total += aml_buffer_length(q.chunks[i].ids) / sizeof(uint32_t);
+    uint32_t *ids = (uint32_t *)aml_pool_alloc(pool, sizeof(uint32_t) * (total+1));
+    uint32_t *p = ids;
+    for( uint32_t i=0; i<num_chunks; i++ ) {
+        size_t len = aml_buffer_length(q.chunks[i].ids);
+        memcpy(p, aml_buffer_data(q.chunks[i].ids), len);
+        p += len / sizeof(uint32_t);
+        aml_buffer_destroy(q.chunks[i].ids);
+    }
+    for( uint32_t i=0; i<num_threads; i++ )
+        if(q.threads[i].pool)
+            aml_pool_destroy(q.threads[i].pool);
+    aml_free(q.chunks);
+    aml_free(q.threads);
+
+    *num_ids = total;
+    return ids;
+}
@@ -0,0 +1,225 @@
+// SPDX-FileCopyrightText:  2023 Andy Curtis <contactandyc@gmail.com>
+// SPDX-License-Identifier: Apache-2.0
+#include "a-tokenizer-library/atl_cursor_plan.h"
+
+#include "a-memory-library/aml_buffer.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+
+typedef struct {
+    atl_token_t *token;  /* the leaf passed to the callback */
+    atl_token_t *target; /* the leaf or a token in its attr chain */
+    int32_t attr;   /* index into target->attrs or -1 for the target itself */
+    uint32_t param; /* zero based */
+} plan_slot_t;
+
+struct atl_cursor_plan_s {
+    aml_pool_t *pool;
+    atl_token_t *root;
+
+    plan_slot_t *slots; /* sorted by token */
+    uint32_t num_slots;
+    uint32_t num_params;
+};
+
+typedef struct {
+    atl_cursor_plan_t *plan;
+    atl_cursor_custom_cb cb;
+    void *arg;
+    const char **params;
+    uint32_t num_params;
+} plan_bind_t;
+
+/* returns the one based placeholder number or 0 if s is not a placeholder */
+static
+uint32_t placeholder(const char *s) {
+    if(s[0] != '$' || s[1] < '1' || s[1] > '9')
+        return 0;
+    uint32_t n = 0;
+    for( s++; *s; s++ ) {
+        if(*s < '0' || *s > '9' || n > 100000)
+            return 0;
+        n = (n * 10) + (*s - '0');
+    }
+    return n;
+}
+
+static
+void add_slot(atl_cursor_plan_t *plan, aml_buffer_t *bh, atl_token_t *leaf, atl_token_t *t,
+              int32_t attr, uint32_t n) {
+    plan_slot_t slot;
+    slot.token = leaf;
+    slot.target = t;
+    slot.attr = attr;
+    slot.param = n-1;
+    aml_buffer_append(bh, &slot, sizeof(slot));
+    if(n > plan->num_params)
+        plan->num_params = n;
+}
+
+/* placeholders in t, its attr chain and their children, which are bound when leaf is */
+static
+void find_target_slots(atl_cursor_plan_t *plan, aml_buffer_t *bh, atl_token_t *leaf,
+                       atl_token_t *t) {
+    uint32_t n = placeholder(t->token);
+    if(n)
+        add_slot(plan, bh, leaf, t, -1, n);
+    for( uint32_t i=0; i<t->num_attrs; i++ ) {
+        n = placeholder(t->attrs[i]);
+        if(n)
+            add_slot(plan, bh, leaf, t, i, n);
+    }
+    for( atl_token_t *a=t->attr; a; a=a->next )
+        find_target_slots(plan, bh, leaf, a);
+    for( atl_token_t *c=t->child; c; c=c->next )
+        find_target_slots(plan, bh, leaf, c);
+}
+
+static
+void find_slots(atl_cursor_plan_t *plan, aml_buffer_t *bh, atl_token_t *t) {
+    while(t) {
+        if(t->child)
+            find_slots(plan, bh, t->child);
+        else
+            find_target_slots(plan, bh, t, t);
+        t = t->next;
+    }
+}
+
+static
+int compare_slots(const void *a, const void *b) {
+    const plan_slot_t *sa = (const plan_slot_t *)a;
+    const plan_slot_t *sb = (const plan_slot_t *)b;
+    if(sa->token != sb->token)
+        return (uintptr_t)sa->token < (uintptr_t)sb->token ? -1 : 1;
+    return sa->attr - sb->attr;
+}
+
+atl_cursor_plan_t *atl_cursor_plan_init(const char *expression, atl_token_set_var_cb cb, void *arg) {
+    aml_pool_t *pool = aml_pool_init(4096);
+    atl_cursor_plan_t *plan = (atl_cursor_plan_t *)aml_pool_zalloc(pool, sizeof(*plan));
+    plan->pool = pool;
+    plan->root = atl_token_parse_expression(pool, expression, cb, arg);
+    plan->root = atl_token_optimize(pool, plan->root);
+
+    aml_buffer_t *bh = aml_buffer_pool_init(pool, 8 * sizeof(plan_slot_t));
+    find_slots(plan, bh, plan->root);
+    plan->num_slots = aml_buffer_length(bh) / sizeof(plan_slot_t);
+    plan->slots = (plan_slot_t *)aml_pool_dup(pool, aml_buffer_data(bh),
+                                             sizeof(plan_slot_t) * plan->num_slots);
+    qsort(plan->slots, plan->num_slots, sizeof(plan_slot_t), compare_slots);
+    return plan;
+}
+
+void atl_cursor_plan_destroy(atl_cursor_plan_t *plan) {
+    aml_pool_destroy(plan->pool);
+}
+
+uint32_t atl_cursor_plan_num_params(atl_cursor_plan_t *plan) {
+    return plan->num_params;
+}
+
+atl_token_t *atl_cursor_plan_token(atl_cursor_plan_t *plan) {
+    return plan->root;
+}
+
+/* returns the first slot for t or NULL */
+static
+plan_slot_t *find_slot(atl_cursor_plan_t *plan, atl_token_t *t) {
+    uint32_t lo = 0, hi = plan->num_slots;
+    while(lo < hi) {
+        uint32_t mid = lo + ((hi-lo) >> 1);
+        if((uintptr_t)plan->slots[mid].token < (uintptr_t)t)
+            lo = mid+1;
+        else
+            hi = mid;
+    }
+    if(lo < plan->num_slots && plan->slots[lo].token == t)
+        return plan->slots + lo;
+    return NULL;
+}
+
+/* copies t (with a NULL terminated copy of its attrs), its attr chain and their children so
+   that parameters can be bound without changing the plan */
+static
+atl_token_t *bind_copy(aml_pool_t *pool, atl_token_t *t) {
+    atl_token_t *copy = (atl_token_t *)aml_pool_dup(pool, t, sizeof(*t));
+    if(t->num_attrs) {
+        copy->attrs = (char **)aml_pool_alloc(pool, sizeof(char *) * (t->num_attrs+1));
+        memcpy(copy->attrs, t->attrs, sizeof(char *) * t->num_attrs);
+        copy->attrs[t->num_attrs] = NULL;
+    }
+    atl_token_t **lists[2] = { &copy->attr, &copy->child };
+    for( uint32_t i=0; i<2; i++ ) {
+        atl_token_t *prev = NULL;
+        for( atl_token_t *n=*lists[i]; n; n=n->next ) {
+            atl_token_t *c = bind_copy(pool, n);
+            c->parent = i ? copy : NULL;
+            c->prev = prev;
+            if(prev)
+                prev->next = c;
+            else
+                *lists[i] = c;
+            prev = c;
+        }
+    }
+    return copy;
+}
+
+/* the token of copy (made by bind_copy) which is at the same place as target is in t */
+static
+atl_token_t *bind_find(atl_token_t *t, atl_token_t *copy, atl_token_t *target) {
+    if(t == target)
+        return copy;
+    atl_token_t *lists[4] = { t->attr, copy->attr, t->child, copy->child };
+    for( uint32_t i=0; i<4; i+=2 ) {
+        for( atl_token_t *n=lists[i], *c=lists[i+1]; n; n=n->next, c=c->next ) {
+            atl_token_t *r = bind_find(n, c, target);
+            if(r)
+                return r;
+        }
+    }
+    return NULL;
+}
+
+static
+atl_cursor_t *plan_leaf(aml_pool_t *pool, atl_token_t *t, void *arg) {
+    plan_bind_t *b = (plan_bind_t *)arg;
+    plan_slot_t *slot = find_slot(b->plan, t);
+    if(!slot)
+        return b->cb(pool, t, b->arg);
+
+    /* atl_cursor_plan_open has checked that every param is present */
+    atl_token_t *bound = bind_copy(pool, t);
+    plan_slot_t *ep = b->plan->slots + b->plan->num_slots;
+    for( ; slot < ep && slot->token == t; slot++ ) {
+        atl_token_t *target = bind_find(t, bound, slot->target);
+        char *value = aml_pool_strdup(pool, b->params[slot->param]);
+        if(slot->attr < 0)
+            target->token = value;
+        else
+            target->attrs[slot->attr] = value;
+    }
+    return b->cb(pool, bound, b->arg);
+}
+
+atl_cursor_t *atl_cursor_plan_open(atl_cursor_plan_t *plan, aml_pool_t *pool,
+                                   atl_cursor_custom_cb cb, void *arg,
+                                   const char **params, uint32_t num_params) {
+    if(!plan->num_slots)
+        return atl_cursor_open(pool, cb, plan->root, arg);
+    for( uint32_t i=0; i<plan->num_slots; i++ )
+        if(plan->slots[i].param >= num_params || !params[plan->slots[i].param])
+            return NULL;
+
+    /* the leaf callback is only used while the cursor is being opened */
+    plan_bind_t b;
+    b.plan = plan;
+    b.cb = cb;
+    b.arg = arg;
+    b.params = params;
+    b.num_params = num_params;
+    return atl_cursor_open(pool, plan_leaf, plan->root, &b);
+}
@@ -0,0 +1,1194 @@
+// SPDX-FileCopyrightText:  2023 Andy Curtis <contactandyc@gmail.com>
+// SPDX-License-Identifier: Apache-2.0
+
+/*
+    The cursor engine, shared by the 32 bit (atl_cursor.c) and 64 bit (atl_cursor64.c) ids.
+    This is included once by each of them after defining
+
+    CURSOR_T          the public cursor type (atl_cursor_t)
+    CURSOR_ID_T       the id type (uint32_t)
+    CURSOR_FN(name)   the public name for name (atl_cursor_##name)
+
+    Everything other than the public functions is static, so each instantiation has its own
+    copy of the internal cursor types and callbacks.
+*/
+
+typedef CURSOR_FN(advance_cb) cursor_advance_cb;
+typedef CURSOR_FN(advance_to_cb) cursor_advance_to_cb;
+typedef CURSOR_FN(add_cb) cursor_add_cb;
+typedef CURSOR_FN(score_cb) cursor_score_cb;
+typedef CURSOR_FN(rewind_cb) cursor_rewind_cb;
+typedef CURSOR_FN(count_cb) cursor_count_cb;
+typedef CURSOR_FN(custom_cb) cursor_custom_cb;
+
+#ifdef ATL_CURSOR_STATS
+#define CURSOR_STAT(c, field) if((c)->stats) (c)->stats->field++
+#else
+#define CURSOR_STAT(c, field)
+#endif
+
+static
+bool advance_empty_to(CURSOR_T *c, CURSOR_ID_T id)
+{
+    (void)c;
+    (void)id;
+    return false;
+}
+
+static
+bool advance_empty(CURSOR_T *c)
+{
+    (void)c;
+    return false;
+}
+
+static
+bool rewind_empty(CURSOR_T *c)
+{
+    (void)c;
+    return true;
+}
+
+void CURSOR_FN(init)(CURSOR_T *c, aml_pool_t *pool,
+                     cursor_advance_cb advance, cursor_advance_to_cb advance_to) {
+    memset(c, 0, sizeof(*c));
+    c->pool = pool;
+    c->advance = advance;
+    c->advance_to = advance_to;
+    c->type = NORMAL_CURSOR;
+}
+
+CURSOR_T *CURSOR_FN(init_empty)(aml_pool_t *pool) {
+    CURSOR_T *r = (CURSOR_T *)aml_pool_alloc(pool, sizeof(CURSOR_T));
+    CURSOR_FN(init)(r, pool, advance_empty, advance_empty_to);
+    r->rewind = rewind_empty;
+    r->type = EMPTY_CURSOR;
+    return r;
+}
+
+
+struct or_cursor_s;
+typedef struct or_cursor_s or_cursor_t;
+
+struct or_cursor_s {
+    CURSOR_T cursor;
+    CURSOR_T **cursors;
+    uint32_t num_cursors;
+    uint32_t cursor_size;
+
+    CURSOR_T **active;
+    CURSOR_T **heap;
+    uint32_t num_active;
+    uint32_t num_heap;
+    uint32_t heap_size;
+};
+
+static
+void or_add( or_cursor_t *dest, CURSOR_T *src ) {
+    // printf( "%s, %u\n", __FUNCTION__, __LINE__ );
+
+    if(dest->num_cursors >= dest->cursor_size) {
+        uint32_t num_cursors = (dest->cursor_size+1)*2;
+        CURSOR_T **cursors = 
+            (CURSOR_T **)aml_pool_alloc(dest->cursor.pool, sizeof(CURSOR_T *) * num_cursors);
+        if(dest->num_cursors)
+            memcpy(cursors, dest->cursors, dest->num_cursors * sizeof(CURSOR_T *));
+        dest->cursor_size = num_cursors;
+        dest->cursors = cursors;
+    }
+    dest->cursors[dest->num_cursors] = src;
+    dest->num_cursors++;
+}
+
+static
+void or_push(or_cursor_t *c, CURSOR_T *src) {
+    // printf( "%s, %u\n", __FUNCTION__, __LINE__ );
+    // CURSOR_FN(reset)(src);
+    CURSOR_T *tmp, **heap = c->heap;
+    CURSOR_STAT(&c->cursor, heap_ops);
+
+    c->num_heap++;
+    uint32_t i=c->num_heap;
+    heap[i] = src;
+    uint32_t j=i>>1;
+
+    while (j > 0 && heap[i]->id < heap[j]->id) {
+        tmp = heap[i];
+        heap[i] = heap[j];
+        heap[j] = tmp;
+        i = j;
+        j = j >> 1;
+    }
+}
+
+static
+CURSOR_T *or_pop(or_cursor_t *c) {
+    // printf( "%s, %u\n", __FUNCTION__, __LINE__ );
+
+    CURSOR_STAT(&c->cursor, heap_ops);
+    c->num_heap--;
+    ssize_t num = c->num_heap;
+    CURSOR_T **heap = c->heap;
+    CURSOR_T *r = heap[1];
+    heap[1] = heap[num + 1];
+
+    ssize_t i = 1;
+    ssize_t j = i << 1;
+    ssize_t k = j + 1;
+
+    if (k <= num && heap[k]->id < heap[j]->id)
+        j = k;
+
+    while (j <= num && heap[j]->id < heap[i]->id) {
+        CURSOR_T *tmp = heap[i];
+        heap[i] = heap[j];
+        heap[j] = tmp;
+
+        i = j;
+        j = i << 1;
+        k = j + 1;
+        if (k <= num && heap[k]->id < heap[j]->id)
+            j = k;
+    }
+    return r;
+}
+
+static
+bool advance_or(or_cursor_t *c) {
+    // printf( "%s, %u\n", __FUNCTION__, __LINE__ );
+
+    for( uint32_t i=0; i<c->num_active; i++ ) {
+        if(CURSOR_FN(advance)(c->active[i]))
+            or_push(c, c->active[i]);
+    }
+    if(!c->num_heap)
+        return CURSOR_FN(empty)(&c->cursor);
+
+    c->active[0] = or_pop(c);
+    c->num_active = 1;
+
+    CURSOR_T **heap = c->heap;
+    CURSOR_ID_T id = c->active[0]->id;
+    while(c->num_heap && heap[1]->id == id) {
+        c->active[c->num_active] = or_pop(c);
+        c->num_active++;
+    }
+
+    c->cursor.id = id;
+    return true;
+}
+
+static
+bool advance_or_to(or_cursor_t *c, CURSOR_ID_T id) {
+    // printf( "%s, %u\n", __FUNCTION__, __LINE__ );
+
+    if (id <= c->cursor.id)
+        return true;
+
+    for( uint32_t i=0; i<c->num_active; i++ ) {
+        if(CURSOR_FN(advance_to)(c->active[i], id))
+            or_push(c, c->active[i]);
+    }
+    c->num_active = 0;
+
+    CURSOR_T **heap = c->heap;
+    while(c->num_heap && heap[1]->id < id) {
+        CURSOR_T *p = or_pop(c);
+        if(CURSOR_FN(advance_to)(p, id))
+            or_push(c, p);
+    }
+    if(!c->num_heap)
+        return CURSOR_FN(empty)(&c->cursor);
+
+    c->active[0] = or_pop(c);
+    c->num_active = 1;
+
+    CURSOR_ID_T current = c->active[0]->id;
+    while(c->num_heap && heap[1]->id == current) {
+        c->active[c->num_active] = or_pop(c);
+        c->num_active++;
+    }
+
+    c->cursor.id = current;
+    return true;
+}
+
+static
+bool advance_or_init(or_cursor_t *c) {
+    // printf( "%s, %u\n", __FUNCTION__, __LINE__ );
+
+    uint32_t num = c->num_cursors;
+    if(c->heap_size < num+1) {
+        c->heap = (CURSOR_T **)aml_pool_alloc(c->cursor.pool, sizeof(CURSOR_T *) * (num+1) * 2);
+        c->active = c->heap + (num+1);
+        c->heap_size = num+1;
+    }
+    c->num_heap = 0;
+    c->num_active = 0;
+
+    for( uint32_t k=0; k<c->num_cursors; k++ ) {
+        if(CURSOR_FN(advance)(c->cursors[k])) {
+            // CURSOR_FN(reset)(c->cursors[k]);
+            or_push(c, c->cursors[k]);
+        }
+    }
+    
+    if(!c->num_heap)
+        return CURSOR_FN(empty)(&c->cursor);
+
+    c->cursor.advance = (cursor_advance_cb)advance_or;
+    c->cursor.advance_to = (cursor_advance_to_cb)advance_or_to;
+
+    return advance_or(c);
+}
+
+static
+double or_score(or_cursor_t *c) {
+    double score = 0.0;
+    for( uint32_t i=0; i<c->num_active; i++ )
+        score += CURSOR_FN(score)(c->active[i]);
+    return score;
+}
+
+static
+bool advance_or_to_init(or_cursor_t *c, CURSOR_ID_T id) {
+    // printf( "%s, %u\n", __FUNCTION__, __LINE__ );
+    if(!advance_or_init(c))
+        return CURSOR_FN(empty)(&c->cursor);
+
+    return c->cursor.advance_to((CURSOR_T*)c, id);
+}
+
+static
+bool rewind_or(or_cursor_t *c) {
+    bool r = true;
+    for( uint32_t i=0; i<c->num_cursors; i++ )
+        if(!CURSOR_FN(rewind)(c->cursors[i]))
+            r = false;
+    /* the heap is kept and reused by advance_or_init */
+    c->num_heap = 0;
+    c->num_active = 0;
+    c->cursor.id = 0;
+    c->cursor.advance = (cursor_advance_cb)advance_or_init;
+    c->cursor.advance_to = (cursor_advance_to_cb)advance_or_to_init;
+    return r;
+}
+
+static
+void init_or(aml_pool_t *pool, or_cursor_t *r) {
+    // printf( "%s, %u\n", __FUNCTION__, __LINE__ );
+
+    uint32_t num_cursors = 2;
+    CURSOR_FN(init)(&r->cursor, pool, (cursor_advance_cb)advance_or_init,
+                    (cursor_advance_to_cb)advance_or_to_init);
+    r->cursor.type = OR_CURSOR;
+    r->cursor.add = (cursor_add_cb)or_add;
+    r->cursor.score = (cursor_score_cb)or_score;
+    r->cursor.rewind = (cursor_rewind_cb)rewind_or;
+    r->cursors = (CURSOR_T **)aml_pool_alloc(pool, sizeof(CURSOR_T *) * num_cursors);
+    r->num_cursors = 0;
+    r->cursor_size = num_cursors;
+}
+
+CURSOR_T *CURSOR_FN(init_or)(aml_pool_t *pool) {
+    // printf( "%s, %u\n", __FUNCTION__, __LINE__ );
+
+    or_cursor_t *r = (or_cursor_t *)aml_pool_zalloc(pool, sizeof(or_cursor_t));
+    init_or(pool, r);
+    return (CURSOR_T *)r;
+}
+
+struct not_cursor_s;
+typedef struct not_cursor_s not_cursor_t;
+
+struct not_cursor_s {
+    CURSOR_T cursor;
+    CURSOR_T *pos;  /* pos and neg are adjacent so they can be read as an array */
+    CURSOR_T *neg;
+};
+
+static
+bool advance_pos(not_cursor_t *c) {
+    if(CURSOR_FN(advance)(c->pos)) {
+        c->cursor.id=c->pos->id;
+        return true;
+    }
+    return CURSOR_FN(empty)(&c->cursor);
+}
+
+static
+bool advance_pos_to(not_cursor_t *c, CURSOR_ID_T _id) {
+    if (_id <= c->cursor.id)
+        return true;
+
+    if(CURSOR_FN(advance_to)(c->pos, _id)) {
+        c->cursor.id=c->pos->id;
+        return true;
+    }
+    return CURSOR_FN(empty)(&c->cursor);
+}
+
+static
+bool advance_not(not_cursor_t *c)
+{
+    while(true) {
+        if(!CURSOR_FN(advance)(c->pos))
+            return CURSOR_FN(empty)(&c->cursor);
+        if(!CURSOR_FN(advance_to)(c->neg, c->pos->id)) {
+            c->cursor.advance_to = (cursor_advance_to_cb)advance_pos_to;
+            c->cursor.advance = (cursor_advance_cb)advance_pos;
+            c->cursor.id = c->pos->id;
+            return true;
+        }
+        if(c->pos->id == c->neg->id)
+            continue;
+        c->cursor.id = c->pos->id;
+        return true;
+    }
+}
+
+static
+bool advance_not_to(not_cursor_t *c, CURSOR_ID_T _id)
+{
+    if (_id <= c->cursor.id)
+        return true;
+
+    if(!CURSOR_FN(advance_to)(c->pos, _id))
+        return CURSOR_FN(empty)(&c->cursor);
+    if(!CURSOR_FN(advance_to)(c->neg, c->pos->id)) {
+        c->cursor.advance_to = (cursor_advance_to_cb)advance_pos_to;
+        c->cursor.advance = (cursor_advance_cb)advance_pos;
+        c->cursor.id = c->pos->id;
+        return true;
+    }
+    if(c->pos->id == c->neg->id)
+        return advance_not(c);
+    c->cursor.id = c->pos->id;
+    return true;
+}
+
+static
+double not_score(not_cursor_t *c) {
+    return CURSOR_FN(score)(c->pos);
+}
+
+static
+bool rewind_not(not_cursor_t *c) {
+    bool r = CURSOR_FN(rewind)(c->pos);
+    if(!CURSOR_FN(rewind)(c->neg))
+        r = false;
+    c->cursor.id = 0;
+    c->cursor.advance = (cursor_advance_cb)advance_not;
+    c->cursor.advance_to = (cursor_advance_to_cb)advance_not_to;
+    return r;
+}
+
+CURSOR_T *CURSOR_FN(init_not)(aml_pool_t *pool,
+                                CURSOR_T *pos,
+                                CURSOR_T *neg ) {
+    if(!pos)
+        return CURSOR_FN(init_empty)(pool);
+    else if(!neg)
+        return pos;
+    not_cursor_t *r = (not_cursor_t *)aml_pool_zalloc(pool, sizeof(not_cursor_t));
+    CURSOR_FN(init)(&r->cursor, pool, (cursor_advance_cb)advance_not,
+                    (cursor_advance_to_cb)advance_not_to);
+    r->cursor.type = NOT_CURSOR;
+    r->cursor.score = (cursor_score_cb)not_score;
+    r->cursor.rewind = (cursor_rewind_cb)rewind_not;
+    r->pos = pos;
+    r->neg = neg;
+    return (CURSOR_T *)r;
+}
+
+struct and_cursor_s;
+typedef struct and_cursor_s and_cursor_t;
+
+struct and_cursor_s {
+    CURSOR_T cursor;
+    CURSOR_T **cursors;
+    uint32_t num_cursors;
+    uint32_t cursor_size;
+};
+
+static
+void and_add( and_cursor_t *dest, CURSOR_T *src ) {
+    if(dest->num_cursors >= dest->cursor_size) {
+        uint32_t num_cursors = (dest->cursor_size+1)*2;
+        CURSOR_T **cursors = 
+            (CURSOR_T **)aml_pool_alloc(dest->cursor.pool, sizeof(CURSOR_T *) * num_cursors);
+        if(dest->num_cursors)
+            memcpy(cursors, dest->cursors, dest->num_cursors * sizeof(CURSOR_T *));
+        dest->cursor_size = num_cursors;
+        dest->cursors = cursors;
+    }
+    dest->cursors[dest->num_cursors] = src;
+    dest->num_cursors++;
+}
+
+static
+bool advance_and(and_cursor_t *c)
+{
+    uint32_t i=1;
+    if(!CURSOR_FN(advance)(c->cursors[0]))
+        return CURSOR_FN(empty)(&c->cursor);
+    CURSOR_ID_T id = c->cursors[0]->id;
+    while(i < c->num_cursors) {
+        if(!CURSOR_FN(advance_to)(c->cursors[i], id))
+            return CURSOR_FN(empty)(&c->cursor);
+        CURSOR_ID_T id2 = c->cursors[i]->id;
+        if(id==id2)
+            i++;
+        else {
+            i=0;
+            id=id2;
+        }
+    }
+    c->cursor.id = id;
+    return true;
+}
+
+static
+bool advance_and_to(and_cursor_t *c, CURSOR_ID_T id)
+{
+    if (id <= c->cursor.id)
+        return true;
+
+    uint32_t i=0;
+    while(id && i < c->num_cursors) {
+        if(!CURSOR_FN(advance_to)(c->cursors[i], id))
+            return CURSOR_FN(empty)(&c->cursor);
+        CURSOR_ID_T id2 = c->cursors[i]->id;
+        if(id==id2)
+            i++;
+        else {
+            i=0;
+            id=id2;
+        }
+    }
+    c->cursor.id = id;
+    return true;
+}
+
+static
+double and_score(and_cursor_t *c) {
+    double score = 0.0;
+    for( uint32_t i=0; i<c->num_cursors; i++ )
+        score += CURSOR_FN(score)(c->cursors[i]);
+    return score;
+}
+
+static
+bool rewind_and(and_cursor_t *c) {
+    bool r = true;
+    for( uint32_t i=0; i<c->num_cursors; i++ )
+        if(!CURSOR_FN(rewind)(c->cursors[i]))
+            r = false;
+    c->cursor.id = 0;
+    c->cursor.advance = (cursor_advance_cb)advance_and;
+    c->cursor.advance_to = (cursor_advance_to_cb)advance_and_to;
+    return r;
+}
+
+CURSOR_T *CURSOR_FN(init_and)(aml_pool_t *pool) {
+    uint32_t num_cursors = 2;
+    and_cursor_t *r = (and_cursor_t *)aml_pool_zalloc(pool, sizeof(and_cursor_t));
+    CURSOR_FN(init)(&r->cursor, pool, (cursor_advance_cb)advance_and,
+                    (cursor_advance_to_cb)advance_and_to);
+    r->cursor.type = AND_CURSOR;
+    r->cursor.add = (cursor_add_cb)and_add;
+    r->cursor.score = (cursor_score_cb)and_score;
+    r->cursor.rewind = (cursor_rewind_cb)rewind_and;
+    r->cursors = (CURSOR_T **)aml_pool_alloc(pool, sizeof(CURSOR_T *) * num_cursors);
+    r->num_cursors = 0;
+    r->cursor_size = num_cursors;
+    return (CURSOR_T *)r;
+}
+
+bool CURSOR_FN(rewind)(CURSOR_T *c) {
+    if(!c->rewind)
+        return false;
+    return c->rewind(c);
+}
+
+double CURSOR_FN(score)(CURSOR_T *c) {
+    if(!c->score)
+        return 0.0;
+    return c->score(c);
+}
+
+bool CURSOR_FN(empty)(CURSOR_T *c) {
+    c->advance_to = advance_empty_to;
+    c->advance = advance_empty;
+    c->id = 0;
+    return false;
+}
+
+static
+bool post_reset_advance(CURSOR_T *c) {
+    c->advance = c->_advance;
+    return true;
+}
+
+void CURSOR_FN(reset)(CURSOR_T *c) {
+    c->_advance = c->advance;
+    c->advance = (cursor_advance_cb)post_reset_advance;
+}
+
+struct range_cursor_s;
+typedef struct range_cursor_s range_cursor_t;
+
+struct range_cursor_s {
+    CURSOR_T cursor;
+    CURSOR_ID_T id;
+    CURSOR_ID_T start;
+    CURSOR_ID_T end;
+};
+
+static
+bool advance_range(range_cursor_t *c)
+{
+    CURSOR_ID_T id = c->id;
+    if(id >= c->end)
+        return CURSOR_FN(empty)(&c->cursor);
+    c->cursor.id = id;
+    c->id++;
+    return true;
+}
+
+static
+bool advance_range_to(range_cursor_t *c, CURSOR_ID_T id)
+{
+    /* the next advance should move past the current id even if it was reset */
+    c->cursor.advance = (cursor_advance_cb)advance_range;
+    if(id <= c->cursor.id)
+        return true;
+
+    if(id >= c->end)
+        return CURSOR_FN(empty)(&c->cursor);
+    c->cursor.id = id;
+    c->id = id+1;
+    return true;
+}
+
+static
+bool rewind_range(range_cursor_t *r)
+{
+    r->id = r->start+1;
+    r->cursor.id = r->start;
+    r->cursor._advance = (cursor_advance_cb)advance_range;
+    r->cursor.advance_to = (cursor_advance_to_cb)advance_range_to;
+    r->cursor.advance = (cursor_advance_cb)post_reset_advance;
+    /* the first advance returns start without checking it against end */
+    if(r->start >= r->end)
+        CURSOR_FN(empty)(&r->cursor);
+    return true;
+}
+
+static
+CURSOR_ID_T count_range(range_cursor_t *r, CURSOR_ID_T limit)
+{
+    CURSOR_ID_T next = r->cursor.advance == (cursor_advance_cb)post_reset_advance ? r->cursor.id : r->id;
+    CURSOR_ID_T n = next < r->end ? r->end - next : 0;
+    return n < limit ? n : limit;
+}
+
+CURSOR_T *CURSOR_FN(range)(aml_pool_t *pool, CURSOR_ID_T start, CURSOR_ID_T end) {
+    range_cursor_t *r = (range_cursor_t *)aml_pool_zalloc(pool, sizeof(range_cursor_t));
+    CURSOR_FN(init)(&r->cursor, pool, (cursor_advance_cb)advance_range,
+                    (cursor_advance_to_cb)advance_range_to);
+    r->start = start;
+    r->end = end;
+    r->cursor.rewind = (cursor_rewind_cb)rewind_range;
+    r->cursor.count = (cursor_count_cb)count_range;
+    rewind_range(r);
+    return &(r->cursor);
+}
+
+struct array_cursor_s;
+typedef struct array_cursor_s array_cursor_t;
+
+struct array_cursor_s {
+    CURSOR_T cursor;
+    const CURSOR_ID_T *ids;
+    uint32_t num_ids;
+    uint32_t pos;  /* index of the next id to return */
+};
+
+static
+bool advance_array(array_cursor_t *c)
+{
+    if(c->pos >= c->num_ids)
+        return CURSOR_FN(empty)(&c->cursor);
+    c->cursor.id = c->ids[c->pos];
+    c->pos++;
+    return true;
+}
+
+static
+bool advance_array_to(array_cursor_t *c, CURSOR_ID_T id)
+{
+    /* the next advance should move past the current id even if it was reset */
+    c->cursor.advance = (cursor_advance_cb)advance_array;
+    if(c->pos && id <= c->cursor.id)
+        return true;
+
+    /* gallop forward from the current position and then binary search */
+    const CURSOR_ID_T *ids = c->ids;
+    uint32_t lo = c->pos, hi = c->num_ids;
+    uint32_t step = 1;
+    while(lo + step < hi && ids[lo + step] < id) {
+        lo += step;
+        step <<= 1;
+    }
+    if(lo + step < hi)
+        hi = lo + step + 1;
+    while(lo < hi) {
+        uint32_t mid = lo + ((hi-lo) >> 1);
+        if(ids[mid] < id)
+            lo = mid+1;
+        else
+            hi = mid;
+    }
+    if(lo >= c->num_ids) {
+        c->pos = c->num_ids;
+        return CURSOR_FN(empty)(&c->cursor);
+    }
+    c->cursor.id = ids[lo];
+    c->pos = lo+1;
+    return true;
+}
+
+static
+bool rewind_array(array_cursor_t *c)
+{
+    c->pos = 0;
+    c->cursor.id = 0;
+    c->cursor.advance = (cursor_advance_cb)advance_array;
+    c->cursor.advance_to = (cursor_advance_to_cb)advance_array_to;
+    return true;
+}
+
+static
+CURSOR_ID_T count_array(array_cursor_t *c, CURSOR_ID_T limit)
+{
+    uint32_t next = c->pos;
+    if(next && c->cursor.advance == (cursor_advance_cb)post_reset_advance)
+        next--;
+    CURSOR_ID_T n = c->num_ids - next;
+    return n < limit ? n : limit;
+}
+
+static
+void init_array(aml_pool_t *pool, array_cursor_t *r, const CURSOR_ID_T *ids, uint32_t num_ids) {
+    CURSOR_FN(init)(&r->cursor, pool, (cursor_advance_cb)advance_array,
+                    (cursor_advance_to_cb)advance_array_to);
+    r->cursor.rewind = (cursor_rewind_cb)rewind_array;
+    r->cursor.count = (cursor_count_cb)count_array;
+    r->ids = ids;
+    r->num_ids = num_ids;
+    r->pos = 0;
+}
+
+CURSOR_T *CURSOR_FN(array)(aml_pool_t *pool, const CURSOR_ID_T *ids, uint32_t num_ids) {
+    array_cursor_t *r = (array_cursor_t *)aml_pool_zalloc(pool, sizeof(array_cursor_t));
+    init_array(pool, r, ids, num_ids);
+    return &(r->cursor);
+}
+
+struct bitmap_cursor_s;
+typedef struct bitmap_cursor_s bitmap_cursor_t;
+
+struct bitmap_cursor_s {
+    CURSOR_T cursor;
+    const uint64_t *bits;
+    CURSOR_ID_T num_bits;
+    CURSOR_ID_T next;  /* the first id which has not been examined */
+};
+
+static
+bool advance_bitmap(bitmap_cursor_t *c)
+{
+    CURSOR_ID_T next = c->next;
+    if(next >= c->num_bits)
+        return CURSOR_FN(empty)(&c->cursor);
+    CURSOR_ID_T word = next >> 6;
+    CURSOR_ID_T num_words = (c->num_bits + 63) >> 6;
+    uint64_t w = c->bits[word] & (~0ULL << (next & 63));
+    while(!w) {
+        word++;
+        if(word >= num_words) {
+            c->next = c->num_bits;
+            return CURSOR_FN(empty)(&c->cursor);
+        }
+        w = c->bits[word];
+    }
+    CURSOR_ID_T id = (word << 6) + __builtin_ctzll(w);
+    if(id >= c->num_bits) {
+        c->next = c->num_bits;
+        return CURSOR_FN(empty)(&c->cursor);
+    }
+    c->cursor.id = id;
+    c->next = id+1;
+    return true;
+}
+
+static
+bool advance_bitmap_to(bitmap_cursor_t *c, CURSOR_ID_T id)
+{
+    /* the next advance should move past the current id even if it was reset */
+    c->cursor.advance = (cursor_advance_cb)advance_bitmap;
+    if(c->next && id <= c->cursor.id)
+        return true;
+    c->next = id;
+    return advance_bitmap(c);
+}
+
+static
+bool rewind_bitmap(bitmap_cursor_t *c)
+{
+    c->next = 0;
+    c->cursor.id = 0;
+    c->cursor.advance = (cursor_advance_cb)advance_bitmap;
+    c->cursor.advance_to = (cursor_advance_to_cb)advance_bitmap_to;
+    return true;
+}
+
+/* word of the bitmap with any bits at or past num_bits cleared */
+static inline
+uint64_t bitmap_word(bitmap_cursor_t *c, CURSOR_ID_T word)
+{
+    CURSOR_ID_T base = word << 6;
+    if(base >= c->num_bits)
+        return 0;
+    uint64_t w = c->bits[word];
+    if(c->num_bits - base < 64)
+        w &= (1ULL << (c->num_bits - base)) - 1;
+    return w;
+}
+
+static
+CURSOR_ID_T count_bitmap(bitmap_cursor_t *c, CURSOR_ID_T limit)
+{
+    CURSOR_ID_T next = c->next;
+    if(c->cursor.advance == (cursor_advance_cb)post_reset_advance)
+        next = c->cursor.id;
+    if(next >= c->num_bits)
+        return 0;
+    CURSOR_ID_T word = next >> 6;
+    CURSOR_ID_T num_words = (c->num_bits + 63) >> 6;
+    CURSOR_ID_T n = __builtin_popcountll(bitmap_word(c, word) & (~0ULL << (next & 63)));
+    for( word++; word < num_words && n < limit; word++ )
+        n += __builtin_popcountll(bitmap_word(c, word));
+    return n < limit ? n : limit;
+}
+
+CURSOR_T *CURSOR_FN(bitmap)(aml_pool_t *pool, const uint64_t *bits, CURSOR_ID_T num_bits) {
+    bitmap_cursor_t *r = (bitmap_cursor_t *)aml_pool_zalloc(pool, sizeof(bitmap_cursor_t));
+    CURSOR_FN(init)(&r->cursor, pool, (cursor_advance_cb)advance_bitmap,
+                    (cursor_advance_to_cb)advance_bitmap_to);
+    r->cursor.rewind = (cursor_rewind_cb)rewind_bitmap;
+    r->cursor.count = (cursor_count_cb)count_bitmap;
+    r->bits = bits;
+    r->num_bits = num_bits;
+    rewind_bitmap(r);
+    return &(r->cursor);
+}
+
+struct bm25_cursor_s;
+typedef struct bm25_cursor_s bm25_cursor_t;
+
+struct bm25_cursor_s {
+    array_cursor_t array;
+    const uint32_t *tfs;
+    const uint32_t *doc_lens;
+    double idf;
+    double k1_plus_1;
+    double norm_base;  /* k1 * (1-b) */
+    double norm_len;   /* k1 * b / avg_doc_len */
+};
+
+static
+double bm25_score(bm25_cursor_t *c) {
+    if(!c->array.pos)
+        return 0.0;
+    double tf = c->tfs[c->array.pos-1];
+    double norm = c->norm_base;
+    if(c->doc_lens)
+        norm += c->norm_len * c->doc_lens[c->array.cursor.id];
+    return c->idf * (tf * c->k1_plus_1) / (tf + norm);
+}
+
+CURSOR_T *CURSOR_FN(bm25)(aml_pool_t *pool, const CURSOR_ID_T *ids, const uint32_t *tfs,
+                              uint32_t num_ids, const atl_cursor_bm25_t *params) {
+    bm25_cursor_t *r = (bm25_cursor_t *)aml_pool_zalloc(pool, sizeof(bm25_cursor_t));
+    init_array(pool, &r->array, ids, num_ids);
+    r->array.cursor.type = TERM_CURSOR;
+    r->array.cursor.score = (cursor_score_cb)bm25_score;
+    r->tfs = tfs;
+    r->doc_lens = params->doc_lens;
+
+    double n = params->num_docs;
+    double df = num_ids;
+    r->idf = log(1.0 + (n - df + 0.5) / (df + 0.5));
+    r->k1_plus_1 = params->k1 + 1.0;
+    r->norm_base = params->k1 * (1.0 - params->b);
+    if(params->doc_lens && params->avg_doc_len > 0.0)
+        r->norm_len = params->k1 * params->b / params->avg_doc_len;
+    else
+        r->norm_base = params->k1;
+    return &(r->array.cursor);
+}
+
+struct id_cursor_s;
+typedef struct id_cursor_s id_cursor_t;
+
+struct id_cursor_s {
+    CURSOR_T cursor;
+    CURSOR_ID_T id;  /* cursor.id is cleared once the cursor is empty */
+};
+
+static
+bool advance_id_to(id_cursor_t *c, CURSOR_ID_T id)
+{
+    /* the next advance should move past the id even if it hadn't been read */
+    c->cursor.advance = advance_empty;
+    if(id <= c->cursor.id)
+        return true;
+    return CURSOR_FN(empty)(&c->cursor);
+}
+
+static
+bool rewind_id(id_cursor_t *c) {
+    c->cursor.id = c->id;
+    c->cursor._advance = advance_empty;
+    c->cursor.advance = (cursor_advance_cb)post_reset_advance;
+    c->cursor.advance_to = (cursor_advance_to_cb)advance_id_to;
+    return true;
+}
+
+static
+CURSOR_ID_T count_id(CURSOR_T *r, CURSOR_ID_T limit) {
+    (void)limit;
+    return r->advance == (cursor_advance_cb)post_reset_advance ? 1 : 0;
+}
+
+CURSOR_T *CURSOR_FN(init_id)(aml_pool_t *pool, CURSOR_ID_T id) {
+    id_cursor_t *r = (id_cursor_t *)aml_pool_zalloc(pool, sizeof(id_cursor_t));
+    CURSOR_FN(init)(&r->cursor, pool, (cursor_advance_cb)post_reset_advance,
+                    (cursor_advance_to_cb)advance_id_to);
+    r->id = id;
+    r->cursor.rewind = (cursor_rewind_cb)rewind_id;
+    r->cursor.count = count_id;
+    rewind_id(r);
+    return &(r->cursor);
+}
+
+/* returns the bitmap if c is a bitmap cursor which hasn't been advanced */
+static
+bitmap_cursor_t *unread_bitmap(CURSOR_T *c) {
+    if(c->advance != (cursor_advance_cb)advance_bitmap)
+        return NULL;
+    bitmap_cursor_t *b = (bitmap_cursor_t *)c;
+    return b->next ? NULL : b;
+}
+
+/* popcount of the AND or OR of the bitmaps, less any ids in neg */
+static
+CURSOR_ID_T count_bitmaps(bitmap_cursor_t **bms, uint32_t num_bms, enum atl_cursor_type type,
+                       bitmap_cursor_t *neg, CURSOR_ID_T limit) {
+    CURSOR_ID_T num_bits = bms[0]->num_bits;
+    for( uint32_t i=1; i<num_bms; i++ ) {
+        if(type == AND_CURSOR ? bms[i]->num_bits < num_bits : bms[i]->num_bits > num_bits)
+            num_bits = bms[i]->num_bits;
+    }
+    CURSOR_ID_T num_words = (num_bits + 63) >> 6;
+    CURSOR_ID_T n = 0;
+    for( CURSOR_ID_T word=0; word < num_words && n < limit; word++ ) {
+        uint64_t w = bitmap_word(bms[0], word);
+        for( uint32_t i=1; i<num_bms; i++ ) {
+            if(type == AND_CURSOR)
+                w &= bitmap_word(bms[i], word);
+            else
+                w |= bitmap_word(bms[i], word);
+        }
+        if(neg)
+            w &= ~bitmap_word(neg, word);
+        n += __builtin_popcountll(w);
+    }
+    return n < limit ? n : limit;
+}
+
+/* counts AND, OR and NOT cursors which haven't been advanced and only have bitmap children */
+static
+bool count_composite(CURSOR_T *c, CURSOR_ID_T limit, CURSOR_ID_T *n) {
+    bitmap_cursor_t *bms[16];
+    CURSOR_T **subs = NULL;
+    uint32_t num_subs = 0;
+    if(c->type == AND_CURSOR) {
+        if(c->advance != (cursor_advance_cb)advance_and || c->id)
+            return false;
+        subs = ((and_cursor_t *)c)->cursors;
+        num_subs = ((and_cursor_t *)c)->num_cursors;
+    }
+    else if(c->type == OR_CURSOR) {
+        if(c->advance != (cursor_advance_cb)advance_or_init)
+            return false;
+        subs = ((or_cursor_t *)c)->cursors;
+        num_subs = ((or_cursor_t *)c)->num_cursors;
+    }
+    else if(c->type == NOT_CURSOR) {
+        not_cursor_t *r = (not_cursor_t *)c;
+        if(c->advance == (cursor_advance_cb)advance_pos) {
+            /* the negative side has run out */
+            *n = CURSOR_FN(count_upto)(r->pos, limit);
+            return true;
+        }
+        if(c->advance != (cursor_advance_cb)advance_not || c->id)
+            return false;
+        bms[0] = unread_bitmap(r->pos);
+        bitmap_cursor_t *neg = unread_bitmap(r->neg);
+        if(!bms[0] || !neg)
+            return false;
+        *n = count_bitmaps(bms, 1, NOT_CURSOR, neg, limit);
+        return true;
+    }
+    if(!num_subs || num_subs > 16)
+        return false;
+    for( uint32_t i=0; i<num_subs; i++ ) {
+        if(!(bms[i] = unread_bitmap(subs[i])))
+            return false;
+    }
+    *n = count_bitmaps(bms, num_subs, c->type, NULL, limit);
+    return true;
+}
+
+CURSOR_ID_T CURSOR_FN(count_upto)(CURSOR_T *c, CURSOR_ID_T limit) {
+    CURSOR_ID_T n = 0;
+    if(c->advance == advance_empty)
+        return 0;
+    if(c->count)
+        n = c->count(c, limit);
+    else if(!count_composite(c, limit, &n)) {
+        while(n < limit && CURSOR_FN(advance)(c))
+            n++;
+    }
+    CURSOR_FN(empty)(c);
+    return n;
+}
+
+CURSOR_ID_T CURSOR_FN(count)(CURSOR_T *c) {
+    return CURSOR_FN(count_upto)(c, (CURSOR_ID_T)-1);
+}
+
+CURSOR_T ** CURSOR_FN(subs)(CURSOR_T *c, uint32_t *num_sub ) {
+    if(c->type == AND_CURSOR || c->type == PHRASE_CURSOR) {
+        and_cursor_t *r = (and_cursor_t *)c;
+        *num_sub = r->num_cursors;
+        return r->cursors;
+    }
+    else if(c->type == OR_CURSOR) {
+        or_cursor_t *r = (or_cursor_t *)c;
+        *num_sub = r->num_active;
+        return r->active;
+    }
+    else if(c->type == NOT_CURSOR) {
+        not_cursor_t *r = (not_cursor_t *)c;
+        *num_sub = 1;
+        return &(r->pos);
+    }
+    *num_sub = 0;
+    return NULL;
+}
+
+static
+CURSOR_T *open_token(aml_pool_t *pool, cursor_custom_cb cb, atl_token_t *t, void *arg) {
+    if(t->child) {
+        if(t->type == ATL_TOKEN_OPEN_PAREN || t->type == ATL_TOKEN_DQUOTE) {
+            CURSOR_T *resp = CURSOR_FN(init_and)(pool);
+            if(t->type == ATL_TOKEN_DQUOTE)
+                resp->type = PHRASE_CURSOR;
+            atl_token_t *n = t->child;
+            while(n) {
+                CURSOR_T *c = open_token(pool, cb, n, arg);
+                if(c && c->type != EMPTY_CURSOR)
+                    resp->add(resp, c);
+                else
+                    return NULL;
+                n = n->next;
+            }
+            return resp;
+        }
+        else if(t->type == ATL_TOKEN_OR) {
+            CURSOR_T *resp = CURSOR_FN(init_or)(pool);
+            atl_token_t *n = t->child;
+            while(n) {
+                CURSOR_T *c = open_token(pool, cb, n, arg);
+                if(c)
+                    resp->add(resp, c);
+                n = n->next;
+            }
+            return resp;
+        }
+        else if(t->type == ATL_TOKEN_NOT) {
+            if(t->child && t->child->next) {
+                return CURSOR_FN(init_not)(pool,
+                                          open_token(pool, cb, t->child->next, arg),
+                                          open_token(pool, cb, t->child, arg));
+            }
+        }
+        return NULL;
+    }
+    else
+        return cb(pool, t, arg);
+}
+
+/* open_token over the nodes of an ast */
+static
+CURSOR_T *open_ast_node(aml_pool_t *pool, cursor_custom_cb cb, const atl_token_ast_t *ast,
+                        uint32_t idx, void *arg) {
+    const atl_token_ast_node_t *t = ast->nodes + idx;
+    if(t->child) {
+        if(t->type == ATL_TOKEN_OPEN_PAREN || t->type == ATL_TOKEN_DQUOTE) {
+            CURSOR_T *resp = CURSOR_FN(init_and)(pool);
+            if(t->type == ATL_TOKEN_DQUOTE)
+                resp->type = PHRASE_CURSOR;
+            for( uint32_t n=t->child; n; n=ast->nodes[n].next ) {
+                CURSOR_T *c = open_ast_node(pool, cb, ast, n, arg);
+                if(c && c->type != EMPTY_CURSOR)
+                    resp->add(resp, c);
+                else
+                    return NULL;
+            }
+            return resp;
+        }
+        else if(t->type == ATL_TOKEN_OR) {
+            CURSOR_T *resp = CURSOR_FN(init_or)(pool);
+            for( uint32_t n=t->child; n; n=ast->nodes[n].next ) {
+                CURSOR_T *c = open_ast_node(pool, cb, ast, n, arg);
+                if(c)
+                    resp->add(resp, c);
+            }
+            return resp;
+        }
+        else if(t->type == ATL_TOKEN_NOT) {
+            uint32_t neg = ast->nodes[t->child].next;
+            if(neg) {
+                return CURSOR_FN(init_not)(pool,
+                                          open_ast_node(pool, cb, ast, neg, arg),
+                                          open_ast_node(pool, cb, ast, t->child, arg));
+            }
+        }
+        return NULL;
+    }
+    else
+        return cb(pool, atl_token_ast_token(pool, ast, idx), arg);
+}
+
+/* every child of c (including the inactive children of an OR and both sides of a NOT) */
+static
+CURSOR_T **cursor_children(CURSOR_T *c, uint32_t *num) {
+    if(c->type == AND_CURSOR || c->type == PHRASE_CURSOR) {
+        *num = ((and_cursor_t *)c)->num_cursors;
+        return ((and_cursor_t *)c)->cursors;
+    }
+    else if(c->type == OR_CURSOR) {
+        *num = ((or_cursor_t *)c)->num_cursors;
+        return ((or_cursor_t *)c)->cursors;
+    }
+    else if(c->type == NOT_CURSOR) {
+        *num = 2;
+        return &((not_cursor_t *)c)->pos;
+    }
+    *num = 0;
+    return NULL;
+}
+
+#ifdef ATL_CURSOR_STATS
+static
+void cursor_stats_init(aml_pool_t *pool, CURSOR_T *c) {
+    if(!c->stats)
+        c->stats = (atl_cursor_stats_t *)aml_pool_zalloc(pool, sizeof(atl_cursor_stats_t));
+    uint32_t num;
+    CURSOR_T **children = cursor_children(c, &num);
+    for( uint32_t i=0; i<num; i++ )
+        cursor_stats_init(pool, children[i]);
+}
+#endif
+
+CURSOR_T *CURSOR_FN(open)(aml_pool_t *pool, cursor_custom_cb cb, atl_token_t *t, void *arg) {
+    if(!t)
+        return CURSOR_FN(init_empty)(pool);
+        
+    CURSOR_T *c = open_token(pool, cb, t, arg);
+    if(!c)
+        return CURSOR_FN(init_empty)(pool);
+#ifdef ATL_CURSOR_STATS
+    cursor_stats_init(pool, c);
+#endif
+    return c;
+}
+
+CURSOR_T *CURSOR_FN(open_ast)(aml_pool_t *pool, cursor_custom_cb cb, const atl_token_ast_t *ast, void *arg) {
+    if(!ast || !ast->num_nodes)
+        return CURSOR_FN(init_empty)(pool);
+
+    CURSOR_T *c = open_ast_node(pool, cb, ast, 0, arg);
+    if(!c)
+        return CURSOR_FN(init_empty)(pool);
+#ifdef ATL_CURSOR_STATS
+    cursor_stats_init(pool, c);
+#endif
+    return c;
+}
+
+static
+void cursor_explain(CURSOR_T *c, int depth) {
+    static const char *names[] = { "EMPTY", "AND", "PHRASE", "OR", "NOT", "NORMAL", "TERM" };
+    for( int i=0; i<depth; i++ )
+        printf( "\t" );
+    if(c->type <= TERM_CURSOR)
+        printf( "%s", names[c->type] );
+    else
+        printf( "%d", (int)c->type );
+    if(c->tag)
+        printf( " tag=%u", c->tag );
+
+    uint32_t num;
+    CURSOR_T **children = cursor_children(c, &num);
+    atl_cursor_stats_t *s = c->stats;
+    if(s) {
+        uint64_t self = s->cycles;
+        for( uint32_t i=0; i<num; i++ ) {
+            if(children[i]->stats && children[i]->stats->cycles < self)
+                self -= children[i]->stats->cycles;
+        }
+        printf( " advance=%" PRIu64 " advance_to=%" PRIu64 " returned=%" PRIu64 " skipped=%" PRIu64,
+                s->advance_calls, s->advance_to_calls, s->ids_returned, s->ids_skipped );
+        if(c->type == OR_CURSOR)
+            printf( " heap_ops=%" PRIu64, s->heap_ops );
+        printf( " cycles=%" PRIu64 " self=%" PRIu64, s->cycles, self );
+    }
+    printf( "\n" );
+    for( uint32_t i=0; i<num; i++ ) {
+        if(c->type == NOT_CURSOR) {
+            for( int j=0; j<=depth; j++ )
+                printf( "\t" );
+            printf( i == 0 ? "+\n" : "-\n" );
+            cursor_explain(children[i], depth+2);
+        }
+        else
+            cursor_explain(children[i], depth+1);
+    }
+}
+
+void CURSOR_FN(explain)(CURSOR_T *c) {
+    cursor_explain(c, 0);
+}
+
+bool CURSOR_FN(match)(aml_pool_t *pool, cursor_custom_cb cb, atl_token_t *t, void *arg) {
+    CURSOR_T *c = CURSOR_FN(open)(pool, cb, t, arg);
+    if(!c)
+        return false;
+    return CURSOR_FN(advance)(c);
+}
@@ -0,0 +1,226 @@
+// SPDX-FileCopyrightText:  2023 Andy Curtis <contactandyc@gmail.com>
+// SPDX-License-Identifier: Apache-2.0
+#include "a-tokenizer-library/atl_cursor_terms.h"
+
+#include "a-memory-library/aml_alloc.h"
+#include "a-memory-library/aml_buffer.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+
+/* expansions of up to this many terms are merged by an OR cursor */
+#define TERMS_OR_LIMIT 8
+
+typedef struct {
+    char *term;
+    const uint32_t *ids;
+    uint32_t num_ids;
+} term_entry_t;
+
+struct atl_cursor_terms_s {
+    aml_pool_t *pool;
+    aml_buffer_t *bh;
+
+    term_entry_t *terms;
+    uint32_t num_terms;
+};
+
+atl_cursor_terms_t *atl_cursor_terms_init(void) {
+    aml_pool_t *pool = aml_pool_init(16384);
+    atl_cursor_terms_t *h = (atl_cursor_terms_t *)aml_pool_zalloc(pool, sizeof(*h));
+    h->pool = pool;
+    h->bh = aml_buffer_init(1024 * sizeof(term_entry_t));
+    return h;
+}
+
+void atl_cursor_terms_destroy(atl_cursor_terms_t *h) {
+    aml_buffer_destroy(h->bh);
+    aml_pool_destroy(h->pool);
+}
+
+void atl_cursor_terms_add(atl_cursor_terms_t *h, const char *term,
+                          const uint32_t *ids, uint32_t num_ids) {
+    term_entry_t e;
+    e.term = aml_pool_strdup(h->pool, term);
+    e.ids = ids;
+    e.num_ids = num_ids;
+    aml_buffer_append(h->bh, &e, sizeof(e));
+}
+
+static
+int compare_terms(const void *p1, const void *p2) {
+    const term_entry_t *a = (const term_entry_t *)p1;
+    const term_entry_t *b = (const term_entry_t *)p2;
+    return strcmp(a->term, b->term);
+}
+
+void atl_cursor_terms_freeze(atl_cursor_terms_t *h) {
+    h->terms = (term_entry_t *)aml_buffer_data(h->bh);
+    h->num_terms = aml_buffer_length(h->bh) / sizeof(term_entry_t);
+    qsort(h->terms, h->num_terms, sizeof(term_entry_t), compare_terms);
+}
+
+uint32_t atl_cursor_terms_size(atl_cursor_terms_t *h) {
+    return h->num_terms;
+}
+
+const char *atl_cursor_terms_term(atl_cursor_terms_t *h, uint32_t index) {
+    return h->terms[index].term;
+}
+
+const uint32_t *atl_cursor_terms_ids(atl_cursor_terms_t *h, uint32_t index, uint32_t *num_ids) {
+    *num_ids = h->terms[index].num_ids;
+    return h->terms[index].ids;
+}
+
+/* the first term which doesn't compare less than (or equal to, if upper) the first len bytes
+   of key */
+static
+uint32_t terms_bound(atl_cursor_terms_t *h, const char *key, size_t len, bool upper) {
+    uint32_t lo = 0, hi = h->num_terms;
+    while(lo < hi) {
+        uint32_t mid = lo + ((hi - lo) >> 1);
+        int n = strncmp(h->terms[mid].term, key, len);
+        if(n < 0 || (upper && n == 0))
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+bool atl_cursor_terms_find(atl_cursor_terms_t *h, const char *term, uint32_t *index) {
+    uint32_t i = terms_bound(h, term, strlen(term) + 1, false);
+    if(i >= h->num_terms || strcmp(h->terms[i].term, term))
+        return false;
+    *index = i;
+    return true;
+}
+
+uint32_t atl_cursor_terms_prefix(atl_cursor_terms_t *h, const char *prefix, size_t len,
+                                 uint32_t *start, uint32_t *end) {
+    *start = terms_bound(h, prefix, len, false);
+    *end = terms_bound(h, prefix, len, true);
+    return *end - *start;
+}
+
+/* glob match of s against p, where '*' matches any run of bytes and '?' one byte */
+static
+bool wildcard_match(const char *p, const char *s) {
+    const char *star = NULL, *retry = NULL;
+    while(*s) {
+        if(*p == '?' || (*p && *p == *s && *p != '*')) {
+            p++;
+            s++;
+        }
+        else if(*p == '*') {
+            star = ++p;
+            retry = s;
+        }
+        else if(star) {
+            p = star;
+            s = ++retry;
+        }
+        else
+            return false;
+    }
+    while(*p == '*')
+        p++;
+    return *p == 0;
+}
+
+static
+int compare_ids(const void *p1, const void *p2) {
+    uint32_t a = *(const uint32_t *)p1;
+    uint32_t b = *(const uint32_t *)p2;
+    return a < b ? -1 : a > b ? 1 : 0;
+}
+
+/* the union of the postings of the matches as a bitmap or sorted array cursor */
+static
+atl_cursor_t *terms_union(aml_pool_t *pool, atl_cursor_terms_t *h,
+                          const uint32_t *matches, uint32_t num_matches) {
+    size_t total = 0;
+    uint32_t num_bits = 0;
+    for( uint32_t i=0; i<num_matches; i++ ) {
+        term_entry_t *e = h->terms + matches[i];
+        total += e->num_ids;
+        if(e->num_ids && e->ids[e->num_ids-1] >= num_bits)
+            num_bits = e->ids[e->num_ids-1] + 1;
+    }
+
+    size_t num_words = ((size_t)num_bits + 63) >> 6;
+    if(num_words * sizeof(uint64_t) <= total * sizeof(uint32_t)) {
+        uint64_t *bits = (uint64_t *)aml_pool_zalloc(pool, num_words * sizeof(uint64_t));
+        for( uint32_t i=0; i<num_matches; i++ ) {
+            term_entry_t *e = h->terms + matches[i];
+            for( uint32_t j=0; j<e->num_ids; j++ )
+                bits[e->ids[j] >> 6] |= 1ULL << (e->ids[j] & 63);
+        }
+        return atl_cursor_bitmap(pool, bits, num_bits);
+    }
+
+    uint32_t *ids = (uint32_t *)aml_pool_alloc(pool, sizeof(uint32_t) * (total+1));
+    uint32_t *p = ids;
+    for( uint32_t i=0; i<num_matches; i++ ) {
+        term_entry_t *e = h->terms + matches[i];
+        memcpy(p, e->ids, sizeof(uint32_t) * e->num_ids);
+        p += e->num_ids;
+    }
+    qsort(ids, total, sizeof(uint32_t), compare_ids);
+    uint32_t num_ids = 0;
+    for( size_t i=0; i<total; i++ )
+        if(!num_ids || ids[i] != ids[num_ids-1])
+            ids[num_ids++] = ids[i];
+    return atl_cursor_array(pool, ids, num_ids);
+}
+
+atl_cursor_t *atl_cursor_terms_open(aml_pool_t *pool, atl_cursor_terms_t *h, const char *pattern) {
+    size_t prefix_len = strcspn(pattern, "*?");
+    if(!pattern[prefix_len]) {
+        uint32_t i;
+        if(!atl_cursor_terms_find(h, pattern, &i))
+            return atl_cursor_init_empty(pool);
+        return atl_cursor_array(pool, h->terms[i].ids, h->terms[i].num_ids);
+    }
+
+    uint32_t start, end;
+    if(!atl_cursor_terms_prefix(h, pattern, prefix_len, &start, &end))
+        return atl_cursor_init_empty(pool);
+
+    /* the part of the pattern after the prefix is matched against the rest of each term */
+    const char *rest = pattern + prefix_len;
+    bool match_all = true;
+    for( const char *p=rest; *p; p++ )
+        if(*p != '*')
+            match_all = false;
+
+    aml_buffer_t *bh = aml_buffer_pool_init(pool, 16 * sizeof(uint32_t));
+    for( uint32_t i=start; i<end; i++ ) {
+        if(!h->terms[i].num_ids)
+            continue;
+        if(!match_all && !wildcard_match(rest, h->terms[i].term + prefix_len))
+            continue;
+        aml_buffer_append(bh, &i, sizeof(i));
+    }
+    uint32_t *matches = (uint32_t *)aml_buffer_data(bh);
+    uint32_t num_matches = aml_buffer_length(bh) / sizeof(uint32_t);
+    if(!num_matches)
+        return atl_cursor_init_empty(pool);
+    if(num_matches == 1)
+        return atl_cursor_array(pool, h->terms[matches[0]].ids, h->terms[matches[0]].num_ids);
+    if(num_matches > TERMS_OR_LIMIT)
+        return terms_union(pool, h, matches, num_matches);
+
+    atl_cursor_t *c = atl_cursor_init_or(pool);
+    for( uint32_t i=0; i<num_matches; i++ ) {
+        term_entry_t *e = h->terms + matches[i];
+        c->add(c, atl_cursor_array(pool, e->ids, e->num_ids));
+    }
+    return c;
+}
+
+atl_cursor_t *atl_cursor_terms_cb(aml_pool_t *pool, atl_token_t *t, void *arg) {
+    return atl_cursor_terms_open(pool, (atl_cursor_terms_t *)arg, t->token);
+}
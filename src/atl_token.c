@@ -3,12 +3,17 @@
 #include "a-tokenizer-library/atl_token.h"
 #include "a-memory-library/aml_buffer.h"
 #include "the-io-library/io_in.h"
-#include "the-macro-library/macro_map.h"
 
 #include <string.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdbool.h>
+#include <stddef.h>
+#include <math.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 struct token_head_s;
 typedef struct token_head_s token_head_t;
@@ -23,8 +28,33 @@ struct token_head_s {
 
     atl_token_set_var_cb cb;
     void *arg;    
+    uint32_t flags;
+
+    /* the number of ancestors of tail which are quotes and braces */
+    uint32_t quote_depth;
+    uint32_t brace_depth;
 };
 
+/* tail becomes t, a child of the current tail */
+static inline
+void token_tail_down(token_head_t *th, atl_token_t *t) {
+    if(th->tail->type == ATL_TOKEN_DQUOTE)
+        th->quote_depth++;
+    else if(th->tail->type == ATL_TOKEN_OPEN_BRACE)
+        th->brace_depth++;
+    th->tail = t;
+}
+
+/* tail becomes the parent of the current tail */
+static inline
+void token_tail_up(token_head_t *th) {
+    th->tail = th->tail->parent;
+    if(th->tail->type == ATL_TOKEN_DQUOTE)
+        th->quote_depth--;
+    else if(th->tail->type == ATL_TOKEN_OPEN_BRACE)
+        th->brace_depth--;
+}
+
 static
 void token_merge(token_head_t *th, const char *p, size_t len, atl_token_type_t type ) {
     size_t tlen = strlen(th->tail->token);
@@ -86,7 +116,7 @@ static atl_token_t * __token_init(token_head_t *th, const char *p, size_t len, s
 
     if(type == ATL_TOKEN_CLOSE_PAREN) {
         if(th->tail && th->tail->parent && th->tail->parent->type == ATL_TOKEN_OPEN_PAREN)
-            th->tail = th->tail->parent;
+            token_tail_up(th);
         else if(tail_type == ATL_TOKEN_OPEN_PAREN && !th->tail->child) {
             atl_token_t *t = (atl_token_t *)aml_pool_zalloc(th->pool, sizeof(atl_token_t) + 1);
             t->token = (char *)(t+1);
@@ -100,7 +130,7 @@ static atl_token_t * __token_init(token_head_t *th, const char *p, size_t len, s
     }
     else if(type == ATL_TOKEN_CLOSE_BRACE) {
         if(th->tail && th->tail->parent && th->tail->parent->type == ATL_TOKEN_OPEN_BRACE)
-            th->tail = th->tail->parent;
+            token_tail_up(th);
         else if(tail_type == ATL_TOKEN_OPEN_BRACE && !th->tail->child) {
             atl_token_t *t = (atl_token_t *)aml_pool_zalloc(th->pool, sizeof(atl_token_t) + 1);
             t->token = (char *)(t+1);
@@ -114,7 +144,7 @@ static atl_token_t * __token_init(token_head_t *th, const char *p, size_t len, s
     }    
     else if(type == ATL_TOKEN_CLOSE_BRACKET) {
         if(th->tail && th->tail->parent && th->tail->parent->type == ATL_TOKEN_OPEN_BRACKET)
-            th->tail = th->tail->parent;
+            token_tail_up(th);
         else if(tail_type == ATL_TOKEN_OPEN_BRACKET && !th->tail->child) {
             atl_token_t *t = (atl_token_t *)aml_pool_zalloc(th->pool, sizeof(atl_token_t) + 1);
             t->token = (char *)(t+1);
@@ -128,7 +158,7 @@ static atl_token_t * __token_init(token_head_t *th, const char *p, size_t len, s
     }
     else if(type == ATL_TOKEN_DQUOTE) {
         if(th->tail && th->tail->parent && th->tail->parent->type == ATL_TOKEN_DQUOTE) {
-            th->tail = th->tail->parent;
+            token_tail_up(th);
             return NULL;        
         }
         else if(tail_type == ATL_TOKEN_DQUOTE && !th->tail->child) {
@@ -139,7 +169,7 @@ static atl_token_t * __token_init(token_head_t *th, const char *p, size_t len, s
         if(th->tail && th->tail->parent && 
            th->tail->parent->type == ATL_TOKEN_COMPARISON && 
            !strcmp(th->tail->parent->token, "="))
-            th->tail = th->tail->parent;
+            token_tail_up(th);
         return NULL;
     }
     else if(type == ATL_TOKEN_COMMA) {        
@@ -185,12 +215,12 @@ static atl_token_t * __token_init(token_head_t *th, const char *p, size_t len, s
             )) {            
             t->parent = th->tail;
             th->tail->child = t;            
-            th->tail = t;
+            token_tail_down(th, t);
         } 
         else if(tail_type == ATL_TOKEN_COMPARISON && !th->tail->child && !strcmp(th->tail->token, "=")) {
             t->parent = th->tail;
             th->tail->child = t;
-            th->tail = t;
+            token_tail_down(th, t);
         } 
         else {
             t->parent = th->tail->parent;
@@ -230,7 +260,15 @@ static atl_token_t * _token_init(token_head_t *th, const char *p, size_t len, si
         atl_token_cb_data_t data;
         memset(&data, 0, sizeof(data));
         data.pool = th->pool;
-        data.param = aml_pool_strndup(th->pool, p, len);
+        if(th->flags & ATL_TOKEN_PARSE_SPANS) {
+            data.text = p;
+            data.len = len;
+        }
+        else {
+            data.param = aml_pool_strndup(th->pool, p, len);
+            data.text = data.param;
+            data.len = len;
+        }
         if(th->cb(th->arg, &data) == SKIP)
             return NULL;
         alt = data.alt_token;
@@ -569,226 +607,161 @@ atl_token_t *atl_token_parse(aml_pool_t *pool, const char *s) {
     return th.head;
 }
 
+static inline
+bool is_braced(token_head_t *th) {
+    return th->tail && (th->tail->type == ATL_TOKEN_OPEN_BRACE || th->brace_depth);
+}
+
+static inline
+bool is_quoted(token_head_t *th) {
+    return th->tail && (th->tail->type == ATL_TOKEN_DQUOTE || th->quote_depth);
+}
+
+static inline
+bool is_or(atl_token_t *t) {
+    return t->type == ATL_TOKEN_OR || (t->type == ATL_TOKEN_TOKEN && !strcasecmp(t->token, "or"));
+}
+
+static inline
+bool is_not(atl_token_t *t) {
+    return t->type == ATL_TOKEN_NOT || (t->type == ATL_TOKEN_TOKEN && !strcasecmp(t->token, "not"));
+}
+
 static
-bool has_parent(token_head_t *th, atl_token_type_t type) {
-    atl_token_t *t = th->tail;
-    if(t && t->type == type)
-        return true;
-    while(t && t->parent && t->parent->type != type)
-        t = t->parent;
-    if(t && t->parent)
-        return true;
-    return false;
+atl_token_t *new_group(aml_pool_t *pool, atl_token_type_t type, const char *token) {
+    size_t len = strlen(token);
+    atl_token_t *t = (atl_token_t *)aml_pool_alloc(pool, sizeof(atl_token_t) + len + 1);
+    memset(t, 0, sizeof(*t));
+    t->token = (char *)(t+1);
+    memcpy(t->token, token, len+1);
+    t->type = type;
+    return t;
 }
 
+/* children[0..num) become the children of parent (in order) */
 static
-bool is_quoted(token_head_t *th) {
-    atl_token_t *t = th->tail;
-    if(t && (t->type == ATL_TOKEN_DQUOTE))
-        return true;
-    while(t && t->parent && t->parent->type != ATL_TOKEN_DQUOTE)
-        t = t->parent;
-    if(t && t->parent)
-        return true;
-    return false; 
+void link_children(atl_token_t *parent, atl_token_t **children, uint32_t num) {
+    parent->child = children[0];
+    for( uint32_t i=0; i<num; i++ ) {
+        children[i]->parent = parent;
+        children[i]->prev = i ? children[i-1] : NULL;
+        children[i]->next = i+1 < num ? children[i+1] : NULL;
+    }
+}
+
+/* add the list starting at st as the last child of the OR (created on the first call), a
+   list of more than one token is wrapped in a paren.  Returns the new last child. */
+static
+atl_token_t *or_branch(aml_pool_t *pool, atl_token_t **or_parent, atl_token_t *last, atl_token_t *st) {
+    if(!*or_parent) {
+        *or_parent = new_group(pool, ATL_TOKEN_OR, "or");
+        (*or_parent)->parent = st->parent;
+    }
+    atl_token_t *branch = st;
+    if(st->next) {
+        branch = new_group(pool, ATL_TOKEN_OPEN_PAREN, "(");
+        branch->child = st;
+        for( atl_token_t *n=st; n; n=n->next )
+            n->parent = branch;
+    }
+    branch->parent = *or_parent;
+    if(last) {
+        branch->prev = last;
+        last->next = branch;
+    }
+    else
+        (*or_parent)->child = branch;
+    return branch;
 }
 
 atl_token_t *fix_ors(aml_pool_t *pool, atl_token_t *t) {
     atl_token_t *st = t;
     atl_token_t *resp = t;
-    aml_buffer_t *bh = aml_buffer_pool_init(pool, 32);
+    atl_token_t *or_parent = NULL;
+    atl_token_t *last = NULL;
     while(t) {
         atl_token_t *next = t->next;
-        if(t->child && t->type != ATL_TOKEN_DQUOTE)
+        if(t->child && t->type != ATL_TOKEN_DQUOTE && !t->child->read_only)
            t->child = fix_ors(pool, t->child);
-        if(t->type == ATL_TOKEN_OR || (t->type == ATL_TOKEN_TOKEN && !strcasecmp(t->token, "or"))) {
-            if(next && st != t)            
-                aml_buffer_append(bh, &st, sizeof(st));
+        if(is_or(t)) {
             if(t->prev)
                 t->prev->next = NULL;
             if(next)
                 next->prev = NULL;            
+            if(next && st != t)
+                last = or_branch(pool, &or_parent, last, st);
             st = next;
         }
         t = next;
     }
-    if(aml_buffer_length(bh)) {
-        if(st)
-            aml_buffer_append(bh, &st, sizeof(st));
-        atl_token_t **starts = (atl_token_t **)aml_buffer_data(bh);
-        uint32_t num_starts = aml_buffer_length(bh) / sizeof(atl_token_t *);
-
-        atl_token_t *or_parent = (atl_token_t *)aml_pool_alloc(pool, sizeof(atl_token_t) + 4);
-        memset(or_parent, 0, sizeof(*or_parent));
-        or_parent->token = (char *)(or_parent+1);
-        strcpy(or_parent->token, "or");
-        or_parent->type = ATL_TOKEN_OR;
-        or_parent->parent = starts[0]->parent;
-        if(or_parent->parent && or_parent->parent->child == resp)
-            or_parent->parent->child = or_parent;
-        for( uint32_t i=0; i<num_starts; i++ ) {
-            if(starts[i]->next) {
-                // (
-                atl_token_t *parent = (atl_token_t *)aml_pool_alloc(pool, sizeof(atl_token_t) + 2);
-                memset(parent, 0, sizeof(*parent));
-                parent->token = (char *)(parent+1);
-                parent->token[0] = '(';
-                parent->token[1] = 0;
-                parent->type = ATL_TOKEN_OPEN_PAREN;
-                parent->parent = or_parent;
-                parent->child = starts[i];
-                atl_token_t *n = starts[i];
-                while(n) {
-                    n->parent = parent;
-                    n = n->next;
-                }
-                if(!or_parent->child)
-                    or_parent->child = parent;
-                else {
-                    n = or_parent->child;
-                    while(n->next)
-                        n = n->next;
-                    parent->prev = n;
-                    n->next = parent;
-                }
-            }
-            else {
-                // add single token
-                starts[i]->parent = or_parent;
-                if(!or_parent->child)
-                    or_parent->child = starts[i];
-                else {
-                    atl_token_t *n = or_parent->child;
-                    while(n->next)
-                        n = n->next;
-                    starts[i]->prev = n;
-                    n->next = starts[i];
-                }
-            }
-        }
-        return or_parent;
-    }
-    return resp;
+    if(!or_parent)
+        return resp;
+    if(st)
+        or_branch(pool, &or_parent, last, st);
+    if(or_parent->parent && or_parent->parent->child == resp)
+        or_parent->parent->child = or_parent;
+    return or_parent;
 }
 
+/* Each token following a NOT is collected (OR'ed if there is more than one) as the negative
+   side of a new NOT token and the remaining tokens (grouped in a paren if there is more than
+   one) become its positive side.  The tokens are collected in a single pass. */
 atl_token_t *fix_nots(aml_pool_t *pool, atl_token_t *t) {
-    atl_token_t *st = t;
     atl_token_t *resp = t;
-    int num_nots = 0, num_others = 0;
+    aml_buffer_t *nots = NULL;
+    aml_buffer_t *others = NULL;
+    uint32_t num_others = 0;
     while(t) {
         atl_token_t *next = t->next;
-        if(t->child && t->type != ATL_TOKEN_DQUOTE)
+        if(t->child && t->type != ATL_TOKEN_DQUOTE && !t->child->read_only)
            t->child = fix_nots(pool, t->child);
-        if(t->type == ATL_TOKEN_NOT || (t->type == ATL_TOKEN_TOKEN && !strcasecmp(t->token, "not"))) {
+        if(is_not(t)) {
             if(next) {
-                num_nots++;
+                if(!nots) {
+                    /* the tokens before the first NOT are all others */
+                    nots = aml_buffer_pool_init(pool, 16 * sizeof(atl_token_t *));
+                    others = aml_buffer_pool_init(pool, 16 * sizeof(atl_token_t *));
+                    for( atl_token_t *o=resp; o != t; o=o->next )
+                        aml_buffer_append(others, &o, sizeof(o));
+                }
+                aml_buffer_append(nots, &next, sizeof(next));
                 next = next->next;
             }
         }
-        else
+        else {
+            if(others)
+                aml_buffer_append(others, &t, sizeof(t));
             num_others++;
+        }
         t = next;
     }
-    if(num_nots > 0 && num_others > 0) {
-        atl_token_t *root_parent = resp->parent;
-        atl_token_t **nots = (atl_token_t **)aml_pool_zalloc(pool, sizeof(atl_token_t *)*(num_nots+1));
-        atl_token_t **others = (atl_token_t **)aml_pool_zalloc(pool, sizeof(atl_token_t *)*(num_others+1));
-        num_nots = 0;
-        num_others = 0;
-        t = resp;
-        while(t) {
-            atl_token_t *next = t->next;
-            if(t->type == ATL_TOKEN_NOT || (t->type == ATL_TOKEN_TOKEN && !strcasecmp(t->token, "not"))) {
-                if(t->prev)
-                    t->prev->next = NULL;
-                if(next) {
-                    next->prev = NULL;
-                    if(next->next)
-                        next->next->prev = NULL;
-                }
-                if(next) {
-                    nots[num_nots] = next;
-                    num_nots++;
-                    atl_token_t *next2 = next->next;
-                    next->next = NULL;                    
-                    next = next2;                  
-                }
-            }
-            else {
-                others[num_others] = t;
-                num_others++;
-                if(t->prev)
-                    t->prev->next = NULL;
-                if(t->next)
-                    t->next->prev = NULL;
-                t->next = NULL;
-                t->prev = NULL;
-            }
-            t = next;
-        }
-        atl_token_t *not_root = NULL;
-        if(num_nots > 1) {
-            atl_token_t *or_parent = (atl_token_t *)aml_pool_alloc(pool, sizeof(atl_token_t) + 4);
-            memset(or_parent, 0, sizeof(*or_parent));
-            or_parent->token = (char *)(or_parent+1);
-            strcpy(or_parent->token, "or");
-            or_parent->type = ATL_TOKEN_OR;
-            or_parent->child = nots[0];
-            nots[0]->parent = or_parent;
-            nots[0]->prev = NULL;
-            nots[num_nots-1]->next = NULL;
-            for( int i=1; i<num_nots; i++ ) {
-                nots[i]->parent = or_parent;
-                nots[i]->prev = nots[i-1];
-                nots[i-1]->next = nots[i];
-            }
-            not_root = or_parent;
-        }
-        else
-            not_root = nots[0];
-        atl_token_t *other_root = NULL;
-        if(num_others > 1) {
-            atl_token_t *and_parent = (atl_token_t *)aml_pool_alloc(pool, sizeof(atl_token_t) + 2);
-            memset(and_parent, 0, sizeof(*and_parent));
-            and_parent->token = (char *)(and_parent+1);
-            strcpy(and_parent->token, "(");
-            and_parent->type = ATL_TOKEN_OPEN_PAREN;
-            and_parent->child = others[0];
-            others[0]->parent = and_parent;
-            others[0]->prev = NULL;
-            others[num_others-1]->next = NULL;
-            for( int i=1; i<num_others; i++ ) {
-                others[i]->parent = and_parent;
-                others[i]->prev = others[i-1];
-                others[i-1]->next = others[i];
-            }
-            other_root = and_parent;
-        }
-        else if(num_others == 1)
-            other_root = others[0];
-
-        atl_token_t *not_parent = (atl_token_t *)aml_pool_alloc(pool, sizeof(atl_token_t) + 4);
-        memset(not_parent, 0, sizeof(*not_parent));
-        not_parent->token = (char *)(not_parent+1);
-        strcpy(not_parent->token, "not");
-        not_parent->parent = root_parent;
-        if(not_parent->parent && not_parent->parent->child == resp)
-            not_parent->parent->child = not_parent;
-        not_parent->type = ATL_TOKEN_NOT;
-        not_parent->child = not_root;
-        not_root->parent = not_parent;
-        not_root->next = other_root;
-        not_root->prev = NULL;
-        if(other_root) {
-            other_root->prev = not_root;
-            other_root->parent = not_parent;
-            other_root->next = NULL;
-        }
-        return not_parent;
+    if(!nots || !num_others)
+        return resp;
+
+    atl_token_t *root_parent = resp->parent;
+    atl_token_t **not_tokens = (atl_token_t **)aml_buffer_data(nots);
+    uint32_t num_nots = aml_buffer_length(nots) / sizeof(atl_token_t *);
+    atl_token_t **other_tokens = (atl_token_t **)aml_buffer_data(others);
+
+    atl_token_t *not_root = not_tokens[0];
+    if(num_nots > 1) {
+        not_root = new_group(pool, ATL_TOKEN_OR, "or");
+        link_children(not_root, not_tokens, num_nots);
+    }
+    atl_token_t *other_root = other_tokens[0];
+    if(num_others > 1) {
+        other_root = new_group(pool, ATL_TOKEN_OPEN_PAREN, "(");
+        link_children(other_root, other_tokens, num_others);
     }
-    return resp;
-}
 
+    atl_token_t *not_parent = new_group(pool, ATL_TOKEN_NOT, "not");
+    not_parent->parent = root_parent;
+    if(not_parent->parent && not_parent->parent->child == resp)
+        not_parent->parent->child = not_parent;
+    atl_token_t *children[2] = { not_root, other_root };
+    link_children(not_parent, children, 2);
+    return not_parent;
+}
 
 atl_token_t *group_and(aml_pool_t *pool, atl_token_t *t) {
     if(!t->next)
@@ -807,12 +780,15 @@ atl_token_t *fix_open_parens(aml_pool_t *pool, atl_token_t *t) {
     return t;
 }
 
-char *get_next_token(aml_pool_t *pool, char **s, char *eot) {
+/* the next attr (quoted or ending at whitespace or a character in eot) */
+static
+atl_token_span_t next_attr(char **s, const char *eot) {
     char *p = *s;
-    char *sp = p;    
+    atl_token_span_t r;
+    r.text = p;
     if(*p == '\'' || *p == '\"') {
         char quote = *p++;    
-        sp++;
+        r.text = p;
         while(*p && *p != quote) {
             if(*p == '\\' && p[1])
                 p += 2;
@@ -820,7 +796,8 @@ char *get_next_token(aml_pool_t *pool, char **s, char *eot) {
                 p++;
         }
         *s = *p == quote ? p+1 : p;
-        return aml_pool_strndup(pool, sp, p-sp);
+        r.len = p - r.text;
+        return r;
     }
 
     while(*p) {
@@ -831,34 +808,63 @@ char *get_next_token(aml_pool_t *pool, char **s, char *eot) {
         p++;
     }
     *s = p;
-    return aml_pool_strndup(pool, sp, p-sp);
+    r.len = p - r.text;
+    return r;
+}
+
+/* copies the attrs into a single allocation */
+static
+char **copy_attrs(aml_pool_t *pool, atl_token_span_t *spans, uint32_t num_spans) {
+    size_t len = sizeof(char *) * (num_spans+1);
+    for( uint32_t i=0; i<num_spans; i++ )
+        len += spans[i].len + 1;
+    char **attrs = (char **)aml_pool_alloc(pool, len);
+    char *p = (char *)(attrs + num_spans + 1);
+    for( uint32_t i=0; i<num_spans; i++ ) {
+        attrs[i] = p;
+        memcpy(p, spans[i].text, spans[i].len);
+        p += spans[i].len;
+        *p++ = 0;
+    }
+    attrs[num_spans] = NULL;
+    return attrs;
 }
 
 char *token_parse_attr(token_head_t *th, char *p, char *ep) {
     char *s = ep;
-    aml_buffer_t *bh = aml_buffer_pool_init(th->pool, 16);
+    aml_buffer_t *bh = aml_buffer_pool_init(th->pool, 16 * sizeof(atl_token_span_t));
     if(*s == '[') {
         s++;
         while(*s && *s != ']') {
-            char *token = get_next_token(th->pool, &s, "],");
-            if(token[0])
-                aml_buffer_append(bh, &token, sizeof(token));
+            atl_token_span_t attr = next_attr(&s, "],");
+            if(attr.len)
+                aml_buffer_append(bh, &attr, sizeof(attr));
             if(*s && *s != ']')
                 s++;
         }
         if(*s == ']')
             s++;
     }
-    char *token = get_next_token(th->pool, &s, "");
-    if(token[0])
-        aml_buffer_append(bh, &token, sizeof(token));
+    atl_token_span_t attr = next_attr(&s, "");
+    if(attr.len)
+        aml_buffer_append(bh, &attr, sizeof(attr));
+
+    atl_token_span_t *spans = (atl_token_span_t *)aml_buffer_data(bh);
+    uint32_t num_spans = aml_buffer_length(bh) / sizeof(atl_token_span_t);
 
     atl_token_cb_data_t data;
     memset(&data, 0, sizeof(data));
     data.pool = th->pool;
-    data.param = aml_pool_strndup(th->pool, p, ep-p);
-    data.attrs = (char **)aml_buffer_data(bh);
-    data.num_attrs = aml_buffer_length(bh) / sizeof(char *);
+    data.text = p;
+    data.len = ep-p;
+    data.num_attrs = num_spans;
+    if(th->flags & ATL_TOKEN_PARSE_SPANS)
+        data.attr_spans = spans;
+    else {
+        data.param = aml_pool_strndup(th->pool, p, ep-p);
+        data.text = data.param;
+        data.attrs = copy_attrs(th->pool, spans, num_spans);
+    }
     atl_token_cb_t v=NORMAL;
     if(th->cb)
         v=th->cb(th->arg, &data);
@@ -870,50 +876,108 @@ char *token_parse_attr(token_head_t *th, char *p, char *ep) {
     if(v == SKIP)
         return s;
 
-    atl_token_t *tok = __token_init(th, data.param, strlen(data.param), 0, ATL_TOKEN_TOKEN, v, data.alt_token);
-    if(data.num_attrs) {
-        tok->attrs = data.attrs;
+    atl_token_t *tok;
+    if(data.param)
+        tok = __token_init(th, data.param, strlen(data.param), 0, ATL_TOKEN_TOKEN, v, data.alt_token);
+    else
+        tok = __token_init(th, data.text, data.len, 0, ATL_TOKEN_TOKEN, v, data.alt_token);
+    if(tok && data.num_attrs) {
+        tok->attrs = data.attrs ? data.attrs : copy_attrs(th->pool, spans, data.num_attrs);
         tok->num_attrs = data.num_attrs;
     }
     return s;
 }
 
 atl_token_t *atl_token_parse_expression(aml_pool_t *pool, const char *s,
-                                      atl_token_set_var_cb cb, void *arg) {
+                                        atl_token_set_var_cb cb, void *arg) {
+    return atl_token_parse_expression_ex(pool, s, cb, arg, 0);
+}
+
+static inline
+bool is_number_end(int ch) {
+    return !((ch >= '0' && ch <= '9') || (ch >= 'a' && ch <= 'z') || (ch >= 'A' && ch <= 'Z') ||
+             ch == '_' || ch == ':' || (ch & 0x80));
+}
+
+/* Adds the number at s as an ATL_TOKEN_NUMBER token and returns the end of it, or returns
+   NULL if s doesn't start a number (so it is parsed as part of a token). */
+static
+const char *token_number(token_head_t *th, const char *s) {
+    const char *p = s;
+    uint64_t v = 0;
+    bool is_double = false;
+    while(*p >= '0' && *p <= '9') {
+        if(v > ((uint64_t)INT64_MAX - (uint64_t)(*p - '0')) / 10)
+            is_double = true;
+        v = v * 10 + (*p - '0');
+        p++;
+    }
+    if(*p == '.' && p[1] >= '0' && p[1] <= '9') {
+        is_double = true;
+        p++;
+        while(*p >= '0' && *p <= '9')
+            p++;
+    }
+    if(*p == 'e' || *p == 'E') {
+        const char *e = p+1;
+        if(*e == '-' || *e == '+')
+            e++;
+        if(*e >= '0' && *e <= '9') {
+            is_double = true;
+            p = e;
+            while(*p >= '0' && *p <= '9')
+                p++;
+        }
+    }
+    if(!is_number_end(*p))
+        return NULL;
+
+    double d = 0.0;
+    if(is_double) {
+        char *ep = NULL;
+        d = strtod(s, &ep);
+        if(ep != p)
+            return NULL;
+    }
+    atl_token_t *t = _token_init(th, s, p-s, 0, ATL_TOKEN_NUMBER, NORMAL);
+    /* a token from the callback keeps its own type */
+    if(t && t->type == ATL_TOKEN_NUMBER && !t->read_only) {
+        t->is_double = is_double;
+        if(is_double)
+            t->value.d = d;
+        else
+            t->value.i = (int64_t)v;
+    }
+    return p;
+}
+
+atl_token_t *atl_token_parse_expression_ex(aml_pool_t *pool, const char *s,
+                                           atl_token_set_var_cb cb, void *arg, uint32_t flags) {
     token_head_t th;
     memset(&th, 0, sizeof(th));
     th.pool = pool;
     th.cb = cb;
     th.arg = arg;
+    th.flags = flags;
     char *token_start = NULL;
     while(*s) {
         int ch = *s;
         switch(ch) {
-        /*
         case '0' ... '9':
-        {
-            if(token_start) {
-                s++;
-                continue;
-            }
-            else {
-                const char *sp = s;
-                s++;
-                while(*s >= '0' && *s <= '9')
-                    s++;
-                if(*s == '.' && s[1] >= '0' && s[1] <= '9') {
-                    s++;
-                    while(*s >= '0' && *s <= '9')
-                        s++;
+            if(!token_start && (th.flags & ATL_TOKEN_PARSE_NUMBERS) && !is_quoted(&th)) {
+                const char *ep = token_number(&th, s);
+                if(ep) {
+                    s = ep;
+                    break;
                 }
-                _token_init(&th, sp, s-sp, ATL_TOKEN_NUMBER, NUMBER );
             }
+            if(!token_start)
+                token_start = (char *)s;
+            s++;
             break;
-        }
-        */
         case '*':
             if(token_start) {
-                if(has_parent(&th, ATL_TOKEN_OPEN_BRACE)) {
+                if(is_braced(&th)) {
                     if(token_start) {
                         token_init(&th, token_start, s-token_start, 0, ATL_TOKEN_MODIFIER );
                         token_start = NULL;
@@ -1154,66 +1218,662 @@ atl_token_t *atl_token_parse_expression(aml_pool_t *pool, const char *s,
 }
 
 
-struct atl_token_dict_s {
-    aml_pool_t *pool;
-    macro_map_t *root;
-};
+static
+uint64_t token_hash(atl_token_t *t);
+
+static
+uint64_t token_list_hash(atl_token_t *t, uint64_t h) {
+    while(t) {
+        h = (h ^ token_hash(t)) * 1099511628211ULL;
+        t = t->next;
+    }
+    return h;
+}
+
+/* hash of the token and its subtree (but not its siblings) */
+static
+uint64_t token_hash(atl_token_t *t) {
+    uint64_t h = 14695981039346656037ULL;
+    h = (h ^ (uint64_t)t->type) * 1099511628211ULL;
+    h = (h ^ (uint64_t)t->attr_type) * 1099511628211ULL;
+    for( const char *p=t->token; *p; p++ )
+        h = (h ^ (unsigned char)*p) * 1099511628211ULL;
+    for( uint32_t i=0; i<t->num_attrs; i++ ) {
+        h = (h ^ 0xFF) * 1099511628211ULL;
+        for( const char *p=t->attrs[i]; *p; p++ )
+            h = (h ^ (unsigned char)*p) * 1099511628211ULL;
+    }
+    h = token_list_hash(t->attr, h);
+    return token_list_hash(t->child, h);
+}
+
+static
+bool token_equal(atl_token_t *a, atl_token_t *b);
+
+static
+bool token_list_equal(atl_token_t *a, atl_token_t *b) {
+    while(a && b) {
+        if(!token_equal(a, b))
+            return false;
+        a = a->next;
+        b = b->next;
+    }
+    return a == b;
+}
+
+/* true if a and b (and their subtrees) are the same */
+static
+bool token_equal(atl_token_t *a, atl_token_t *b) {
+    if(a == b)
+        return true;
+    if(a->type != b->type || a->attr_type != b->attr_type || a->no_params != b->no_params ||
+       a->num_attrs != b->num_attrs || strcmp(a->token, b->token))
+        return false;
+    for( uint32_t i=0; i<a->num_attrs; i++ )
+        if(strcmp(a->attrs[i], b->attrs[i]))
+            return false;
+    return token_list_equal(a->attr, b->attr) && token_list_equal(a->child, b->child);
+}
+
+static
+void token_set_children(atl_token_t *t, atl_token_t **children, uint32_t num_children) {
+    t->child = num_children ? children[0] : NULL;
+    for( uint32_t i=0; i<num_children; i++ ) {
+        children[i]->parent = t;
+        children[i]->prev = i ? children[i-1] : NULL;
+        children[i]->next = i+1 < num_children ? children[i+1] : NULL;
+    }
+}
 
+/* removes repeated subtrees from children while maintaining the order of first occurrence */
+static
+uint32_t token_dedup(aml_pool_t *pool, atl_token_t **children, uint32_t num_children) {
+    uint32_t num = 0;
+    if(num_children <= 8) {
+        for( uint32_t i=0; i<num_children; i++ ) {
+            uint32_t j=0;
+            while(j < num && !token_equal(children[j], children[i]))
+                j++;
+            if(j == num)
+                children[num++] = children[i];
+        }
+        return num;
+    }
+
+    uint32_t size = 16;
+    while(size < num_children * 2)
+        size <<= 1;
+    uint32_t mask = size-1;
+    uint64_t *hashes = (uint64_t *)aml_pool_alloc(pool, sizeof(uint64_t) * num_children);
+    uint32_t *slots = (uint32_t *)aml_pool_alloc(pool, sizeof(uint32_t) * size);
+    memset(slots, 0xFF, sizeof(uint32_t) * size);
+    for( uint32_t i=0; i<num_children; i++ ) {
+        uint64_t h = token_hash(children[i]);
+        uint32_t slot = (uint32_t)h & mask;
+        bool found = false;
+        while(slots[slot] != (uint32_t)-1) {
+            uint32_t j = slots[slot];
+            if(hashes[j] == h && token_equal(children[j], children[i])) {
+                found = true;
+                break;
+            }
+            slot = (slot+1) & mask;
+        }
+        if(found)
+            continue;
+        hashes[num] = h;
+        children[num] = children[i];
+        slots[slot] = num;
+        num++;
+    }
+    return num;
+}
+
+static
+atl_token_t *optimize_token(aml_pool_t *pool, atl_token_t *t) {
+    if(!t->child)
+        return t->type == ATL_TOKEN_NULL ? NULL : t;
+
+    /* children shared with a dictionary can't be relinked */
+    if(t->child->read_only)
+        return t;
+
+    if(t->type == ATL_TOKEN_NOT) {
+        if(!t->child->next)
+            return NULL;
+        atl_token_t *children[2];
+        children[1] = optimize_token(pool, t->child->next);
+        if(!children[1])
+            return NULL;
+        children[0] = optimize_token(pool, t->child);
+        if(!children[0])
+            return children[1];
+        if(token_equal(children[0], children[1]))
+            return NULL;
+        token_set_children(t, children, 2);
+        return t;
+    }
+
+    if(t->type != ATL_TOKEN_OPEN_PAREN && t->type != ATL_TOKEN_OR)
+        return t;
+
+    aml_buffer_t *bh = aml_buffer_pool_init(pool, 16 * sizeof(atl_token_t *));
+    atl_token_t *n = t->child;
+    while(n) {
+        atl_token_t *next = n->next;
+        atl_token_t *c = optimize_token(pool, n);
+        if(!c) {
+            if(t->type == ATL_TOKEN_OPEN_PAREN)
+                return NULL;
+        }
+        else if(c->type == t->type && c->child && !c->child->read_only && !c->attr && !c->num_attrs) {
+            atl_token_t *sub = c->child;
+            while(sub) {
+                aml_buffer_append(bh, &sub, sizeof(sub));
+                sub = sub->next;
+            }
+        }
+        else
+            aml_buffer_append(bh, &c, sizeof(c));
+        n = next;
+    }
+
+    atl_token_t **children = (atl_token_t **)aml_buffer_data(bh);
+    uint32_t num_children = aml_buffer_length(bh) / sizeof(atl_token_t *);
+    num_children = token_dedup(pool, children, num_children);
+    if(!num_children)
+        return NULL;
+    if(num_children == 1 && !t->attr && !t->num_attrs)
+        return children[0];
+    token_set_children(t, children, num_children);
+    return t;
+}
+
+atl_token_t *atl_token_optimize(aml_pool_t *pool, atl_token_t *t) {
+    if(!t)
+        return NULL;
+    atl_token_t *parent = t->parent, *prev = t->prev, *next = t->next;
+    atl_token_t *r = optimize_token(pool, t);
+    if(!r)
+        return NULL;
+    r->parent = parent;
+    r->prev = prev;
+    r->next = next;
+    return r;
+}
+
+
+static
+void canonical_append(aml_buffer_t *bh, const char *s, uint32_t flags) {
+    for( ; *s; s++ ) {
+        char ch = *s;
+        switch(ch) {
+        case '\\':
+        case '(':
+        case ')':
+        case '[':
+        case ']':
+        case '{':
+        case '}':
+        case ',':
+        case ':':
+        case '#':
+        case ' ':
+            aml_buffer_appendc(bh, '\\');
+            aml_buffer_appendc(bh, ch);
+            break;
+        case 'A' ... 'Z':
+            if(flags & ATL_TOKEN_CANONICAL_CASE)
+                aml_buffer_appendc(bh, ch);
+            else
+                aml_buffer_appendc(bh, ch - 'A' + 'a');
+            break;
+        default:
+            aml_buffer_appendc(bh, ch);
+            break;
+        }
+    }
+}
+
+static
+int compare_canonical(const void *a, const void *b) {
+    return strcmp(*(const char **)a, *(const char **)b);
+}
+
+static
+char *token_canonical(aml_pool_t *pool, atl_token_t *t, uint32_t flags);
+
+static inline
+bool canonical_is_group(atl_token_t *t) {
+    return (t->type == ATL_TOKEN_OPEN_PAREN || t->type == ATL_TOKEN_OR) && t->child &&
+           !t->attr && !t->num_attrs && t->attr_type == NORMAL;
+}
+
+/* collects the canonical form of each token in the list, lifting the children of nested
+   groups of the given type */
+static
+void canonical_collect(aml_pool_t *pool, aml_buffer_t *subs, atl_token_t *t,
+                       atl_token_type_t group_type, uint32_t flags) {
+    for( ; t; t=t->next ) {
+        if(t->type == group_type && canonical_is_group(t))
+            canonical_collect(pool, subs, t->child, group_type, flags);
+        else {
+            char *sub = token_canonical(pool, t, flags);
+            aml_buffer_append(subs, &sub, sizeof(sub));
+        }
+    }
+}
+
+static
+void canonical_list(aml_buffer_t *bh, char **subs, uint32_t num_subs) {
+    for( uint32_t i=0; i<num_subs; i++ ) {
+        aml_buffer_appendc(bh, ' ');
+        aml_buffer_appends(bh, subs[i]);
+    }
+}
+
+static
+uint32_t canonical_sort(char **subs, uint32_t num_subs) {
+    if(num_subs < 2)
+        return num_subs;
+    qsort(subs, num_subs, sizeof(char *), compare_canonical);
+    uint32_t num = 1;
+    for( uint32_t i=1; i<num_subs; i++ )
+        if(strcmp(subs[i], subs[num-1]))
+            subs[num++] = subs[i];
+    return num;
+}
+
+static
+char *token_canonical(aml_pool_t *pool, atl_token_t *t, uint32_t flags) {
+    aml_buffer_t *subs = NULL;
+    uint32_t num_subs = 0;
+    if(t->child) {
+        subs = aml_buffer_pool_init(pool, 16 * sizeof(char *));
+        if(canonical_is_group(t)) {
+            canonical_collect(pool, subs, t->child, t->type, flags);
+            num_subs = canonical_sort((char **)aml_buffer_data(subs),
+                                      aml_buffer_length(subs) / sizeof(char *));
+            if(num_subs == 1)
+                return ((char **)aml_buffer_data(subs))[0];
+        }
+        else {
+            canonical_collect(pool, subs, t->child, ATL_TOKEN_NULL, flags);
+            num_subs = aml_buffer_length(subs) / sizeof(char *);
+        }
+    }
+
+    aml_buffer_t *bh = aml_buffer_pool_init(pool, 64);
+    if(t->child) {
+        if(t->type == ATL_TOKEN_OPEN_PAREN)
+            aml_buffer_appends(bh, "(and");
+        else if(t->type == ATL_TOKEN_OR)
+            aml_buffer_appends(bh, "(or");
+        else if(t->type == ATL_TOKEN_NOT)
+            aml_buffer_appends(bh, "(not");
+        else if(t->type == ATL_TOKEN_DQUOTE)
+            aml_buffer_appends(bh, "(phrase");
+        else {
+            aml_buffer_appendf(bh, "(#%d:", t->type);
+            canonical_append(bh, t->token, flags);
+        }
+    }
+    else if(t->type != ATL_TOKEN_TOKEN) {
+        aml_buffer_appendf(bh, "#%d:", t->type);
+        canonical_append(bh, t->token, flags);
+    }
+    else
+        canonical_append(bh, t->token, flags);
+
+    if(t->attr_type != NORMAL)
+        aml_buffer_appendf(bh, "#%d", t->attr_type);
+    if(t->num_attrs) {
+        aml_buffer_appendc(bh, '[');
+        for( uint32_t i=0; i<t->num_attrs; i++ ) {
+            if(i)
+                aml_buffer_appendc(bh, ',');
+            canonical_append(bh, t->attrs[i], flags);
+        }
+        aml_buffer_appendc(bh, ']');
+    }
+    if(t->attr) {
+        aml_buffer_t *attrs = aml_buffer_pool_init(pool, 4 * sizeof(char *));
+        canonical_collect(pool, attrs, t->attr, ATL_TOKEN_NULL, flags);
+        aml_buffer_appendc(bh, '{');
+        canonical_list(bh, (char **)aml_buffer_data(attrs), aml_buffer_length(attrs) / sizeof(char *));
+        aml_buffer_appendc(bh, '}');
+    }
+    if(t->child) {
+        canonical_list(bh, (char **)aml_buffer_data(subs), num_subs);
+        aml_buffer_appendc(bh, ')');
+    }
+    return aml_pool_strndup(pool, aml_buffer_data(bh), aml_buffer_length(bh));
+}
+
+char *atl_token_canonical_ex(aml_pool_t *pool, atl_token_t *t, uint32_t flags) {
+    if(!t)
+        return aml_pool_strdup(pool, "");
+    return token_canonical(pool, t, flags);
+}
+
+char *atl_token_canonical(aml_pool_t *pool, atl_token_t *t) {
+    return atl_token_canonical_ex(pool, t, 0);
+}
+
+/* the number in [s, s+len), which must be all of it */
+static
+bool range_bound(const char *s, size_t len, double *v) {
+    char buf[64];
+    if(!len || len >= sizeof(buf))
+        return false;
+    memcpy(buf, s, len);
+    buf[len] = 0;
+    char *ep = NULL;
+    *v = strtod(buf, &ep);
+    return ep == buf + len;
+}
+
+bool atl_token_range(atl_token_t *t, atl_token_range_t *r) {
+    if(t->num_attrs != 1)
+        return false;
+    r->field.text = t->token;
+    r->field.len = strlen(t->token);
+    if(r->field.len && t->token[r->field.len-1] == ':')
+        r->field.len--;
+    r->min = -INFINITY;
+    r->max = INFINITY;
+
+    const char *a = t->attrs[0];
+    size_t len = strlen(a);
+    const char *dots = strstr(a, "..");
+    if(dots) {
+        size_t lo = dots - a, hi = len - lo - 2;
+        if(!lo && !hi)
+            return false;
+        return (!lo || range_bound(a, lo, &r->min)) && (!hi || range_bound(dots+2, hi, &r->max));
+    }
+    if(a[0] == '>' || a[0] == '<') {
+        bool inclusive = a[1] == '=';
+        size_t skip = inclusive ? 2 : 1;
+        double v;
+        if(!range_bound(a+skip, len-skip, &v))
+            return false;
+        if(a[0] == '>')
+            r->min = inclusive ? v : nextafter(v, INFINITY);
+        else
+            r->max = inclusive ? v : nextafter(v, -INFINITY);
+        return true;
+    }
+    if(!range_bound(a, len, &r->min))
+        return false;
+    r->max = r->min;
+    return true;
+}
+
+
+/* the name follows the node */
 struct atl_token_node_s {
-    macro_map_t node;
     atl_token_t *token;
+    uint64_t hash;
+    uint32_t len;
 };
 
 typedef struct atl_token_node_s atl_token_node_t;
 
+struct atl_token_dict_s {
+    aml_pool_t *pool;
+
+    /* open addressing (linear probing) index of the nodes, num_slots is a power of 2 */
+    atl_token_node_t **slots;
+    uint32_t num_slots;
+    uint32_t num_nodes;
+
+    /* minimal perfect hash built by atl_token_dict_freeze, perfect has num_nodes entries and
+       the seed of a key's bucket picks its entry */
+    atl_token_node_t **perfect;
+    uint32_t *seeds;
+    uint32_t num_buckets;
+
+    /* set when the dictionary is mapped from an image written by atl_token_dict_save */
+    void *image;
+    size_t image_size;
+};
+
 static inline
-int compare_token_node_for_find(const char *key, const atl_token_node_t *node) {
-    return strcmp(key, (const char *)(node+1));
+uint64_t token_key_mix(uint64_t h) {
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return h;
 }
 
 static inline
-int compare_token_node_for_insert(const atl_token_node_t *a, const atl_token_node_t *b) {
-    return strcmp((const char *)(a+1), (const char *)(b+1));
+uint64_t token_key_hash(const char *key, size_t len) {
+    uint64_t h = 14695981039346656037ULL;
+    for( size_t i=0; i<len; i++ )
+        h = (h ^ (unsigned char)key[i]) * 1099511628211ULL;
+    return token_key_mix(h);
 }
 
-static macro_map_find_kv(_token_node_find, char, atl_token_node_t, compare_token_node_for_find);
-static macro_map_insert(_token_node_insert, atl_token_node_t, compare_token_node_for_insert);
+static inline
+uint32_t token_perfect_slot(uint64_t hash, uint32_t seed, uint32_t num_nodes) {
+    return (uint32_t)(token_key_mix(hash + seed * 0x9E3779B97F4A7C15ULL) % num_nodes);
+}
 
+static inline
+uint32_t token_perfect_bucket(uint64_t hash, uint32_t num_buckets) {
+    return (uint32_t)((hash >> 32) % num_buckets);
+}
+
+static inline
+bool token_node_equal(atl_token_node_t *n, uint64_t hash, const char *key, size_t len) {
+    return n->hash == hash && n->len == len && !memcmp(n+1, key, len);
+}
+
+static
+atl_token_node_t *token_node_find(atl_token_dict_t *h, const char *key, size_t len) {
+    uint64_t hash = token_key_hash(key, len);
+    if(h->perfect) {
+        uint32_t b = token_perfect_bucket(hash, h->num_buckets);
+        atl_token_node_t *n = h->perfect[token_perfect_slot(hash, h->seeds[b], h->num_nodes)];
+        return token_node_equal(n, hash, key, len) ? n : NULL;
+    }
+    if(!h->slots)
+        return NULL;
+    uint32_t mask = h->num_slots-1;
+    uint32_t i = (uint32_t)hash & mask;
+    atl_token_node_t *n;
+    while((n = h->slots[i]) != NULL) {
+        if(token_node_equal(n, hash, key, len))
+            return n;
+        i = (i+1) & mask;
+    }
+    return NULL;
+}
+
+static
+void token_node_grow(atl_token_dict_t *h) {
+    uint32_t num_slots = h->num_slots ? h->num_slots << 1 : 64;
+    atl_token_node_t **slots = (atl_token_node_t **)aml_malloc(sizeof(atl_token_node_t *) * num_slots);
+    memset(slots, 0, sizeof(atl_token_node_t *) * num_slots);
+    uint32_t mask = num_slots-1;
+    for( uint32_t i=0; i<h->num_slots; i++ ) {
+        atl_token_node_t *n = h->slots[i];
+        if(!n)
+            continue;
+        uint32_t j = (uint32_t)n->hash & mask;
+        while(slots[j])
+            j = (j+1) & mask;
+        slots[j] = n;
+    }
+    if(h->slots)
+        aml_free(h->slots);
+    h->slots = slots;
+    h->num_slots = num_slots;
+}
+
+static
+void token_node_insert(atl_token_dict_t *h, atl_token_node_t *n) {
+    if((h->num_nodes+1) * 2 > h->num_slots)
+        token_node_grow(h);
+    uint32_t mask = h->num_slots-1;
+    uint32_t i = (uint32_t)n->hash & mask;
+    while(h->slots[i])
+        i = (i+1) & mask;
+    h->slots[i] = n;
+    h->num_nodes++;
+}
+
+typedef struct {
+    uint32_t bucket;
+    uint32_t size;
+    uint32_t start;
+} token_bucket_t;
+
+static
+int compare_token_buckets(const void *a, const void *b) {
+    const token_bucket_t *ba = (const token_bucket_t *)a;
+    const token_bucket_t *bb = (const token_bucket_t *)b;
+    if(ba->size != bb->size)
+        return ba->size > bb->size ? -1 : 1;
+    return ba->bucket < bb->bucket ? -1 : ba->bucket > bb->bucket;
+}
+
+/* hash and displace: the largest buckets are placed first, each searching for a seed which
+   sends all of its keys to free entries */
+bool atl_token_dict_freeze(atl_token_dict_t *h) {
+    if(h->perfect)
+        return true;
+    uint32_t num_nodes = h->num_nodes;
+    if(!num_nodes)
+        return false;
+    uint32_t num_buckets = (num_nodes + 3) / 4;
+
+    token_bucket_t *buckets = (token_bucket_t *)aml_malloc(sizeof(token_bucket_t) * num_buckets);
+    atl_token_node_t **members = (atl_token_node_t **)aml_malloc(sizeof(atl_token_node_t *) * num_nodes);
+    atl_token_node_t **perfect = (atl_token_node_t **)aml_pool_zalloc(h->pool, sizeof(atl_token_node_t *) * num_nodes);
+    uint32_t *seeds = (uint32_t *)aml_pool_zalloc(h->pool, sizeof(uint32_t) * num_buckets);
+    uint32_t *slots = (uint32_t *)aml_malloc(sizeof(uint32_t) * num_nodes);
+
+    for( uint32_t b=0; b<num_buckets; b++ ) {
+        buckets[b].bucket = b;
+        buckets[b].size = 0;
+    }
+    for( uint32_t i=0; i<h->num_slots; i++ )
+        if(h->slots[i])
+            buckets[token_perfect_bucket(h->slots[i]->hash, num_buckets)].size++;
+    uint32_t start = 0;
+    for( uint32_t b=0; b<num_buckets; b++ ) {
+        buckets[b].start = start;
+        start += buckets[b].size;
+        buckets[b].size = 0;
+    }
+    for( uint32_t i=0; i<h->num_slots; i++ ) {
+        atl_token_node_t *n = h->slots[i];
+        if(!n)
+            continue;
+        token_bucket_t *bp = buckets + token_perfect_bucket(n->hash, num_buckets);
+        members[bp->start + bp->size] = n;
+        bp->size++;
+    }
+    qsort(buckets, num_buckets, sizeof(token_bucket_t), compare_token_buckets);
+
+    bool ok = true;
+    for( uint32_t b=0; b<num_buckets && ok && buckets[b].size; b++ ) {
+        token_bucket_t *bp = buckets + b;
+        atl_token_node_t **m = members + bp->start;
+        uint32_t seed = 0;
+        while(true) {
+            uint32_t i=0;
+            for( ; i<bp->size; i++ ) {
+                uint32_t slot = token_perfect_slot(m[i]->hash, seed, num_nodes);
+                if(perfect[slot])
+                    break;
+                uint32_t j=0;
+                while(j < i && slots[j] != slot)
+                    j++;
+                if(j < i)
+                    break;
+                slots[i] = slot;
+            }
+            if(i == bp->size)
+                break;
+            seed++;
+            if(seed > (1U << 24)) {
+                ok = false;
+                break;
+            }
+        }
+        if(!ok)
+            break;
+        seeds[bp->bucket] = seed;
+        for( uint32_t i=0; i<bp->size; i++ )
+            perfect[slots[i]] = m[i];
+    }
+
+    aml_free(slots);
+    aml_free(members);
+    aml_free(buckets);
+    if(!ok)
+        return false;
+
+    h->perfect = perfect;
+    h->seeds = seeds;
+    h->num_buckets = num_buckets;
+    aml_free(h->slots);
+    h->slots = NULL;
+    h->num_slots = 0;
+    return true;
+}
+
+
+static
+void token_mark_read_only(atl_token_t *t) {
+    for( ; t; t=t->next ) {
+        t->read_only = true;
+        token_mark_read_only(t->attr);
+        token_mark_read_only(t->child);
+    }
+}
+
+/* The parser links the token returned from the dictionary into the expression, so only the
+   root is copied.  Its children (marked read_only when the entry was added) are shared. */
+static
+atl_token_t *token_share(aml_pool_t *pool, atl_token_t *t) {
+    size_t len = strlen(t->token);
+    atl_token_t *r = (atl_token_t *)aml_pool_alloc(pool, sizeof(*t) + len + 1);
+    *r = *t;
+    r->token = (char *)(r+1);
+    memcpy(r->token, t->token, len+1);
+    return r;
+}
 
 atl_token_cb_t atl_token_dict_cb(void *arg, atl_token_cb_data_t *d) {
     atl_token_dict_t *h = (atl_token_dict_t *)arg;
-    atl_token_node_t *n = _token_node_find(h->root, d->param);
+    if(!d->text) {
+        d->text = d->param;
+        d->len = strlen(d->param);
+    }
+    atl_token_node_t *n = token_node_find(h, d->text, d->len);
     if(!n) {
-        if(d->param[0] == '@')
+        if(d->len && d->text[0] == '@')
             return NUMBER;
         d->no_params = true;
-        if(d->param[strlen(d->param)-1] == ':')
-            d->param[strlen(d->param)-1] = 0;
+        if(d->len && d->text[d->len-1] == ':') {
+            if(d->param)
+                d->param[d->len-1] = 0;
+            d->len--;
+        }
         return NORMAL;
     }
     if(n->token->no_params)
         d->no_params = true;
-    d->alt_token = atl_token_clone(d->pool, n->token);
-    /*    if(d->alt_token) {
-        atl_token_dump(d->alt_token);
-    }*/
+    d->alt_token = token_share(d->pool, n->token);
     return n->token->attr_type;
 }
 
-/*
-atl_token_cb_t _atl_token_dict_cb(void *arg, atl_token_cb_data_t *d) {
-    atl_token_dict_t *h = (atl_token_dict_t *)arg;
-    atl_token_node_t *n = _token_node_find(d->param, h->root);
-    if(!n) {
-        return d->param[0] == '@' ? NUMBER : NORMAL;
-    }
-    if(n->token->no_params)
-        d->no_params = true;
-    d->alt_token = atl_token_clone(d->pool, n->token);
-    return NORMAL;
-}
-*/
-
 atl_token_dict_t *atl_token_dict_init() {
     aml_pool_t *pool = aml_pool_init(16384);
     atl_token_dict_t *h = (atl_token_dict_t *)aml_pool_zalloc(pool, sizeof(*h));
@@ -1234,13 +1894,23 @@ atl_token_dict_t *atl_token_dict_load(const char *filename) {
     return dict;
 }
 
+uint32_t atl_token_dict_size(atl_token_dict_t *h) {
+    return h->num_nodes;
+}
+
 void atl_token_dict_destroy(atl_token_dict_t *h) {
+    if(h->slots)
+        aml_free(h->slots);
+    if(h->image)
+        munmap(h->image, h->image_size);
     aml_pool_t *pool = h->pool;
     aml_pool_destroy(pool);
 }
 
 /* name: global|next|skip|normal|number[,no_params] string */
 bool atl_token_dict_add(atl_token_dict_t *h, const char *config_line) {
+    if(h->perfect || h->image)
+        return false;
     char *line = aml_pool_strdup(h->pool, config_line);
     char *p = line;
     while(*p && *p <= ' ')
@@ -1290,18 +1960,23 @@ bool atl_token_dict_add(atl_token_dict_t *h, const char *config_line) {
     else
         return false;
     
-    atl_token_t *t = atl_token_parse_expression(h->pool, p, NULL, NULL); //_atl_token_dict_cb, h);
+    atl_token_t *t = atl_token_parse_expression(h->pool, p, NULL, NULL);
     if(!t)
         return false;
     
     t->attr_type = cb_type;
     t->no_params = no_params;
+    token_mark_read_only(t->attr);
+    token_mark_read_only(t->child);
 
-    atl_token_node_t *n = _token_node_find(h->root, name);
+    size_t name_len = strlen(name);
+    atl_token_node_t *n = token_node_find(h, name, name_len);
     if(!n) {
-        n = (atl_token_node_t *)aml_pool_zalloc(h->pool, sizeof(*n) + strlen(name) + 1);
+        n = (atl_token_node_t *)aml_pool_zalloc(h->pool, sizeof(*n) + name_len + 1);
         strcpy((char *)(n+1), name);
-        _token_node_insert(&h->root, n);
+        n->hash = token_key_hash(name, name_len);
+        n->len = name_len;
+        token_node_insert(h, n);
         // printf( "inserting %s (%s) %s\n", name, type, p );
     }
     n->token = t;
@@ -1311,7 +1986,7 @@ bool atl_token_dict_add(atl_token_dict_t *h, const char *config_line) {
 
 char **atl_token_dict_values(atl_token_dict_t *h, uint32_t *num_values, const char *param) {
     *num_values = 0;
-    atl_token_node_t *n = _token_node_find(h->root, param);
+    atl_token_node_t *n = token_node_find(h, param, strlen(param));
     if(!n) return NULL;
 
     if(n->token) {
@@ -1329,34 +2004,546 @@ const char *atl_token_dict_value(atl_token_dict_t *h, const char *param) {
     return NULL;
 }
 
-atl_token_t *_atl_token_clone(aml_pool_t *pool, atl_token_t *t, atl_token_t *parent) {
-    atl_token_t *clone = (atl_token_t *)aml_pool_dup(pool, t, sizeof(*t) + strlen(t->token)+1);
-    clone->token = (char *)(clone+1);
-    strcpy(clone->token, t->token);
-    clone->parent = parent;
-    clone->child = NULL;
-    clone->next = NULL;
-    clone->prev = NULL;
-    if(parent && t->parent && t->parent->child && t->parent->child == t)
-        parent->child = clone;
+/*
+    Dictionary image
+
+    header | data | strings | seeds | relocations
+
+    data holds the nodes, their token trees, attrs arrays and the perfect hash table laid out
+    exactly as they are in memory except that every pointer is stored as an offset from the
+    start of the image.  Each such pointer is listed in relocations, so the loader only needs
+    to add the address of the mapping to them (which copies the pages of data for the
+    process).  Strings are interned and, along with the seeds and relocations, are never
+    written to once mapped so those pages stay shared between every process mapping the
+    image.  A relocation with the low bit set refers to strings, so the loader can check that
+    each pointer lands in the section it belongs to before walking the nodes and tokens.
+*/
+#define TOKEN_IMAGE_MAGIC "ATLDICT"
+#define TOKEN_IMAGE_VERSION 2
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t pointer_size;
+    uint32_t token_size;
+    uint32_t num_nodes;
+    uint32_t num_buckets;
+    uint32_t reserved;
+    uint64_t size;
+    uint64_t data;
+    uint64_t strings;
+    uint64_t perfect;
+    uint64_t seeds;
+    uint64_t relocs;
+    uint64_t num_relocs;
+} token_image_header_t;
+
+typedef struct {
+    uint64_t field;  /* offset in data */
+    uint64_t string; /* true if the pointer refers to strings rather than data */
+} token_image_reloc_t;
+
+typedef struct {
+    aml_pool_t *pool;
+    aml_buffer_t *data;
+    aml_buffer_t *strings;
+    aml_buffer_t *relocs;
 
-    strcpy(clone->token, t->token);
-    if(t->num_attrs) {
-        clone->attrs = (char **)aml_pool_zalloc(pool, sizeof(char *) * (t->num_attrs+1));
-        for( uint32_t i=0; i<t->num_attrs; i++ )
-            clone->attrs[i] = aml_pool_strdup(pool, t->attrs[i]);
-        clone->num_attrs = t->num_attrs;
+    /* interned strings (offset+1 in strings, 0 if empty) */
+    uint64_t *interned;
+    uint32_t interned_mask;
+    uint32_t num_interned;
+} token_image_t;
+
+static
+uint64_t image_alloc(token_image_t *img, size_t size) {
+    size_t len = aml_buffer_length(img->data);
+    size_t offs = (len + 7) & ~(size_t)7;
+    char *d = (char *)aml_buffer_resize(img->data, offs + size);
+    memset(d + len, 0, offs + size - len);
+    return offs;
+}
+
+static
+bool image_write(FILE *out, const void *d, size_t len) {
+    return !len || fwrite(d, len, 1, out) == 1;
+}
+
+static
+void image_pointer(token_image_t *img, uint64_t field, uint64_t value, bool string) {
+    uintptr_t v = (uintptr_t)value;
+    memcpy(aml_buffer_data(img->data) + field, &v, sizeof(v));
+    token_image_reloc_t r;
+    r.field = field;
+    r.string = string;
+    aml_buffer_append(img->relocs, &r, sizeof(r));
+}
+
+static
+uint64_t image_string(token_image_t *img, const char *s) {
+    size_t len = strlen(s);
+    if((img->num_interned+1) * 2 > img->interned_mask) {
+        uint32_t size = img->interned_mask ? (img->interned_mask+1) << 1 : 1024;
+        uint64_t *interned = (uint64_t *)aml_pool_zalloc(img->pool, sizeof(uint64_t) * size);
+        for( uint32_t i=0; img->interned_mask && i<=img->interned_mask; i++ ) {
+            uint64_t o = img->interned[i];
+            if(!o)
+                continue;
+            const char *p = aml_buffer_data(img->strings) + o - 1;
+            uint32_t j = (uint32_t)token_key_hash(p, strlen(p)) & (size-1);
+            while(interned[j])
+                j = (j+1) & (size-1);
+            interned[j] = o;
+        }
+        img->interned = interned;
+        img->interned_mask = size-1;
+    }
+    uint32_t i = (uint32_t)token_key_hash(s, len) & img->interned_mask;
+    while(img->interned[i]) {
+        uint64_t o = img->interned[i] - 1;
+        if(!strcmp(aml_buffer_data(img->strings) + o, s))
+            return o;
+        i = (i+1) & img->interned_mask;
     }
-    if(t->attr)
-        clone->attr = atl_token_clone(pool, t->attr);
+    uint64_t o = aml_buffer_length(img->strings);
+    aml_buffer_append(img->strings, s, len+1);
+    img->interned[i] = o+1;
+    img->num_interned++;
+    return o;
+}
 
-    if(t->next) {
-        clone->next = _atl_token_clone(pool, t->next, parent);
-        clone->next->prev = clone;        
-    }    
-    return clone;    
+/* writes the list starting at t and returns the offset of the first token */
+static
+uint64_t image_token(token_image_t *img, atl_token_t *t, uint64_t parent) {
+    uint64_t first = 0, prev = 0;
+    for( ; t; t=t->next ) {
+        uint64_t o = image_alloc(img, sizeof(atl_token_t));
+        atl_token_t *it = (atl_token_t *)(aml_buffer_data(img->data) + o);
+        it->type = t->type;
+        it->attr_type = t->attr_type;
+        it->no_params = t->no_params;
+        it->read_only = t->read_only;
+        it->num_attrs = t->num_attrs;
+        it->pos = t->pos;
+        it->len = t->len;
+        image_pointer(img, o + offsetof(atl_token_t, token), image_string(img, t->token), true);
+        if(t->num_attrs) {
+            uint64_t attrs = image_alloc(img, sizeof(char *) * (t->num_attrs+1));
+            for( uint32_t i=0; i<t->num_attrs; i++ )
+                image_pointer(img, attrs + sizeof(char *) * i, image_string(img, t->attrs[i]), true);
+            image_pointer(img, o + offsetof(atl_token_t, attrs), attrs, false);
+        }
+        if(t->attr)
+            image_pointer(img, o + offsetof(atl_token_t, attr), image_token(img, t->attr, 0), false);
+        if(t->child)
+            image_pointer(img, o + offsetof(atl_token_t, child), image_token(img, t->child, o), false);
+        if(parent)
+            image_pointer(img, o + offsetof(atl_token_t, parent), parent, false);
+        if(prev) {
+            image_pointer(img, o + offsetof(atl_token_t, prev), prev, false);
+            image_pointer(img, prev + offsetof(atl_token_t, next), o, false);
+        }
+        else
+            first = o;
+        prev = o;
+    }
+    return first;
+}
+
+bool atl_token_dict_save(atl_token_dict_t *h, const char *filename) {
+    if(!h->perfect && h->num_nodes && !atl_token_dict_freeze(h))
+        return false;
+
+    token_image_t img;
+    memset(&img, 0, sizeof(img));
+    img.pool = aml_pool_init(16384);
+    img.data = aml_buffer_pool_init(img.pool, 65536);
+    img.strings = aml_buffer_pool_init(img.pool, 65536);
+    img.relocs = aml_buffer_pool_init(img.pool, 65536);
+
+    uint64_t *nodes = (uint64_t *)aml_pool_alloc(img.pool, sizeof(uint64_t) * (h->num_nodes+1));
+    for( uint32_t i=0; i<h->num_nodes; i++ ) {
+        atl_token_node_t *n = h->perfect[i];
+        uint64_t o = image_alloc(&img, sizeof(*n) + n->len + 1);
+        atl_token_node_t *in = (atl_token_node_t *)(aml_buffer_data(img.data) + o);
+        in->hash = n->hash;
+        in->len = n->len;
+        memcpy(in+1, n+1, n->len+1);
+        if(n->token)
+            image_pointer(&img, o + offsetof(atl_token_node_t, token), image_token(&img, n->token, 0), false);
+        nodes[i] = o;
+    }
+    uint64_t perfect = 0;
+    if(h->num_nodes) {
+        perfect = image_alloc(&img, sizeof(atl_token_node_t *) * h->num_nodes);
+        for( uint32_t i=0; i<h->num_nodes; i++ )
+            image_pointer(&img, perfect + sizeof(atl_token_node_t *) * i, nodes[i], false);
+    }
+
+    token_image_header_t hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, TOKEN_IMAGE_MAGIC, sizeof(TOKEN_IMAGE_MAGIC));
+    hdr.version = TOKEN_IMAGE_VERSION;
+    hdr.pointer_size = sizeof(void *);
+    hdr.token_size = sizeof(atl_token_t);
+    hdr.num_nodes = h->num_nodes;
+    hdr.num_buckets = h->num_buckets;
+
+    uint64_t data_len = (aml_buffer_length(img.data) + 7) & ~(uint64_t)7;
+    uint64_t strings_len = (aml_buffer_length(img.strings) + 7) & ~(uint64_t)7;
+    uint64_t seeds_len = ((sizeof(uint32_t) * h->num_buckets) + 7) & ~(uint64_t)7;
+    uint64_t num_relocs = aml_buffer_length(img.relocs) / sizeof(token_image_reloc_t);
+    hdr.data = (sizeof(hdr) + 63) & ~(uint64_t)63;
+    hdr.strings = hdr.data + data_len;
+    hdr.seeds = hdr.strings + strings_len;
+    hdr.relocs = hdr.seeds + seeds_len;
+    hdr.num_relocs = num_relocs;
+    hdr.size = hdr.relocs + sizeof(uint64_t) * num_relocs;
+    hdr.perfect = perfect ? hdr.data + perfect : 0;
+
+    /* pointers become offsets from the start of the image */
+    aml_buffer_resize(img.data, data_len);
+    char *data = aml_buffer_data(img.data);
+    token_image_reloc_t *relocs = (token_image_reloc_t *)aml_buffer_data(img.relocs);
+    uint64_t *fields = (uint64_t *)aml_pool_alloc(img.pool, sizeof(uint64_t) * (num_relocs+1));
+    for( uint64_t i=0; i<num_relocs; i++ ) {
+        uintptr_t v;
+        memcpy(&v, data + relocs[i].field, sizeof(v));
+        v += relocs[i].string ? hdr.strings : hdr.data;
+        memcpy(data + relocs[i].field, &v, sizeof(v));
+        fields[i] = (hdr.data + relocs[i].field) | (relocs[i].string ? 1 : 0);
+    }
+
+    static const char zeros[64] = {0};
+    FILE *out = fopen(filename, "wb");
+    bool ok = out != NULL;
+    if(ok) {
+        ok = image_write(out, &hdr, sizeof(hdr)) &&
+             image_write(out, zeros, hdr.data - sizeof(hdr)) &&
+             image_write(out, data, data_len) &&
+             image_write(out, aml_buffer_data(img.strings), aml_buffer_length(img.strings)) &&
+             image_write(out, zeros, strings_len - aml_buffer_length(img.strings)) &&
+             image_write(out, h->seeds, sizeof(uint32_t) * h->num_buckets) &&
+             image_write(out, zeros, seeds_len - sizeof(uint32_t) * h->num_buckets) &&
+             image_write(out, fields, sizeof(uint64_t) * num_relocs);
+        if(fclose(out))
+            ok = false;
+    }
+    aml_pool_destroy(img.pool);
+    return ok;
+}
+
+bool atl_token_dict_is_image(const char *filename) {
+    char magic[sizeof(TOKEN_IMAGE_MAGIC)];
+    int fd = open(filename, O_RDONLY);
+    if(fd < 0)
+        return false;
+    bool r = read(fd, magic, sizeof(magic)) == sizeof(magic) &&
+             !memcmp(magic, TOKEN_IMAGE_MAGIC, sizeof(magic));
+    close(fd);
+    return r;
+}
+
+/* what each word of data holds once the relocations have been applied */
+#define IMAGE_WORD_DATA 1    /* a pointer into data */
+#define IMAGE_WORD_STRING 2  /* a pointer into strings */
+#define IMAGE_WORD_SEEN 4    /* the start of a node or token which has been checked */
+
+typedef struct {
+    char *image;
+    token_image_header_t *hdr;
+    uint8_t *words;
+} image_check_t;
+
+/* sets *offs to the offset the pointer at field refers to, which must be 0 or a relocated
+   pointer of the given kind */
+static
+bool image_check_pointer(image_check_t *c, const void *field, uint8_t kind, uint64_t *offs) {
+    uintptr_t v;
+    memcpy(&v, field, sizeof(v));
+    uint8_t w = c->words[((const char *)field - c->image - c->hdr->data) >> 3];
+    w &= IMAGE_WORD_DATA | IMAGE_WORD_STRING;
+    *offs = w ? v - (uintptr_t)c->image : 0;
+    return w ? w == kind : v == 0;
+}
+
+/* an object of size bytes at offs must lie within data and may only be checked once */
+static
+bool image_check_object(image_check_t *c, uint64_t offs, uint64_t size) {
+    if(offs < c->hdr->data || (offs & 7) || size > c->hdr->strings - offs)
+        return false;
+    uint8_t *w = c->words + ((offs - c->hdr->data) >> 3);
+    if(*w & IMAGE_WORD_SEEN)
+        return false;
+    *w |= IMAGE_WORD_SEEN;
+    return true;
+}
+
+static
+bool image_check_attrs(image_check_t *c, atl_token_t *t) {
+    uint64_t attrs;
+    if(!image_check_pointer(c, &t->attrs, IMAGE_WORD_DATA, &attrs) || !attrs != !t->num_attrs)
+        return false;
+    if(!attrs)
+        return true;
+    /* num_attrs strings followed by NULL */
+    if(!image_check_object(c, attrs, sizeof(char *) * ((uint64_t)t->num_attrs + 1)))
+        return false;
+    for( uint32_t i=0; i<=t->num_attrs; i++ ) {
+        uint64_t s;
+        if(!image_check_pointer(c, t->attrs + i, IMAGE_WORD_STRING, &s) ||
+           !s != (i == t->num_attrs))
+            return false;
+    }
+    return true;
+}
+
+/* the flags are read as bool, so their bytes must be 0 or 1 */
+static
+bool image_check_flags(atl_token_t *t) {
+    const size_t flags[] = {
+        offsetof(atl_token_t, no_params), offsetof(atl_token_t, read_only),
+        offsetof(atl_token_t, is_double)
+    };
+    for( size_t i=0; i<sizeof(flags) / sizeof(flags[0]); i++ )
+        if(((const uint8_t *)t)[flags[i]] > 1)
+            return false;
+    return true;
+}
+
+/* Walks the token lists below a node without recursing.  Every list must be linked exactly as
+   atl_token_dict_save writes it (prev and parent included) and every token may only be reached
+   once, so cycles are rejected.  pos and len are offsets into the config line and are never
+   dereferenced, so they aren't checked. */
+static
+bool image_check_tokens(image_check_t *c, aml_buffer_t *stack, uint64_t first) {
+    uint64_t list[2] = { first, 0 };  /* first token and its parent */
+    aml_buffer_clear(stack);
+    aml_buffer_append(stack, list, sizeof(list));
+    while(aml_buffer_length(stack)) {
+        size_t len = aml_buffer_length(stack) - sizeof(list);
+        memcpy(list, aml_buffer_data(stack) + len, sizeof(list));
+        aml_buffer_resize(stack, len);
+        uint64_t prev = 0;
+        for( uint64_t o=list[0]; o; ) {
+            if(!image_check_object(c, o, sizeof(atl_token_t)))
+                return false;
+            atl_token_t *t = (atl_token_t *)(c->image + o);
+            uint64_t token, attr, child, next, p, parent;
+            if(!image_check_flags(t) ||
+               !image_check_pointer(c, &t->token, IMAGE_WORD_STRING, &token) || !token ||
+               !image_check_attrs(c, t) ||
+               !image_check_pointer(c, &t->attr, IMAGE_WORD_DATA, &attr) ||
+               !image_check_pointer(c, &t->child, IMAGE_WORD_DATA, &child) ||
+               !image_check_pointer(c, &t->next, IMAGE_WORD_DATA, &next) ||
+               !image_check_pointer(c, &t->prev, IMAGE_WORD_DATA, &p) || p != prev ||
+               !image_check_pointer(c, &t->parent, IMAGE_WORD_DATA, &parent) || parent != list[1])
+                return false;
+            uint64_t lists[4] = { attr, 0, child, o };
+            if(attr)
+                aml_buffer_append(stack, lists, sizeof(uint64_t) * 2);
+            if(child)
+                aml_buffer_append(stack, lists + 2, sizeof(uint64_t) * 2);
+            prev = o;
+            o = next;
+        }
+    }
+    return true;
+}
+
+/* every entry of the perfect hash table must be a node whose key lies within data, followed
+   by its token tree */
+static
+bool image_check_nodes(image_check_t *c, aml_buffer_t *stack) {
+    atl_token_node_t **perfect = (atl_token_node_t **)(c->image + c->hdr->perfect);
+    for( uint32_t i=0; i<c->hdr->num_nodes; i++ ) {
+        uint64_t o, token;
+        if(!image_check_pointer(c, perfect + i, IMAGE_WORD_DATA, &o) || !o ||
+           !image_check_object(c, o, sizeof(atl_token_node_t)))
+            return false;
+        atl_token_node_t *n = (atl_token_node_t *)(c->image + o);
+        if(n->len >= c->hdr->strings - o - sizeof(*n) || ((char *)(n+1))[n->len] ||
+           !image_check_pointer(c, &n->token, IMAGE_WORD_DATA, &token) ||
+           (token && !image_check_tokens(c, stack, token)))
+            return false;
+    }
+    return true;
+}
+
+atl_token_dict_t *atl_token_dict_map(const char *filename) {
+    int fd = open(filename, O_RDONLY);
+    if(fd < 0)
+        return NULL;
+    struct stat st;
+    if(fstat(fd, &st) || (size_t)st.st_size < sizeof(token_image_header_t)) {
+        close(fd);
+        return NULL;
+    }
+    size_t size = st.st_size;
+    char *image = (char *)mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(image == MAP_FAILED)
+        return NULL;
+
+    token_image_header_t *hdr = (token_image_header_t *)image;
+    if(memcmp(hdr->magic, TOKEN_IMAGE_MAGIC, sizeof(TOKEN_IMAGE_MAGIC)) ||
+       hdr->version != TOKEN_IMAGE_VERSION || hdr->pointer_size != sizeof(void *) ||
+       hdr->token_size != sizeof(atl_token_t) || hdr->size != size ||
+       hdr->data < sizeof(*hdr) || (hdr->data & 7) || (hdr->strings & 7) ||
+       hdr->data > hdr->strings || hdr->strings > hdr->seeds || hdr->seeds > hdr->relocs ||
+       hdr->relocs > size || hdr->num_relocs > (size - hdr->relocs) / sizeof(uint64_t) ||
+       hdr->num_buckets > (hdr->relocs - hdr->seeds) / sizeof(uint32_t) ||
+       /* every string must end before the seeds */
+       (hdr->strings < hdr->seeds && image[hdr->seeds-1]) ||
+       (hdr->num_nodes && (!hdr->num_buckets || hdr->perfect < hdr->data ||
+                           hdr->perfect > hdr->strings || (hdr->perfect & 7) ||
+                           hdr->num_nodes > (hdr->strings - hdr->perfect) / sizeof(void *)))) {
+        munmap(image, size);
+        return NULL;
+    }
+
+    /* each pointer must be an aligned field of data, relocated once and point into data or
+       strings */
+    aml_pool_t *pool = aml_pool_init(16384);
+    image_check_t c;
+    c.image = image;
+    c.hdr = hdr;
+    c.words = (uint8_t *)aml_pool_zalloc(pool, ((hdr->strings - hdr->data) >> 3) + 1);
+    const uint64_t *fields = (const uint64_t *)(image + hdr->relocs);
+    bool ok = true;
+    for( uint64_t i=0; ok && i<hdr->num_relocs; i++ ) {
+        uintptr_t v;
+        uint64_t field = fields[i] & ~(uint64_t)1;
+        bool string = fields[i] & 1;
+        if(field < hdr->data || field >= hdr->strings || (field & 7) ||
+           c.words[(field - hdr->data) >> 3]) {
+            ok = false;
+            break;
+        }
+        memcpy(&v, image + field, sizeof(v));
+        if(string ? (v < hdr->strings || v >= hdr->seeds)
+                  : (v < hdr->data || v >= hdr->strings || (v & 7)))
+            ok = false;
+        c.words[(field - hdr->data) >> 3] = string ? IMAGE_WORD_STRING : IMAGE_WORD_DATA;
+        v += (uintptr_t)image;
+        memcpy(image + field, &v, sizeof(v));
+    }
+    /* the structure is checked after relocating so that no checked value changes afterwards */
+    ok = ok && image_check_nodes(&c, aml_buffer_pool_init(pool, 1024));
+    aml_pool_destroy(pool);
+    if(!ok) {
+        munmap(image, size);
+        return NULL;
+    }
+
+    atl_token_dict_t *h = atl_token_dict_init();
+    h->image = image;
+    h->image_size = size;
+    h->num_nodes = hdr->num_nodes;
+    h->num_buckets = hdr->num_buckets;
+    if(hdr->num_nodes) {
+        h->perfect = (atl_token_node_t **)(image + hdr->perfect);
+        h->seeds = (uint32_t *)(image + hdr->seeds);
+    }
+    return h;
+}
+
+/*
+    A clone is sized by a first pass so that its tokens, attrs arrays and strings are copied
+    into one block by the second.  Both passes loop over sibling lists and keep the children
+    and attr chains still to be copied on a stack, so neither recurses.
+*/
+typedef struct {
+    atl_token_t *t;      /* first token of a list to copy */
+    atl_token_t *parent; /* parent of the copied list */
+    atl_token_t **head;  /* set to the first copied token */
+} token_clone_t;
+
+static inline
+void clone_push(aml_buffer_t *bh, atl_token_t *t, atl_token_t *parent, atl_token_t **head) {
+    token_clone_t c = { t, parent, head };
+    aml_buffer_append(bh, &c, sizeof(c));
+}
+
+static inline
+bool clone_pop(aml_buffer_t *bh, token_clone_t *c) {
+    size_t len = aml_buffer_length(bh);
+    if(!len)
+        return false;
+    len -= sizeof(*c);
+    memcpy(c, aml_buffer_data(bh) + len, sizeof(*c));
+    aml_buffer_resize(bh, len);
+    return true;
+}
+
+static inline
+char *clone_string(char **sp, const char *s) {
+    size_t len = strlen(s) + 1;
+    char *r = *sp;
+    memcpy(r, s, len);
+    *sp += len;
+    return r;
 }
 
 atl_token_t *atl_token_clone(aml_pool_t *pool, atl_token_t *t) {
-    return _atl_token_clone(pool, t, NULL);
-}
\ No newline at end of file
+    if(!t)
+        return NULL;
+    aml_buffer_t *bh = aml_buffer_pool_init(pool, 16 * sizeof(token_clone_t));
+    token_clone_t c;
+
+    size_t num_tokens = 0, num_attrs = 0, strings_len = 0;
+    clone_push(bh, t, NULL, NULL);
+    while(clone_pop(bh, &c)) {
+        for( atl_token_t *n=c.t; n; n=n->next ) {
+            num_tokens++;
+            strings_len += strlen(n->token) + 1;
+            if(n->num_attrs) {
+                num_attrs += n->num_attrs + 1;
+                for( uint32_t i=0; i<n->num_attrs; i++ )
+                    strings_len += strlen(n->attrs[i]) + 1;
+            }
+            if(n->attr)
+                clone_push(bh, n->attr, NULL, NULL);
+            if(n->child)
+                clone_push(bh, n->child, NULL, NULL);
+        }
+    }
+
+    atl_token_t *dest = (atl_token_t *)aml_pool_alloc(pool, sizeof(atl_token_t) * num_tokens +
+                                                       sizeof(char *) * num_attrs + strings_len);
+    char **attrs = (char **)(dest + num_tokens);
+    char *sp = (char *)(attrs + num_attrs);
+
+    atl_token_t *head = NULL;
+    clone_push(bh, t, NULL, &head);
+    while(clone_pop(bh, &c)) {
+        atl_token_t *prev = NULL;
+        for( atl_token_t *n=c.t; n; n=n->next ) {
+            atl_token_t *clone = dest++;
+            *clone = *n;
+            clone->token = clone_string(&sp, n->token);
+            clone->read_only = false;
+            clone->parent = c.parent;
+            clone->prev = prev;
+            clone->next = clone->child = clone->attr = NULL;
+            clone->attrs = NULL;
+            if(n->num_attrs) {
+                clone->attrs = attrs;
+                for( uint32_t i=0; i<n->num_attrs; i++ )
+                    attrs[i] = clone_string(&sp, n->attrs[i]);
+                attrs[n->num_attrs] = NULL;
+                attrs += n->num_attrs + 1;
+            }
+            if(prev)
+                prev->next = clone;
+            else
+                *c.head = clone;
+            if(n->attr)
+                clone_push(bh, n->attr, NULL, &clone->attr);
+            if(n->child)
+                clone_push(bh, n->child, clone, &clone->child);
+            prev = clone;
+        }
+    }
+    return head;
+}
@@ -0,0 +1,318 @@
+// SPDX-FileCopyrightText:  2023 Andy Curtis <contactandyc@gmail.com>
+// SPDX-License-Identifier: Apache-2.0
+#include "a-tokenizer-library/atl_token_ast.h"
+
+#include "a-memory-library/aml_alloc.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+
+typedef struct {
+    atl_token_ast_t *ast;
+    uint32_t num_nodes;
+    uint32_t num_attrs;
+    uint32_t strings_len;
+} ast_builder_t;
+
+static
+void ast_count(ast_builder_t *b, atl_token_t *t) {
+    for( ; t; t=t->next ) {
+        b->num_nodes++;
+        b->strings_len += strlen(t->token) + 1;
+        b->num_attrs += t->num_attrs;
+        for( uint32_t i=0; i<t->num_attrs; i++ )
+            b->strings_len += strlen(t->attrs[i]) + 1;
+        ast_count(b, t->attr);
+        ast_count(b, t->child);
+    }
+}
+
+static
+uint32_t ast_string(ast_builder_t *b, const char *s) {
+    size_t len = strlen(s) + 1;
+    uint32_t offs = b->strings_len;
+    memcpy(b->ast->strings + offs, s, len);
+    b->strings_len += len;
+    return offs;
+}
+
+/* returns the index of the first token in the list */
+static
+uint32_t ast_fill(ast_builder_t *b, atl_token_t *t) {
+    uint32_t first = 0, prev = 0;
+    for( ; t; t=t->next ) {
+        uint32_t idx = b->num_nodes++;
+        atl_token_ast_node_t *n = b->ast->nodes + idx;
+        memset(n, 0, sizeof(*n));
+        n->token = ast_string(b, t->token);
+        n->type = t->type;
+        n->attr_type = t->attr_type;
+        n->no_params = t->no_params;
+        n->is_double = t->is_double;
+        memcpy(&n->value, &t->value, sizeof(n->value));
+        n->pos = (uint32_t)t->pos;
+        n->len = (uint32_t)t->len;
+        n->attrs = b->num_attrs;
+        n->num_attrs = t->num_attrs;
+        for( uint32_t i=0; i<t->num_attrs; i++ )
+            b->ast->attrs[b->num_attrs++] = ast_string(b, t->attrs[i]);
+        n->attr = ast_fill(b, t->attr);
+        n->child = ast_fill(b, t->child);
+        if(prev)
+            b->ast->nodes[prev].next = idx;
+        else
+            first = idx;
+        prev = idx;
+    }
+    return first;
+}
+
+atl_token_ast_t *atl_token_ast_init(aml_pool_t *pool, atl_token_t *t) {
+    if(!t)
+        return NULL;
+    ast_builder_t b;
+    memset(&b, 0, sizeof(b));
+    ast_count(&b, t);
+
+    atl_token_ast_t *ast = (atl_token_ast_t *)aml_pool_alloc(pool, sizeof(*ast));
+    ast->num_nodes = b.num_nodes;
+    ast->num_attrs = b.num_attrs;
+    ast->strings_len = b.strings_len;
+    ast->nodes = (atl_token_ast_node_t *)aml_pool_alloc(pool, sizeof(atl_token_ast_node_t) * b.num_nodes);
+    ast->attrs = (uint32_t *)aml_pool_alloc(pool, sizeof(uint32_t) * (b.num_attrs+1));
+    ast->strings = (char *)aml_pool_alloc(pool, b.strings_len);
+
+    b.ast = ast;
+    b.num_nodes = b.num_attrs = b.strings_len = 0;
+    ast_fill(&b, t);
+    return ast;
+}
+
+static
+void ast_token(atl_token_t *dest, const atl_token_ast_node_t *n, char *strings) {
+    memset(dest, 0, sizeof(*dest));
+    dest->type = (atl_token_type_t)n->type;
+    dest->attr_type = (atl_token_cb_t)n->attr_type;
+    dest->no_params = n->no_params;
+    dest->is_double = n->is_double;
+    memcpy(&dest->value, &n->value, sizeof(dest->value));
+    dest->token = strings + n->token;
+    dest->num_attrs = n->num_attrs;
+    dest->pos = n->pos;
+    dest->len = n->len;
+}
+
+/* links node idx (and its siblings, children and attr chains) within tokens */
+static
+void ast_link(const atl_token_ast_t *ast, atl_token_t *tokens, uint32_t idx, atl_token_t *parent) {
+    atl_token_t *prev = NULL;
+    while(idx) {
+        const atl_token_ast_node_t *n = ast->nodes + idx;
+        atl_token_t *t = tokens + idx;
+        t->parent = parent;
+        t->prev = prev;
+        if(prev)
+            prev->next = t;
+        if(n->attr) {
+            t->attr = tokens + n->attr;
+            ast_link(ast, tokens, n->attr, NULL);
+        }
+        if(n->child) {
+            t->child = tokens + n->child;
+            ast_link(ast, tokens, n->child, t);
+        }
+        prev = t;
+        idx = n->next;
+    }
+}
+
+atl_token_t *atl_token_ast_tree(aml_pool_t *pool, const atl_token_ast_t *ast) {
+    if(!ast || !ast->num_nodes)
+        return NULL;
+    /* each node's attrs are followed by NULL, so there is room for one more per node */
+    atl_token_t *tokens = (atl_token_t *)aml_pool_alloc(pool, sizeof(atl_token_t) * ast->num_nodes +
+                                                         sizeof(char *) * (ast->num_attrs +
+                                                                           ast->num_nodes) +
+                                                         ast->strings_len);
+    char **attrs = (char **)(tokens + ast->num_nodes);
+    char *strings = (char *)(attrs + ast->num_attrs + ast->num_nodes);
+    memcpy(strings, ast->strings, ast->strings_len);
+
+    for( uint32_t i=0; i<ast->num_nodes; i++ ) {
+        const atl_token_ast_node_t *n = ast->nodes + i;
+        ast_token(tokens + i, n, strings);
+        if(n->num_attrs) {
+            tokens[i].attrs = attrs;
+            for( uint32_t j=0; j<n->num_attrs; j++ )
+                *attrs++ = strings + ast->attrs[n->attrs + j];
+            *attrs++ = NULL;
+        }
+    }
+
+    /* the root isn't reachable as a child or sibling (index 0 means none) */
+    const atl_token_ast_node_t *root = ast->nodes;
+    if(root->attr) {
+        tokens->attr = tokens + root->attr;
+        ast_link(ast, tokens, root->attr, NULL);
+    }
+    if(root->child) {
+        tokens->child = tokens + root->child;
+        ast_link(ast, tokens, root->child, tokens);
+    }
+    if(root->next) {
+        tokens->next = tokens + root->next;
+        ast_link(ast, tokens, root->next, NULL);
+        tokens->next->prev = tokens;
+    }
+    return tokens;
+}
+
+/* standalone tokens for the list starting at idx (with their children) */
+static
+atl_token_t *ast_chain(aml_pool_t *pool, const atl_token_ast_t *ast, uint32_t idx) {
+    atl_token_t *head = NULL, *prev = NULL;
+    for( ; idx; idx=ast->nodes[idx].next ) {
+        atl_token_t *t = atl_token_ast_token(pool, ast, idx);
+        t->child = ast_chain(pool, ast, ast->nodes[idx].child);
+        for( atl_token_t *c=t->child; c; c=c->next )
+            c->parent = t;
+        t->prev = prev;
+        if(prev)
+            prev->next = t;
+        else
+            head = t;
+        prev = t;
+    }
+    return head;
+}
+
+atl_token_t *atl_token_ast_token(aml_pool_t *pool, const atl_token_ast_t *ast, uint32_t node) {
+    const atl_token_ast_node_t *n = ast->nodes + node;
+    atl_token_t *t = (atl_token_t *)aml_pool_alloc(pool, sizeof(atl_token_t) +
+                                                   sizeof(char *) * (n->num_attrs+1));
+    ast_token(t, n, ast->strings);
+    if(n->num_attrs) {
+        t->attrs = (char **)(t+1);
+        for( uint32_t i=0; i<n->num_attrs; i++ )
+            t->attrs[i] = ast->strings + ast->attrs[n->attrs + i];
+        t->attrs[n->num_attrs] = NULL;
+    }
+    if(n->attr)
+        t->attr = ast_chain(pool, ast, n->attr);
+    return t;
+}
+
+#define AST_ENCODING_MAGIC "ATLQ"
+#define AST_ENCODING_VERSION 2
+#define AST_ENCODING_BYTE_ORDER 0x01020304
+
+typedef struct {
+    char magic[4];
+    uint32_t version;
+    uint32_t byte_order;
+    uint32_t node_size;
+    uint32_t num_nodes;
+    uint32_t num_attrs;
+    uint32_t strings_len;
+    uint32_t reserved;
+} ast_encoding_header_t;
+
+size_t atl_token_ast_encoded_size(const atl_token_ast_t *ast) {
+    return sizeof(ast_encoding_header_t) + sizeof(atl_token_ast_node_t) * ast->num_nodes +
+           sizeof(uint32_t) * ast->num_attrs + ast->strings_len;
+}
+
+size_t atl_token_ast_encode(void *buf, const atl_token_ast_t *ast) {
+    ast_encoding_header_t hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, AST_ENCODING_MAGIC, sizeof(hdr.magic));
+    hdr.version = AST_ENCODING_VERSION;
+    hdr.byte_order = AST_ENCODING_BYTE_ORDER;
+    hdr.node_size = sizeof(atl_token_ast_node_t);
+    hdr.num_nodes = ast->num_nodes;
+    hdr.num_attrs = ast->num_attrs;
+    hdr.strings_len = ast->strings_len;
+
+    char *p = (char *)buf;
+    memcpy(p, &hdr, sizeof(hdr));
+    p += sizeof(hdr);
+    memcpy(p, ast->nodes, sizeof(atl_token_ast_node_t) * ast->num_nodes);
+    p += sizeof(atl_token_ast_node_t) * ast->num_nodes;
+    memcpy(p, ast->attrs, sizeof(uint32_t) * ast->num_attrs);
+    p += sizeof(uint32_t) * ast->num_attrs;
+    memcpy(p, ast->strings, ast->strings_len);
+    p += ast->strings_len;
+    return p - (char *)buf;
+}
+
+/* a link must be 0 or refer to a later node which nothing else refers to */
+static inline
+bool ast_valid_link(uint8_t *seen, uint32_t num_nodes, uint32_t idx, uint32_t link) {
+    if(!link)
+        return true;
+    if(link <= idx || link >= num_nodes || (seen[link >> 3] & (1 << (link & 7))))
+        return false;
+    seen[link >> 3] |= (1 << (link & 7));
+    return true;
+}
+
+static
+bool ast_valid(const atl_token_ast_t *ast, uint8_t *seen) {
+    uint32_t links = 0;
+    for( uint32_t i=0; i<ast->num_nodes; i++ ) {
+        const atl_token_ast_node_t *n = ast->nodes + i;
+        if(n->token >= ast->strings_len ||
+           n->attrs > ast->num_attrs || n->num_attrs > ast->num_attrs - n->attrs)
+            return false;
+        if(!ast_valid_link(seen, ast->num_nodes, i, n->child) ||
+           !ast_valid_link(seen, ast->num_nodes, i, n->next) ||
+           !ast_valid_link(seen, ast->num_nodes, i, n->attr))
+            return false;
+        links += (n->child != 0) + (n->next != 0) + (n->attr != 0);
+    }
+    /* with every link unique and pointing forward, n-1 links reach every node but the root */
+    if(links != ast->num_nodes - 1)
+        return false;
+    for( uint32_t i=0; i<ast->num_attrs; i++ )
+        if(ast->attrs[i] >= ast->strings_len)
+            return false;
+    return true;
+}
+
+bool atl_token_ast_decode(atl_token_ast_t *ast, const void *buf, size_t len) {
+    ast_encoding_header_t hdr;
+    if(((uintptr_t)buf & 7) || len < sizeof(hdr))
+        return false;
+    memcpy(&hdr, buf, sizeof(hdr));
+    if(memcmp(hdr.magic, AST_ENCODING_MAGIC, sizeof(hdr.magic)) ||
+       hdr.version != AST_ENCODING_VERSION || hdr.byte_order != AST_ENCODING_BYTE_ORDER ||
+       hdr.node_size != sizeof(atl_token_ast_node_t) || !hdr.num_nodes || !hdr.strings_len)
+        return false;
+    uint64_t size = sizeof(hdr) + (uint64_t)sizeof(atl_token_ast_node_t) * hdr.num_nodes +
+                    (uint64_t)sizeof(uint32_t) * hdr.num_attrs + hdr.strings_len;
+    if(size != len)
+        return false;
+
+    char *p = (char *)buf + sizeof(hdr);
+    ast->nodes = (atl_token_ast_node_t *)p;
+    ast->num_nodes = hdr.num_nodes;
+    p += sizeof(atl_token_ast_node_t) * hdr.num_nodes;
+    ast->attrs = (uint32_t *)p;
+    ast->num_attrs = hdr.num_attrs;
+    p += sizeof(uint32_t) * hdr.num_attrs;
+    ast->strings = p;
+    ast->strings_len = hdr.strings_len;
+
+    /* a small query is checked without allocating */
+    uint8_t stack_seen[512];
+    size_t seen_len = (hdr.num_nodes + 7) >> 3;
+    uint8_t *seen = seen_len <= sizeof(stack_seen) ? stack_seen : (uint8_t *)aml_malloc(seen_len);
+    memset(seen, 0, seen_len);
+    bool ok = !ast->strings[ast->strings_len-1] && ast_valid(ast, seen);
+    if(seen != stack_seen)
+        aml_free(seen);
+    if(!ok)
+        memset(ast, 0, sizeof(*ast));
+    return ok;
+}
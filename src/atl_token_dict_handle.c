@@ -0,0 +1,172 @@
+// SPDX-FileCopyrightText:  2023 Andy Curtis <contactandyc@gmail.com>
+// SPDX-License-Identifier: Apache-2.0
+#include "a-tokenizer-library/atl_token_dict_handle.h"
+
+#include "a-memory-library/aml_alloc.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#include <unistd.h>
+
+/* readers count themselves in the slot picked by the parity of the epoch they saw */
+typedef struct {
+    _Atomic uint64_t count;
+    char pad[56];
+} dict_readers_t;
+
+struct atl_token_dict_handle_s {
+    dict_readers_t readers[2];
+    _Atomic uint64_t epoch;
+    char pad[56];
+
+    _Atomic(atl_token_dict_t *) dict;
+    _Atomic uint64_t version;
+
+    /* serializes publishers */
+    pthread_mutex_t mutex;
+
+    /* only touched by the thread calling reload, wait and destroy */
+    pthread_t thread;
+    bool reloading;
+    _Atomic bool reload_done;
+    bool reload_ok;
+    char *filename;
+};
+
+atl_token_dict_handle_t *atl_token_dict_handle_init(atl_token_dict_t *dict) {
+    atl_token_dict_handle_t *h = (atl_token_dict_handle_t *)aml_malloc(sizeof(*h));
+    memset(h, 0, sizeof(*h));
+    atomic_init(&h->readers[0].count, 0);
+    atomic_init(&h->readers[1].count, 0);
+    atomic_init(&h->epoch, 0);
+    atomic_init(&h->dict, dict);
+    atomic_init(&h->version, 0);
+    atomic_init(&h->reload_done, false);
+    pthread_mutex_init(&h->mutex, NULL);
+    h->reload_ok = true;
+    return h;
+}
+
+void atl_token_dict_handle_destroy(atl_token_dict_handle_t *h) {
+    atl_token_dict_handle_wait(h);
+    atl_token_dict_t *dict = atomic_load(&h->dict);
+    if(dict)
+        atl_token_dict_destroy(dict);
+    pthread_mutex_destroy(&h->mutex);
+    aml_free(h);
+}
+
+atl_token_dict_t *atl_token_dict_handle_pin(atl_token_dict_handle_t *h, uint32_t *pin) {
+    while(true) {
+        uint64_t epoch = atomic_load(&h->epoch);
+        uint32_t slot = epoch & 1;
+        atomic_fetch_add(&h->readers[slot].count, 1);
+        /* if the epoch moved, the publisher may have already checked this slot */
+        if(atomic_load(&h->epoch) == epoch) {
+            *pin = slot;
+            return atomic_load(&h->dict);
+        }
+        atomic_fetch_sub(&h->readers[slot].count, 1);
+    }
+}
+
+void atl_token_dict_handle_unpin(atl_token_dict_handle_t *h, uint32_t pin) {
+    atomic_fetch_sub_explicit(&h->readers[pin & 1].count, 1, memory_order_release);
+}
+
+static
+void wait_for_readers(atl_token_dict_handle_t *h) {
+    /* Flip the epoch twice, each time waiting for the readers counted under the old parity.
+       A reader which saw the epoch before the first flip is waited for by the first pass and
+       one which saw it before the second flip (but may still have loaded the old dictionary)
+       by the second. */
+    for( int pass=0; pass<2; pass++ ) {
+        uint64_t epoch = atomic_fetch_add(&h->epoch, 1);
+        _Atomic uint64_t *count = &h->readers[epoch & 1].count;
+        uint32_t spins = 0;
+        while(atomic_load_explicit(count, memory_order_acquire)) {
+            if(++spins < 64)
+                sched_yield();
+            else {
+                struct timespec ts = { 0, 50000 };
+                nanosleep(&ts, NULL);
+            }
+        }
+    }
+}
+
+void atl_token_dict_handle_publish(atl_token_dict_handle_t *h, atl_token_dict_t *dict) {
+    pthread_mutex_lock(&h->mutex);
+    atl_token_dict_t *old = atomic_exchange(&h->dict, dict);
+    atomic_fetch_add(&h->version, 1);
+    wait_for_readers(h);
+    pthread_mutex_unlock(&h->mutex);
+    if(old)
+        atl_token_dict_destroy(old);
+}
+
+static
+atl_token_dict_t *load_dict(const char *filename) {
+    atl_token_dict_t *dict = atl_token_dict_map(filename);
+    if(dict)
+        return dict;
+    /* a corrupt or incompatible image is an error rather than a config file */
+    if(access(filename, R_OK) || atl_token_dict_is_image(filename))
+        return NULL;
+    dict = atl_token_dict_load(filename);
+    if(!dict)
+        return NULL;
+    /* an empty (or entirely invalid) config would silently drop every entry */
+    if(!atl_token_dict_size(dict)) {
+        atl_token_dict_destroy(dict);
+        return NULL;
+    }
+    atl_token_dict_freeze(dict);
+    return dict;
+}
+
+static
+void *reload_thread(void *arg) {
+    atl_token_dict_handle_t *h = (atl_token_dict_handle_t *)arg;
+    atl_token_dict_t *dict = load_dict(h->filename);
+    h->reload_ok = dict != NULL;
+    if(dict)
+        atl_token_dict_handle_publish(h, dict);
+    atomic_store(&h->reload_done, true);
+    return NULL;
+}
+
+bool atl_token_dict_handle_reload(atl_token_dict_handle_t *h, const char *filename) {
+    if(h->reloading && !atomic_load(&h->reload_done))
+        return false;
+    atl_token_dict_handle_wait(h);
+    h->filename = aml_strdup(filename);
+    atomic_store(&h->reload_done, false);
+    if(pthread_create(&h->thread, NULL, reload_thread, h)) {
+        h->reload_ok = false;
+        return false;
+    }
+    h->reloading = true;
+    return true;
+}
+
+bool atl_token_dict_handle_wait(atl_token_dict_handle_t *h) {
+    if(h->reloading) {
+        pthread_join(h->thread, NULL);
+        h->reloading = false;
+    }
+    if(h->filename) {
+        aml_free(h->filename);
+        h->filename = NULL;
+    }
+    return h->reload_ok;
+}
+
+uint64_t atl_token_dict_handle_version(atl_token_dict_handle_t *h) {
+    return atomic_load(&h->version);
+}
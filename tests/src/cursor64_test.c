@@ -0,0 +1,151 @@
+// SPDX-FileCopyrightText:  2023 Andy Curtis <contactandyc@gmail.com>
+// SPDX-License-Identifier: Apache-2.0
+#include "a-tokenizer-library/atl_cursor.h"
+#include "a-tokenizer-library/atl_cursor64.h"
+
+#include <stdio.h>
+#include <string.h>
+
+/*
+    The same AND, OR, NOT and phrase trees are opened with the 32 bit and the 64 bit engine.
+    The 64 bit leaves return the 32 bit ids plus BASE, so they cross 2^32.  Both engines must
+    return the same ids (after advance_to, advancing, a rewind and atl_cursor_count).
+*/
+
+#define BASE ((1ULL << 32) - 64)
+#define NUM_LEAVES 6
+#define NUM_IDS 160
+
+static uint32_t postings[NUM_LEAVES][NUM_IDS];
+static uint64_t postings64[NUM_LEAVES][NUM_IDS];
+static uint32_t num_postings[NUM_LEAVES];
+
+static uint32_t seed = 1;
+
+static
+uint32_t next_rand(void) {
+    seed = seed * 1103515245 + 12345;
+    return (seed >> 16) & 0x7FFF;
+}
+
+/* a-f have postings, r is a range and x a single id */
+static
+atl_cursor_t *leaf(aml_pool_t *pool, atl_token_t *t, void *arg) {
+    (void)arg;
+    if(t->token[0] >= 'a' && t->token[0] < 'a' + NUM_LEAVES && !t->token[1]) {
+        uint32_t i = t->token[0] - 'a';
+        return atl_cursor_array(pool, postings[i], num_postings[i]);
+    }
+    if(!strcmp(t->token, "r"))
+        return atl_cursor_range(pool, 40, 100);
+    if(!strcmp(t->token, "x"))
+        return atl_cursor_init_id(pool, 64);
+    return atl_cursor_init_empty(pool);
+}
+
+static
+atl_cursor64_t *leaf64(aml_pool_t *pool, atl_token_t *t, void *arg) {
+    (void)arg;
+    if(t->token[0] >= 'a' && t->token[0] < 'a' + NUM_LEAVES && !t->token[1]) {
+        uint32_t i = t->token[0] - 'a';
+        return atl_cursor64_array(pool, postings64[i], num_postings[i]);
+    }
+    if(!strcmp(t->token, "r"))
+        return atl_cursor64_range(pool, BASE + 40, BASE + 100);
+    if(!strcmp(t->token, "x"))
+        return atl_cursor64_init_id(pool, BASE + 64);
+    return atl_cursor64_init_empty(pool);
+}
+
+static const char *expressions[] = {
+    "a b", "a OR b", "a NOT b", "\"a b\"", "(a OR b) c", "a OR (b NOT c)", "r", "r a",
+    "r NOT a", "x OR a", "(a OR b OR c) NOT (d OR e)", "\"a b\" OR \"c d\"", "a b c d e f",
+    "r (x OR f) NOT e", "NOT a", "a z", "z OR b"
+};
+
+static const char *words[] = {
+    "a", "b", "c", "d", "e", "f", "r", "x", "z", "OR", "NOT", "(", ")", "\""
+};
+
+#define NUM_WORDS (sizeof(words) / sizeof(words[0]))
+
+/* returns the number of ids or -1 if the engines differ */
+static
+int compare_cursors(atl_cursor_t *c, atl_cursor64_t *c64) {
+    int n = 0;
+    while(true) {
+        bool a = c->advance(c);
+        bool b = c64->advance(c64);
+        if(a != b || (a && c->id + BASE != c64->id))
+            return -1;
+        if(!a)
+            return n;
+        n++;
+    }
+}
+
+int main(void) {
+    for( uint32_t i=0; i<NUM_LEAVES; i++ ) {
+        for( uint32_t id=1; id<NUM_IDS; id++ ) {
+            if(next_rand() % 3 == 0) {
+                postings64[i][num_postings[i]] = BASE + id;
+                postings[i][num_postings[i]++] = id;
+            }
+        }
+    }
+
+    aml_pool_t *pool = aml_pool_init(4096);
+    char expression[256];
+    int failures = 0;
+    uint32_t num_expressions = sizeof(expressions) / sizeof(expressions[0]);
+    uint32_t crossed = 0;
+    for( uint32_t i=0; i<num_expressions+4000; i++ ) {
+        aml_pool_clear(pool);
+        if(i < num_expressions)
+            strcpy(expression, expressions[i]);
+        else {
+            expression[0] = 0;
+            uint32_t n = 1 + next_rand() % 10;
+            for( uint32_t j=0; j<n; j++ ) {
+                strcat(expression, words[next_rand() % NUM_WORDS]);
+                strcat(expression, " ");
+            }
+        }
+        atl_token_t *t = atl_token_parse_expression(pool, expression, NULL, NULL);
+        atl_cursor_t *c = atl_cursor_open(pool, leaf, t, NULL);
+        atl_cursor64_t *c64 = atl_cursor64_open(pool, leaf64, t, NULL);
+
+        /* advance_to only moves an unpositioned cursor (id 0) to a target above 0 */
+        uint32_t target = 1 + next_rand() % 80;
+        bool a = c->advance_to(c, target);
+        bool b = c64->advance_to(c64, BASE + target);
+        if(a && b && c64->id >= (1ULL << 32))
+            crossed++;
+        if(a != b || (a && c->id + BASE != c64->id) || compare_cursors(c, c64) < 0) {
+            printf("FAIL %s differs after advance_to %u\n", expression, target);
+            failures++;
+            continue;
+        }
+
+        atl_cursor_rewind(c);
+        atl_cursor64_rewind(c64);
+        int n = compare_cursors(c, c64);
+        atl_cursor_rewind(c);
+        atl_cursor64_rewind(c64);
+        uint32_t count = atl_cursor_count(c);
+        uint64_t count64 = atl_cursor64_count(c64);
+        if(n < 0 || count != (uint32_t)n || count64 != count) {
+            printf("FAIL %s: advanced %d, counted %u and %llu\n", expression, n, count,
+                   (unsigned long long)count64);
+            failures++;
+        }
+    }
+    if(!crossed) {
+        printf("FAIL no expression returned an id above 2^32\n");
+        failures++;
+    }
+
+    aml_pool_destroy(pool);
+    printf("%s\n", failures ? "FAILED" : "passed");
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,74 @@
+// SPDX-FileCopyrightText:  2023 Andy Curtis <contactandyc@gmail.com>
+// SPDX-License-Identifier: Apache-2.0
+#include "a-tokenizer-library/atl_cursor_batch.h"
+
+#include <stdio.h>
+#include <string.h>
+
+/*
+    Checks that atl_cursor_batch returns the same ids as running each expression on its own,
+    including expressions which only differ in case (the leaf callback is case sensitive).
+*/
+
+static const uint32_t foo_upper[] = { 1, 2, 3 };
+static const uint32_t foo_lower[] = { 7, 8, 9 };
+static const uint32_t bar[] = { 1, 2, 3, 5, 7, 8, 9 };
+static const uint32_t baz[] = { 2, 5, 8, 11 };
+
+static
+atl_cursor_t *leaf(aml_pool_t *pool, atl_token_t *t, void *arg) {
+    (void)arg;
+    if(!strcmp(t->token, "Foo"))
+        return atl_cursor_array(pool, foo_upper, 3);
+    if(!strcmp(t->token, "foo"))
+        return atl_cursor_array(pool, foo_lower, 3);
+    if(!strcmp(t->token, "bar"))
+        return atl_cursor_array(pool, bar, 7);
+    if(!strcmp(t->token, "baz"))
+        return atl_cursor_array(pool, baz, 4);
+    return atl_cursor_init_empty(pool);
+}
+
+int main(void) {
+    const char *expressions[] = {
+        "Foo bar",
+        "foo bar",
+        "(Foo bar) OR baz",
+        "(foo bar) OR baz",
+        "baz OR (foo bar)",
+        "(Foo OR foo) bar",
+        "bar -(Foo baz)",
+        "bar -(foo baz)"
+    };
+    uint32_t num_expressions = sizeof(expressions) / sizeof(expressions[0]);
+    int failures = 0;
+
+    aml_pool_t *pool = aml_pool_init(4096);
+    aml_pool_t *tmp = aml_pool_init(4096);
+    for( uint32_t threads=1; threads<=2; threads++ ) {
+        aml_pool_clear(pool);
+        atl_cursor_batch_result_t *r = atl_cursor_batch(pool, expressions, num_expressions,
+                                                        NULL, NULL, leaf, NULL, threads);
+        for( uint32_t i=0; i<num_expressions; i++ ) {
+            aml_pool_clear(tmp);
+            atl_token_t *t = atl_token_parse_expression(tmp, expressions[i], NULL, NULL);
+            atl_cursor_t *c = atl_cursor_open(tmp, leaf, atl_token_optimize(tmp, t), NULL);
+            uint32_t n = 0;
+            bool ok = true;
+            while(c->advance(c)) {
+                if(n >= r[i].num_ids || r[i].ids[n] != c->id)
+                    ok = false;
+                n++;
+            }
+            if(!ok || n != r[i].num_ids) {
+                printf("FAIL %s (%u threads): expected %u ids, batch returned %u\n",
+                       expressions[i], threads, n, r[i].num_ids);
+                failures++;
+            }
+        }
+    }
+    aml_pool_destroy(tmp);
+    aml_pool_destroy(pool);
+    printf("%s\n", failures ? "FAILED" : "passed");
+    return failures ? 1 : 0;
+}
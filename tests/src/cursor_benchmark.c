@@ -0,0 +1,178 @@
+// SPDX-FileCopyrightText:  2023 Andy Curtis <contactandyc@gmail.com>
+// SPDX-License-Identifier: Apache-2.0
+#include "a-tokenizer-library/atl_token.h"
+#include "a-tokenizer-library/atl_cursor.h"
+#include "a-memory-library/aml_alloc.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <math.h>
+
+/*
+    Measures the cursor engine over synthetic posting lists.
+
+    cursor_benchmark [-n num_ids] [-d density] [-s zipf_exponent] [-r repeat]
+
+    Terms t0 .. t15 are generated twice, once with every term matching density * num_ids ids
+    (uniform) and once with term k matching density / (k+1)^s of the ids (zipf).  Each query is
+    opened with atl_cursor_open and advanced to the end repeat times.  ns/advance is the time
+    per call to advance on the root cursor and pool is the bytes used to open the cursor tree.
+*/
+
+#define NUM_TERMS 16
+
+typedef struct {
+    uint32_t *ids;
+    uint32_t num_ids;
+} posting_t;
+
+static posting_t postings[NUM_TERMS];
+
+static uint64_t rng_state = 0x9E3779B97F4A7C15ULL;
+
+static double rng_double(void) {
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 7;
+    rng_state ^= rng_state << 17;
+    return (rng_state >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void generate(uint32_t num_ids, double density, double zipf) {
+    for( uint32_t k=0; k<NUM_TERMS; k++ ) {
+        double p = zipf > 0.0 ? density / pow(k+1, zipf) : density;
+        posting_t *pl = postings + k;
+        pl->num_ids = 0;
+        for( uint32_t id=0; id<num_ids; id++ ) {
+            if(rng_double() < p)
+                pl->ids[pl->num_ids++] = id;
+        }
+    }
+}
+
+static atl_cursor_t *term_cursor(aml_pool_t *pool, atl_token_t *t, void *arg) {
+    (void)arg;
+    if(t->token[0] != 't')
+        return NULL;
+    uint32_t k = atoi(t->token+1);
+    if(k >= NUM_TERMS)
+        return NULL;
+    return atl_cursor_array(pool, postings[k].ids, postings[k].num_ids);
+}
+
+/* width terms joined by sep starting at term first */
+static void terms(char *s, uint32_t first, uint32_t width, const char *sep) {
+    for( uint32_t i=0; i<width; i++ )
+        s += sprintf(s, "%st%u", i ? sep : "", (first + i) % NUM_TERMS);
+}
+
+/* alternating levels of AND and OR, two children per level */
+static char *nested(char *s, uint32_t depth, uint32_t *term) {
+    if(!depth) {
+        s += sprintf(s, "t%u", *term % NUM_TERMS);
+        (*term)++;
+        return s;
+    }
+    *s++ = '(';
+    s = nested(s, depth-1, term);
+    s += sprintf(s, "%s", depth & 1 ? " OR " : " ");
+    s = nested(s, depth-1, term);
+    *s++ = ')';
+    *s = 0;
+    return s;
+}
+
+static aml_pool_t *cursor_pool;
+
+static void run(aml_pool_t *pool, const char *dist, const char *expression, uint32_t repeat) {
+    atl_token_t *t = atl_token_parse_expression(pool, expression, NULL, NULL);
+    uint64_t ids = 0, advances = 0;
+    size_t pool_bytes = 0;
+
+    double start = now();
+    for( uint32_t r=0; r<repeat; r++ ) {
+        aml_pool_clear(cursor_pool);
+        atl_cursor_t *c = atl_cursor_open(cursor_pool, term_cursor, t, NULL);
+        advances++;
+        while(c->advance(c)) {
+            ids++;
+            advances++;
+        }
+        pool_bytes = aml_pool_used(cursor_pool);
+    }
+    double elapsed = now() - start;
+
+    printf( "%-8s %-44s %12" PRIu64 " %14.0f %10.2f %10zu\n", dist, expression, ids / repeat,
+            elapsed > 0.0 ? ids / elapsed : 0.0, elapsed * 1e9 / advances, pool_bytes );
+}
+
+static void run_queries(aml_pool_t *pool, const char *dist, uint32_t repeat) {
+    char s[1024];
+    uint32_t widths[] = {2, 4, 8};
+    for( uint32_t i=0; i<sizeof(widths)/sizeof(widths[0]); i++ ) {
+        terms(s, 0, widths[i], " ");
+        run(pool, dist, s, repeat);
+        terms(s, 0, widths[i], " OR ");
+        run(pool, dist, s, repeat);
+        s[0] = '"';
+        terms(s+1, 0, widths[i], " ");
+        strcat(s, "\"");
+        run(pool, dist, s, repeat);
+    }
+    run(pool, dist, "t0 NOT t1", repeat);
+    run(pool, dist, "t1 NOT t0", repeat);
+    run(pool, dist, "(t0 OR t1) NOT (t2 OR t3)", repeat);
+    for( uint32_t depth=1; depth<=4; depth++ ) {
+        uint32_t term = 0;
+        nested(s, depth, &term);
+        run(pool, dist, s, repeat);
+    }
+}
+
+int main(int argc, char *argv[]) {
+    uint32_t num_ids = 1000000;
+    double density = 0.1;
+    double zipf = 1.0;
+    uint32_t repeat = 5;
+    for( int i=1; i+1<argc; i+=2 ) {
+        if(!strcmp(argv[i], "-n"))
+            num_ids = atoi(argv[i+1]);
+        else if(!strcmp(argv[i], "-d"))
+            density = atof(argv[i+1]);
+        else if(!strcmp(argv[i], "-s"))
+            zipf = atof(argv[i+1]);
+        else if(!strcmp(argv[i], "-r"))
+            repeat = atoi(argv[i+1]);
+    }
+    if(!repeat)
+        repeat = 1;
+
+    for( uint32_t k=0; k<NUM_TERMS; k++ )
+        postings[k].ids = (uint32_t *)aml_malloc(sizeof(uint32_t) * (num_ids+1));
+
+    aml_pool_t *pool = aml_pool_init(16384);
+    cursor_pool = aml_pool_init(16384);
+    printf( "%-8s %-44s %12s %14s %10s %10s\n", "dist", "query", "ids", "ids/sec", "ns/advance", "pool" );
+
+    generate(num_ids, density, 0.0);
+    run_queries(pool, "uniform", repeat);
+    aml_pool_clear(pool);
+
+    char dist[32];
+    snprintf(dist, sizeof(dist), "zipf%.2g", zipf);
+    generate(num_ids, density, zipf);
+    run_queries(pool, dist, repeat);
+
+    aml_pool_destroy(cursor_pool);
+    aml_pool_destroy(pool);
+    for( uint32_t k=0; k<NUM_TERMS; k++ )
+        aml_free(postings[k].ids);
+    return 0;
+}
@@ -0,0 +1,146 @@
+// SPDX-FileCopyrightText:  2023 Andy Curtis <contactandyc@gmail.com>
+// SPDX-License-Identifier: Apache-2.0
+#include "a-tokenizer-library/atl_cursor_cache.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+
+/*
+    Results served from the cache must equal running the expression (including ids whose
+    deltas need every varint length), equivalent expressions must hit without calling the
+    leaf callback, the least recently used result must be evicted first and the invalidation
+    hooks must remove what they say.
+*/
+
+/* deltas of 1 to 5 varint bytes */
+static const uint32_t wide[] = {
+    1, 2, 129, 130, 16514, 16515, 2113667, 2113668, 270549124, 270549125, 4000000000u,
+    4294967294u
+};
+static const uint32_t narrow[] = { 2, 3, 129, 16515, 2113668, 4000000000u };
+static uint32_t same[4][20];
+
+static uint32_t leaf_calls = 0;
+
+/* a leaf callback which is case insensitive, as the cache expects */
+static
+atl_cursor_t *leaf(aml_pool_t *pool, atl_token_t *t, void *arg) {
+    (void)arg;
+    leaf_calls++;
+    if(!strcasecmp(t->token, "wide"))
+        return atl_cursor_array(pool, wide, sizeof(wide) / sizeof(wide[0]));
+    if(!strcasecmp(t->token, "narrow"))
+        return atl_cursor_array(pool, narrow, sizeof(narrow) / sizeof(narrow[0]));
+    if(t->token[0] >= 'p' && t->token[0] < 'p' + 4 && !t->token[1])
+        return atl_cursor_array(pool, same[t->token[0] - 'p'], 20);
+    return atl_cursor_init_empty(pool);
+}
+
+/* opens expression through the cache and compares it to opening it directly, returning the
+   number of times the leaf callback was used or -1 if the ids differ */
+static
+int open_cached(atl_cursor_cache_t *cache, aml_pool_t *pool, const char *expression) {
+    atl_token_t *t = atl_token_parse_expression(pool, expression, NULL, NULL);
+    leaf_calls = 0;
+    atl_cursor_t *c = atl_cursor_cache_open(cache, pool, leaf, t, NULL);
+    int calls = leaf_calls;
+    atl_cursor_t *d = atl_cursor_open(pool, leaf, t, NULL);
+    while(true) {
+        bool a = c->advance(c);
+        bool b = d->advance(d);
+        if(a != b || (a && c->id != d->id))
+            return -1;
+        if(!a)
+            return calls;
+    }
+}
+
+static
+bool expect(int *failures, const char *what, bool ok) {
+    if(!ok) {
+        printf("FAIL %s\n", what);
+        (*failures)++;
+    }
+    return ok;
+}
+
+int main(void) {
+    for( uint32_t i=0; i<4; i++ )
+        for( uint32_t j=0; j<20; j++ )
+            same[i][j] = (j+1) * 1000;
+
+    aml_pool_t *pool = aml_pool_init(4096);
+    int failures = 0;
+    size_t hits, misses, bytes;
+
+    /* hits, including equivalent expressions, decode to the same ids */
+    atl_cursor_cache_t *cache = atl_cursor_cache_init(1 << 20);
+    const char *expressions[] = {
+        "wide", "WIDE", "wide OR narrow", "Narrow or Wide", "wide narrow", "(narrow wide)",
+        "wide NOT narrow", "\"wide narrow\"", "missing", "missing OR wide"
+    };
+    /* 1 when the expression (or an equivalent one) was opened before */
+    const int cached[] = { 0, 1, 0, 1, 0, 1, 0, 0, 0, 0 };
+    for( uint32_t r=0; r<2; r++ ) {
+        for( uint32_t i=0; i<sizeof(expressions) / sizeof(expressions[0]); i++ ) {
+            aml_pool_clear(pool);
+            int calls = open_cached(cache, pool, expressions[i]);
+            if(calls < 0 || (calls == 0) != (r || cached[i])) {
+                printf("FAIL %s (pass %u) called the leaf callback %d times\n", expressions[i],
+                       r, calls);
+                failures++;
+            }
+        }
+    }
+    atl_cursor_cache_stats(cache, &hits, &misses, &bytes);
+    expect(&failures, "hit and miss counts", hits == 13 && misses == 7 && bytes > 0);
+
+    /* invalidation */
+    aml_pool_clear(pool);
+    atl_token_t *t = atl_token_parse_expression(pool, "NARROW wide", NULL, NULL);
+    expect(&failures, "invalidate", atl_cursor_cache_invalidate(cache, t) &&
+                                     !atl_cursor_cache_invalidate(cache, t));
+    expect(&failures, "invalidated result is reopened",
+           open_cached(cache, pool, "wide narrow") > 0);
+    expect(&failures, "invalidate_term", atl_cursor_cache_invalidate_term(cache, "narrow") == 4 &&
+                                         atl_cursor_cache_invalidate_term(cache, "narrow") == 0);
+    expect(&failures, "result without the term is kept", open_cached(cache, pool, "wide") == 0);
+    atl_cursor_cache_clear(cache);
+    atl_cursor_cache_stats(cache, NULL, NULL, &bytes);
+    expect(&failures, "clear", bytes == 0 && open_cached(cache, pool, "wide") > 0);
+    atl_cursor_cache_destroy(cache);
+
+    /* p, q, r and s have results of the same size, the cache holds three of them */
+    cache = atl_cursor_cache_init(1 << 20);
+    open_cached(cache, pool, "p");
+    size_t entry_size;
+    atl_cursor_cache_stats(cache, NULL, NULL, &entry_size);
+    atl_cursor_cache_destroy(cache);
+
+    cache = atl_cursor_cache_init(entry_size * 3);
+    open_cached(cache, pool, "p");
+    open_cached(cache, pool, "q");
+    open_cached(cache, pool, "r");
+    expect(&failures, "p is cached", open_cached(cache, pool, "p") == 0);
+    open_cached(cache, pool, "s"); /* evicts q, the least recently used */
+    atl_cursor_cache_stats(cache, NULL, NULL, &bytes);
+    expect(&failures, "cache stays within max_bytes", bytes <= entry_size * 3);
+    expect(&failures, "recently used results are kept", open_cached(cache, pool, "p") == 0 &&
+                                                         open_cached(cache, pool, "r") == 0 &&
+                                                         open_cached(cache, pool, "s") == 0);
+    expect(&failures, "least recently used result is evicted", open_cached(cache, pool, "q") > 0);
+    atl_cursor_cache_destroy(cache);
+
+    /* a result larger than the cache is returned but never cached */
+    cache = atl_cursor_cache_init(entry_size - 1);
+    expect(&failures, "oversized result", open_cached(cache, pool, "p") > 0 &&
+                                          open_cached(cache, pool, "p") > 0);
+    atl_cursor_cache_stats(cache, NULL, NULL, &bytes);
+    expect(&failures, "nothing cached", bytes == 0);
+    atl_cursor_cache_destroy(cache);
+
+    aml_pool_destroy(pool);
+    printf("%s\n", failures ? "FAILED" : "passed");
+    return failures ? 1 : 0;
+}
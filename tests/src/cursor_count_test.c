@@ -0,0 +1,125 @@
+// SPDX-FileCopyrightText:  2023 Andy Curtis <contactandyc@gmail.com>
+// SPDX-License-Identifier: Apache-2.0
+#include "a-tokenizer-library/atl_cursor.h"
+
+#include <stdio.h>
+#include <string.h>
+
+/*
+    Leaf cursors (including empty ones) are advanced part way, optionally reset and then
+    counted, advanced or moved with advance_to.  atl_cursor_count must agree with the number
+    of ids advancing returns and no id may be returned twice.
+*/
+
+#define NUM_IDS 200
+
+static uint32_t ids[NUM_IDS];
+static uint64_t bits[(NUM_IDS * 4 + 63) / 64];
+
+typedef struct {
+    const char *name;
+    uint32_t start;
+    uint32_t end;
+    uint32_t num_ids;  /* for the array and bitmap leaves */
+} leaf_t;
+
+static
+atl_cursor_t *open_leaf(aml_pool_t *pool, uint32_t type, leaf_t *l) {
+    if(type == 0)
+        return atl_cursor_range(pool, l->start, l->end);
+    if(type == 1)
+        return atl_cursor_array(pool, ids, l->num_ids);
+    if(type == 2)
+        return atl_cursor_bitmap(pool, bits, l->num_ids ? ids[l->num_ids-1] + 1 : 0);
+    return atl_cursor_init_id(pool, l->start);
+}
+
+/* the ids the cursor has left */
+static
+uint32_t collect(atl_cursor_t *c, uint32_t *out) {
+    uint32_t n = 0;
+    while(c->advance(c)) {
+        if(n >= NUM_IDS * 4)
+            return n;
+        out[n++] = c->id;
+    }
+    return n;
+}
+
+int main(void) {
+    uint32_t id = 0;
+    for( uint32_t i=0; i<NUM_IDS; i++ ) {
+        id += 1 + (i * 7) % 5;
+        ids[i] = id;
+        bits[id >> 6] |= 1ULL << (id & 63);
+    }
+
+    leaf_t leaves[] = {
+        { "empty", 0, 0, 0 },
+        { "empty at 5", 5, 5, 0 },
+        { "reversed", 9, 5, 0 },
+        { "one", 5, 6, 1 },
+        { "some", 3, 40, 30 },
+        { "all", 0, NUM_IDS * 3, NUM_IDS }
+    };
+    const char *types[] = { "range", "array", "bitmap", "id" };
+
+    uint32_t expected[NUM_IDS * 4], got[NUM_IDS * 4];
+    aml_pool_t *pool = aml_pool_init(4096);
+    int failures = 0;
+    for( uint32_t type=0; type<4; type++ ) {
+        for( uint32_t i=0; i<sizeof(leaves) / sizeof(leaves[0]); i++ ) {
+            leaf_t *l = leaves + i;
+            aml_pool_clear(pool);
+            uint32_t num_expected = collect(open_leaf(pool, type, l), expected);
+            for( uint32_t skip=0; skip<=num_expected && skip<4; skip++ ) {
+                /* a reset only makes sense once the cursor is on an id */
+                for( uint32_t reset=0; reset<(skip ? 2 : 1); reset++ ) {
+                    /* the ids left after skip advances (the current one again after a reset) */
+                    uint32_t first = skip - reset;
+                    uint32_t left = num_expected - first;
+
+                    atl_cursor_t *c = open_leaf(pool, type, l);
+                    for( uint32_t k=0; k<skip; k++ )
+                        c->advance(c);
+                    if(reset)
+                        atl_cursor_reset(c);
+                    uint32_t count = atl_cursor_count(c);
+
+                    c = open_leaf(pool, type, l);
+                    for( uint32_t k=0; k<skip; k++ )
+                        c->advance(c);
+                    if(reset)
+                        atl_cursor_reset(c);
+                    uint32_t n = collect(c, got);
+
+                    bool ok = count == left && n == left &&
+                              !memcmp(got, expected + first, sizeof(uint32_t) * n);
+
+                    /* advance_to a later id and then advance must not repeat it */
+                    if(first + 1 < num_expected) {
+                        c = open_leaf(pool, type, l);
+                        for( uint32_t k=0; k<skip; k++ )
+                            c->advance(c);
+                        if(reset)
+                            atl_cursor_reset(c);
+                        uint32_t target = expected[first+1];
+                        uint32_t after = first + 2 < num_expected ? expected[first+2] : 0;
+                        if(!c->advance_to(c, target) || c->id != target ||
+                           (c->advance(c) ? c->id : 0) != after)
+                            ok = false;
+                    }
+                    if(!ok) {
+                        printf("FAIL %s %s after %u advances%s: counted %u, advanced %u, "
+                               "expected %u\n", types[type], l->name, skip,
+                               reset ? " and a reset" : "", count, n, left);
+                        failures++;
+                    }
+                }
+            }
+        }
+    }
+    aml_pool_destroy(pool);
+    printf("%s\n", failures ? "FAILED" : "passed");
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,118 @@
+// SPDX-FileCopyrightText:  2023 Andy Curtis <contactandyc@gmail.com>
+// SPDX-License-Identifier: Apache-2.0
+#include "a-tokenizer-library/atl_cursor.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/*
+    atl_cursor_explain must print one line per cursor, with children indented by a tab, the
+    positive and negative side of NOT marked and tags shown.  When built with
+    ATL_CURSOR_STATS, the counters must agree with what the root returned.
+*/
+
+static const uint32_t a[] = { 1, 3, 5, 7, 9, 11, 13 };
+static const uint32_t b[] = { 2, 3, 6, 7, 10 };
+static const uint32_t c[] = { 3, 5, 6, 7, 11, 12 };
+
+static
+atl_cursor_t *leaf(aml_pool_t *pool, atl_token_t *t, void *arg) {
+    (void)arg;
+    atl_cursor_t *r;
+    if(!strcmp(t->token, "a"))
+        r = atl_cursor_array(pool, a, sizeof(a) / sizeof(a[0]));
+    else if(!strcmp(t->token, "b"))
+        r = atl_cursor_array(pool, b, sizeof(b) / sizeof(b[0]));
+    else if(!strcmp(t->token, "c"))
+        r = atl_cursor_array(pool, c, sizeof(c) / sizeof(c[0]));
+    else
+        r = atl_cursor_range(pool, 1, 12);
+    r->tag = t->token[0];
+    return r;
+}
+
+/* what atl_cursor_explain prints for c */
+static
+char *explain(atl_cursor_t *c) {
+    FILE *tmp = tmpfile();
+    if(!tmp)
+        return NULL;
+    fflush(stdout);
+    int saved = dup(STDOUT_FILENO);
+    dup2(fileno(tmp), STDOUT_FILENO);
+    atl_cursor_explain(c);
+    fflush(stdout);
+    dup2(saved, STDOUT_FILENO);
+    close(saved);
+
+    long len = ftell(tmp);
+    char *s = (char *)malloc(len + 1);
+    rewind(tmp);
+    s[fread(s, 1, len, tmp)] = 0;
+    fclose(tmp);
+    return s;
+}
+
+/* removes the counters (everything after the type and tag) from each line */
+static
+void strip_stats(char *s) {
+    char *w = s;
+    bool skip = false;
+    for( char *p=s; *p; p++ ) {
+        if(*p == '\n')
+            skip = false;
+        else if(!strncmp(p, " advance=", 9))
+            skip = true;
+        if(!skip)
+            *w++ = *p;
+    }
+    *w = 0;
+}
+
+int main(void) {
+    aml_pool_t *pool = aml_pool_init(4096);
+    int failures = 0;
+
+    atl_token_t *t = atl_token_parse_expression(pool, "(a OR b) c NOT r", NULL, NULL);
+    atl_cursor_t *cur = atl_cursor_open(pool, leaf, t, NULL);
+    uint32_t n = 0;
+    while(atl_cursor_advance(cur))
+        n++;
+
+    char *s = explain(cur);
+    if(!s) {
+        printf("FAIL tmpfile\n");
+        return 1;
+    }
+#ifdef ATL_CURSOR_STATS
+    char returned[64];
+    sprintf(returned, "NOT advance=%u advance_to=0 returned=%u ", n + 1, n);
+    if(strncmp(s, returned, strlen(returned)) || !strstr(s, "heap_ops=")) {
+        printf("FAIL counters\n%s", s);
+        failures++;
+    }
+#endif
+    strip_stats(s);
+    const char *expected =
+        "NOT\n"
+        "\t+\n"
+        "\t\tAND\n"
+        "\t\t\tAND\n"
+        "\t\t\t\tOR\n"
+        "\t\t\t\t\tNORMAL tag=97\n"
+        "\t\t\t\t\tNORMAL tag=98\n"
+        "\t\t\tNORMAL tag=99\n"
+        "\t-\n"
+        "\t\tNORMAL tag=114\n";
+    if(strcmp(s, expected)) {
+        printf("FAIL explain printed\n%s", s);
+        failures++;
+    }
+    free(s);
+
+    aml_pool_destroy(pool);
+    printf("%s\n", failures ? "FAILED" : "passed");
+    return failures ? 1 : 0;
+}
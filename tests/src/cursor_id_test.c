@@ -0,0 +1,90 @@
+// SPDX-FileCopyrightText:  2023 Andy Curtis <contactandyc@gmail.com>
+// SPDX-License-Identifier: Apache-2.0
+#include "a-tokenizer-library/atl_cursor_parallel.h"
+
+#include <stdio.h>
+#include <string.h>
+
+/*
+    Single id leaves (atl_cursor_init_id) combined with ranges, checked sequentially, after a
+    rewind, by atl_cursor_count and by atl_cursor_parallel (which starts each chunk with
+    advance_to).
+*/
+
+static
+atl_cursor_t *leaf(aml_pool_t *pool, atl_token_t *t, void *arg) {
+    (void)arg;
+    if(!strcmp(t->token, "x"))
+        return atl_cursor_init_id(pool, 42);
+    if(!strcmp(t->token, "y"))
+        return atl_cursor_init_id(pool, 5000);
+    if(!strcmp(t->token, "r"))
+        return atl_cursor_range(pool, 0, 10000);
+    return atl_cursor_init_empty(pool);
+}
+
+typedef struct {
+    const char *expression;
+    uint32_t expected;
+} id_test_t;
+
+int main(void) {
+    id_test_t tests[] = {
+        { "x", 1 },
+        { "x r", 1 },
+        { "r x", 1 },
+        { "x OR y", 2 },
+        { "(x OR y) r", 2 },
+        { "r NOT x", 9999 },
+        { "x y", 0 },
+        { "x NOT y", 1 },
+        { "y NOT x", 1 },
+        { "(x OR y) NOT x", 1 }
+    };
+    uint32_t num_tests = sizeof(tests) / sizeof(tests[0]);
+    int failures = 0;
+
+    aml_pool_t *pool = aml_pool_init(4096);
+    for( uint32_t i=0; i<num_tests; i++ ) {
+        aml_pool_clear(pool);
+        atl_token_t *t = atl_token_parse_expression(pool, tests[i].expression, NULL, NULL);
+        atl_cursor_t *c = atl_cursor_open(pool, leaf, t, NULL);
+        uint32_t n[6];
+        n[0] = 0;
+        while(c->advance(c))
+            n[0]++;
+        c->rewind(c);
+        n[1] = 0;
+        while(c->advance(c))
+            n[1]++;
+        c->rewind(c);
+        n[2] = atl_cursor_count(c);
+        for( uint32_t j=0; j<3; j++ )
+            atl_cursor_parallel(pool, leaf, t, NULL, 0, 20000, 1 << j, n + 3 + j);
+        for( uint32_t j=0; j<6; j++ ) {
+            if(n[j] != tests[i].expected) {
+                printf("FAIL %s: check %u returned %u ids, expected %u\n",
+                       tests[i].expression, j, n[j], tests[i].expected);
+                failures++;
+            }
+        }
+    }
+
+    /* advance_to succeeds while the target is at or before the id, which is then consumed */
+    atl_cursor_t *x = atl_cursor_init_id(pool, 42);
+    if(!x->advance_to(x, 10) || x->id != 42 || x->advance(x))
+        failures++;
+    x->rewind(x);
+    if(!x->advance_to(x, 42) || x->id != 42 || !x->advance_to(x, 42))
+        failures++;
+    x->rewind(x);
+    if(x->advance_to(x, 43))
+        failures++;
+    x->rewind(x);
+    if(!x->advance(x) || x->id != 42 || x->advance(x))
+        failures++;
+
+    aml_pool_destroy(pool);
+    printf("%s\n", failures ? "FAILED" : "passed");
+    return failures ? 1 : 0;
+}
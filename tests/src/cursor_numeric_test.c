@@ -0,0 +1,203 @@
+// SPDX-FileCopyrightText:  2023 Andy Curtis <contactandyc@gmail.com>
+// SPDX-License-Identifier: Apache-2.0
+#include "a-tokenizer-library/atl_cursor_numeric.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+/*
+    A numeric column spread over several blocks of 128 ids (one entirely inside [10, 20], one
+    entirely outside it and NaN values throughout) is queried with inclusive ranges.  The
+    cursor must return exactly the ids whose value is in range, including after advance_to
+    targets on and around block boundaries, a rewind and atl_cursor_count.  Ranges parsed
+    with atl_token_range (price:[10..20], price:>=10, price:[..5], ...) must select the same
+    ids as the comparison they were written as.
+*/
+
+#define NUM_IDS 1000
+#define BLOCK_SIZE 128
+
+static uint32_t ids[NUM_IDS];
+static double values[NUM_IDS];
+
+static uint32_t seed = 1;
+
+static
+uint32_t next_rand(void) {
+    seed = seed * 1103515245 + 12345;
+    return (seed >> 16) & 0x7FFF;
+}
+
+/* the ids whose value v satisfies lo < v < hi (or <= if inclusive) */
+typedef struct {
+    double lo;
+    double hi;
+    bool lo_inclusive;
+    bool hi_inclusive;
+} bounds_t;
+
+static
+bool in_bounds(const bounds_t *b, double v) {
+    if(isnan(v))
+        return false;
+    return (b->lo_inclusive ? v >= b->lo : v > b->lo) &&
+           (b->hi_inclusive ? v <= b->hi : v < b->hi);
+}
+
+/* returns the number of ids c returns which differ from the expected ids from index from */
+static
+uint32_t check_ids(atl_cursor_t *c, const bounds_t *b, uint32_t from) {
+    uint32_t bad = 0;
+    uint32_t i = from;
+    while(c->advance(c)) {
+        while(i < NUM_IDS && !in_bounds(b, values[i]))
+            i++;
+        if(i >= NUM_IDS || c->id != ids[i])
+            bad++;
+        i++;
+    }
+    for( ; i<NUM_IDS; i++ )
+        if(in_bounds(b, values[i]))
+            bad++;
+    return bad;
+}
+
+/* advance_to target from the current position, returning 1 if c lands on the wrong id and
+   setting *from to the index after the expected id */
+static
+uint32_t check_advance_to(atl_cursor_t *c, const bounds_t *b, uint32_t target, uint32_t *from) {
+    uint32_t i = *from;
+    while(i < NUM_IDS && (ids[i] < target || !in_bounds(b, values[i])))
+        i++;
+    bool r = c->advance_to(c, target);
+    *from = i + 1;
+    return r != (i < NUM_IDS) || (r && c->id != ids[i]);
+}
+
+/* checks c (a cursor over b) and returns the number of errors */
+static
+uint32_t check_cursor(atl_cursor_t *c, const bounds_t *b) {
+    uint32_t bad = check_ids(c, b, 0);
+
+    /* the last id of a block, the first of the next and the id after it */
+    for( uint32_t k=BLOCK_SIZE; k<NUM_IDS; k+=BLOCK_SIZE ) {
+        uint32_t targets[3] = { ids[k-1], ids[k], ids[k] + 1 };
+        for( uint32_t j=0; j<3; j++ ) {
+            if(!atl_cursor_rewind(c))
+                bad++;
+            uint32_t from = 0;
+            if(!check_advance_to(c, b, targets[j], &from) && from <= NUM_IDS)
+                bad += check_ids(c, b, from);
+        }
+    }
+
+    /* one cursor stepping through every block boundary */
+    if(!atl_cursor_rewind(c))
+        bad++;
+    uint32_t from = 0;
+    for( uint32_t k=BLOCK_SIZE; k<NUM_IDS && from <= NUM_IDS; k+=BLOCK_SIZE ) {
+        uint32_t target = ids[k] - (k / BLOCK_SIZE) % 2;
+        if(from && ids[from-1] >= target)
+            continue;
+        bad += check_advance_to(c, b, target, &from);
+    }
+
+    if(!atl_cursor_rewind(c))
+        bad++;
+    uint32_t n = 0;
+    for( uint32_t i=0; i<NUM_IDS; i++ )
+        if(in_bounds(b, values[i]))
+            n++;
+    if(atl_cursor_count(c) != n)
+        bad++;
+    if(!atl_cursor_rewind(c))
+        bad++;
+    return bad + check_ids(c, b, 0);
+}
+
+int main(void) {
+    uint32_t id = 0;
+    for( uint32_t i=0; i<NUM_IDS; i++ ) {
+        id += 1 + next_rand() % 3;
+        ids[i] = id;
+        if(i / BLOCK_SIZE == 2)
+            values[i] = 10 + next_rand() % 11;
+        else if(i / BLOCK_SIZE == 4)
+            values[i] = 500 + next_rand() % 100;
+        else if(next_rand() % 13 == 0)
+            values[i] = NAN;
+        else if(next_rand() % 50 == 0)
+            values[i] = next_rand() % 2 ? INFINITY : -INFINITY;
+        else
+            values[i] = (double)(next_rand() % 100) / (next_rand() % 4 + 1) - 5.0;
+    }
+    atl_cursor_numeric_t *h = atl_cursor_numeric_init(ids, values, NUM_IDS);
+
+    aml_pool_t *pool = aml_pool_init(4096);
+    int failures = 0;
+    const bounds_t ranges[] = {
+        { 10, 20, true, true }, { 10, INFINITY, true, true }, { -INFINITY, 5, true, true },
+        { -INFINITY, INFINITY, true, true }, { 42, 42, true, true }, { 20, 10, true, true },
+        { 1000, 2000, true, true }, { -0.5, 0.5, true, true }, { 500, 599, true, true }
+    };
+    for( uint32_t r=0; r<sizeof(ranges) / sizeof(ranges[0]); r++ ) {
+        aml_pool_clear(pool);
+        atl_cursor_t *c = atl_cursor_numeric_open(pool, h, ranges[r].lo, ranges[r].hi);
+        uint32_t bad = check_cursor(c, ranges + r);
+        if(bad) {
+            printf("FAIL [%g, %g]: %u wrong\n", ranges[r].lo, ranges[r].hi, bad);
+            failures++;
+        }
+    }
+
+    /* ranges written in queries */
+    struct {
+        const char *expression;
+        bool ok;
+        bounds_t bounds;
+    } queries[] = {
+        { "price:[10..20]", true, { 10, 20, true, true } },
+        { "price:>=10", true, { 10, INFINITY, true, true } },
+        { "price:[..5]", true, { -INFINITY, 5, true, true } },
+        { "price:[5..]", true, { 5, INFINITY, true, true } },
+        { "price:>5", true, { 5, INFINITY, false, true } },
+        { "price:<7.5", true, { -INFINITY, 7.5, true, false } },
+        { "price:<=7.5", true, { -INFINITY, 7.5, true, true } },
+        { "price:42", true, { 42, 42, true, true } },
+        { "price:-2.5", true, { -2.5, -2.5, true, true } },
+        { "price:[x..y]", false, { 0, 0, true, true } },
+        { "price:[..]", false, { 0, 0, true, true } },
+        { "price", false, { 0, 0, true, true } }
+    };
+    for( uint32_t q=0; q<sizeof(queries) / sizeof(queries[0]); q++ ) {
+        aml_pool_clear(pool);
+        atl_token_t *t = atl_token_parse_expression(pool, queries[q].expression, NULL, NULL);
+        atl_token_range_t r;
+        bool ok = t && atl_token_range(t, &r);
+        if(ok != queries[q].ok) {
+            printf("FAIL %s: atl_token_range returned %d\n", queries[q].expression, ok);
+            failures++;
+            continue;
+        }
+        if(!ok)
+            continue;
+        if(r.field.len != 5 || strncmp(r.field.text, "price", 5)) {
+            printf("FAIL %s: field %.*s\n", queries[q].expression, (int)r.field.len,
+                   r.field.text);
+            failures++;
+        }
+        atl_cursor_t *c = atl_cursor_numeric_open(pool, h, r.min, r.max);
+        uint32_t bad = check_cursor(c, &queries[q].bounds);
+        if(bad) {
+            printf("FAIL %s [%.17g, %.17g]: %u wrong\n", queries[q].expression, r.min, r.max,
+                   bad);
+            failures++;
+        }
+    }
+
+    aml_pool_destroy(pool);
+    atl_cursor_numeric_destroy(h);
+    printf("%s\n", failures ? "FAILED" : "passed");
+    return failures ? 1 : 0;
+}
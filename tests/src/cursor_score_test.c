@@ -0,0 +1,225 @@
+// SPDX-FileCopyrightText:  2023 Andy Curtis <contactandyc@gmail.com>
+// SPDX-License-Identifier: Apache-2.0
+#include "a-tokenizer-library/atl_cursor.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+/*
+    BM25 leaves (and a custom leaf which sets its own score callback) are combined with AND, OR
+    and NOT.  Every id must be scored the way atl_cursor_score documents: AND sums its
+    children, OR sums the children on the id and NOT scores its positive side.  The scores
+    must be the same after advance_to and after a rewind.
+*/
+
+#define NUM_DOCS 400
+#define NUM_TERMS 3
+
+static uint32_t ids[NUM_TERMS][NUM_DOCS];
+static uint32_t tfs[NUM_TERMS][NUM_DOCS];
+static uint32_t num_ids[NUM_TERMS];
+static uint32_t doc_lens[NUM_DOCS];
+static atl_cursor_bm25_t params;
+
+static uint32_t seed = 1;
+
+static
+uint32_t next_rand(void) {
+    seed = seed * 1103515245 + 12345;
+    return (seed >> 16) & 0x7FFF;
+}
+
+/* x is every third id with a score of 1.5 */
+typedef struct {
+    atl_cursor_t cursor;
+    uint32_t end;
+} thirds_cursor_t;
+
+static
+bool thirds_advance(atl_cursor_t *c) {
+    thirds_cursor_t *t = (thirds_cursor_t *)c;
+    uint32_t id = c->id ? c->id + 3 : 3;
+    if(id >= t->end)
+        return false;
+    c->id = id;
+    return true;
+}
+
+static
+bool thirds_advance_to(atl_cursor_t *c, uint32_t id) {
+    if(id <= c->id)
+        return true;
+    c->id = ((id - 1) / 3) * 3;
+    return thirds_advance(c);
+}
+
+static
+double thirds_score(atl_cursor_t *c) {
+    (void)c;
+    return 1.5;
+}
+
+static
+bool thirds_rewind(atl_cursor_t *c) {
+    c->id = 0;
+    c->advance = thirds_advance;
+    return true;
+}
+
+static
+atl_cursor_t *leaf(aml_pool_t *pool, atl_token_t *t, void *arg) {
+    (void)arg;
+    if(t->token[0] >= 'a' && t->token[0] < 'a' + NUM_TERMS && !t->token[1]) {
+        uint32_t i = t->token[0] - 'a';
+        return atl_cursor_bm25(pool, ids[i], tfs[i], num_ids[i], &params);
+    }
+    if(!strcmp(t->token, "x")) {
+        thirds_cursor_t *r = (thirds_cursor_t *)aml_pool_alloc(pool, sizeof(*r));
+        atl_cursor_init(&r->cursor, pool, thirds_advance, thirds_advance_to);
+        r->cursor.score = thirds_score;
+        r->cursor.rewind = thirds_rewind;
+        r->end = NUM_DOCS;
+        return &r->cursor;
+    }
+    return atl_cursor_init_empty(pool);
+}
+
+/* the score of term i for id or -1 if id doesn't contain it */
+static
+double term_score(uint32_t i, uint32_t id) {
+    if(i == NUM_TERMS)
+        return (id && id % 3 == 0) ? 1.5 : -1.0;
+    for( uint32_t j=0; j<num_ids[i]; j++ ) {
+        if(ids[i][j] != id)
+            continue;
+        double n = params.num_docs, df = num_ids[i], tf = tfs[i][j];
+        double idf = log(1.0 + (n - df + 0.5) / (df + 0.5));
+        double norm = params.k1 * (1.0 - params.b +
+                                   params.b * doc_lens[id] / params.avg_doc_len);
+        return idf * tf * (params.k1 + 1.0) / (tf + norm);
+    }
+    return -1.0;
+}
+
+static const char *expressions[] = {
+    "a", "a b", "a OR b", "a NOT b", "(a OR b) c", "(a OR b OR c) NOT (b c)", "x", "a OR x",
+    "(x OR b) NOT c"
+};
+
+/* the score expression e gives id or -1 if it doesn't match */
+static
+double expected_score(uint32_t e, uint32_t id) {
+    double a = term_score(0, id), b = term_score(1, id), c = term_score(2, id);
+    double x = term_score(NUM_TERMS, id);
+    double ab = (a >= 0 ? a : 0) + (b >= 0 ? b : 0);
+    switch(e) {
+    case 0:
+        return a;
+    case 1:
+        return (a >= 0 && b >= 0) ? a + b : -1;
+    case 2:
+        return (a >= 0 || b >= 0) ? ab : -1;
+    case 3:
+        return b < 0 ? a : -1;
+    case 4:
+        return ((a >= 0 || b >= 0) && c >= 0) ? ab + c : -1;
+    case 5:
+        if(a < 0 && b < 0 && c < 0)
+            return -1;
+        if(b >= 0 && c >= 0)
+            return -1;
+        return ab + (c >= 0 ? c : 0);
+    case 6:
+        return x;
+    case 7:
+        return (a >= 0 || x >= 0) ? (a >= 0 ? a : 0) + (x >= 0 ? x : 0) : -1;
+    default:
+        if((x < 0 && b < 0) || c >= 0)
+            return -1;
+        return (x >= 0 ? x : 0) + (b >= 0 ? b : 0);
+    }
+}
+
+/* returns the number of ids whose match or score is wrong, starting with c->id if started */
+static
+uint32_t check_scores(atl_cursor_t *c, uint32_t e, uint32_t from, bool started) {
+    uint32_t bad = 0;
+    uint32_t id = from;
+    while(started || c->advance(c)) {
+        started = false;
+        for( ; id < c->id; id++ )
+            if(expected_score(e, id) >= 0)
+                bad++;
+        if(fabs(atl_cursor_score(c) - expected_score(e, id)) > 1e-9)
+            bad++;
+        id++;
+    }
+    for( ; id < NUM_DOCS; id++ )
+        if(expected_score(e, id) >= 0)
+            bad++;
+    return bad;
+}
+
+int main(void) {
+    uint64_t total_len = 0;
+    for( uint32_t id=0; id<NUM_DOCS; id++ ) {
+        doc_lens[id] = 5 + next_rand() % 50;
+        total_len += doc_lens[id];
+    }
+    for( uint32_t i=0; i<NUM_TERMS; i++ ) {
+        for( uint32_t id=1; id<NUM_DOCS; id++ ) {
+            if(next_rand() % (i + 2) == 0) {
+                tfs[i][num_ids[i]] = 1 + next_rand() % 6;
+                ids[i][num_ids[i]++] = id;
+            }
+        }
+    }
+    params.k1 = 1.2;
+    params.b = 0.75;
+    params.avg_doc_len = (double)total_len / NUM_DOCS;
+    params.num_docs = NUM_DOCS;
+    params.doc_lens = doc_lens;
+
+    aml_pool_t *pool = aml_pool_init(4096);
+    int failures = 0;
+    uint32_t num_expressions = sizeof(expressions) / sizeof(expressions[0]);
+    for( uint32_t e=0; e<num_expressions; e++ ) {
+        aml_pool_clear(pool);
+        atl_token_t *t = atl_token_parse_expression(pool, expressions[e], NULL, NULL);
+        atl_cursor_t *c = atl_cursor_open(pool, leaf, t, NULL);
+        uint32_t bad = check_scores(c, e, 0, false);
+
+        /* scores after advance_to (which skips the ids before the target) */
+        for( uint32_t k=0; k<4; k++ ) {
+            uint32_t target = 1 + next_rand() % (NUM_DOCS - 1);
+            if(!atl_cursor_rewind(c))
+                bad++;
+            if(c->advance_to(c, target))
+                bad += check_scores(c, e, target, true);
+            else {
+                for( uint32_t id=target; id<NUM_DOCS; id++ )
+                    if(expected_score(e, id) >= 0)
+                        bad++;
+            }
+        }
+        if(!atl_cursor_rewind(c))
+            bad++;
+        bad += check_scores(c, e, 0, false);
+        if(bad) {
+            printf("FAIL %s: %u ids matched or scored wrongly\n", expressions[e], bad);
+            failures++;
+        }
+    }
+
+    /* cursors without a score callback score 0 */
+    atl_cursor_t *r = atl_cursor_range(pool, 1, 5);
+    if(!r->advance(r) || atl_cursor_score(r) != 0.0) {
+        printf("FAIL range scored %f\n", atl_cursor_score(r));
+        failures++;
+    }
+
+    aml_pool_destroy(pool);
+    printf("%s\n", failures ? "FAILED" : "passed");
+    return failures ? 1 : 0;
+}
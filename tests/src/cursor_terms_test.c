@@ -0,0 +1,230 @@
+// SPDX-FileCopyrightText:  2023 Andy Curtis <contactandyc@gmail.com>
+// SPDX-License-Identifier: Apache-2.0
+#include "a-tokenizer-library/atl_cursor_terms.h"
+
+#include <fnmatch.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+    Wildcard patterns are expanded from a term dictionary and must return the union of the
+    postings of every term fnmatch accepts.  The or terms expand to at most 8 terms (an OR
+    cursor), the bm terms to more with dense ids (a bitmap) and the ar terms to more with
+    sparse ids (a sorted array, where terms share ids).  Each expansion is checked after
+    advancing, advance_to, a rewind and atl_cursor_count.
+*/
+
+#define NUM_TERMS 50
+#define MAX_IDS 512
+
+static char terms[NUM_TERMS][8];
+static uint32_t postings[NUM_TERMS][MAX_IDS];
+static uint32_t num_postings[NUM_TERMS];
+
+static uint32_t seed = 1;
+
+static
+uint32_t next_rand(void) {
+    seed = seed * 1103515245 + 12345;
+    return (seed >> 16) & 0x7FFF;
+}
+
+static
+int compare_ids(const void *p1, const void *p2) {
+    uint32_t a = *(const uint32_t *)p1;
+    uint32_t b = *(const uint32_t *)p2;
+    return a < b ? -1 : a > b ? 1 : 0;
+}
+
+/* the sorted union of the postings of the terms matching pattern, with the number of terms
+   with postings which matched in num_matches and their total number of ids in total */
+static
+uint32_t *expected_ids(const char *pattern, uint32_t *num_ids, uint32_t *num_matches,
+                       uint32_t *total) {
+    uint32_t *ids = (uint32_t *)malloc(sizeof(uint32_t) * (NUM_TERMS * MAX_IDS + 1));
+    uint32_t n = 0;
+    *num_matches = 0;
+    for( uint32_t i=0; i<NUM_TERMS; i++ ) {
+        if(!num_postings[i] || fnmatch(pattern, terms[i], 0))
+            continue;
+        (*num_matches)++;
+        memcpy(ids + n, postings[i], sizeof(uint32_t) * num_postings[i]);
+        n += num_postings[i];
+    }
+    *total = n;
+    qsort(ids, n, sizeof(uint32_t), compare_ids);
+    *num_ids = 0;
+    for( uint32_t i=0; i<n; i++ )
+        if(!*num_ids || ids[i] != ids[*num_ids-1])
+            ids[(*num_ids)++] = ids[i];
+    return ids;
+}
+
+/* returns the number of ids c returns which differ from ids[from, num_ids) */
+static
+uint32_t check_ids(atl_cursor_t *c, const uint32_t *ids, uint32_t num_ids, uint32_t from) {
+    uint32_t bad = 0;
+    uint32_t i = from;
+    while(c->advance(c)) {
+        if(i >= num_ids || c->id != ids[i])
+            bad++;
+        i++;
+    }
+    return bad + (i < num_ids ? num_ids - i : 0);
+}
+
+static const char *patterns[] = {
+    "or3", "or9", "ar", "or?", "or*", "o*", "or*7", "b*0", "?r1", "bm*", "bm1?", "bm?5",
+    "ar*", "ar0?", "a*", "*", "*9", "*z*", "zz*", "bm1*"
+};
+
+int main(void) {
+    uint32_t nt = 0;
+    /* 8 or terms with ids below 2000 */
+    for( uint32_t i=0; i<8; i++, nt++ ) {
+        sprintf(terms[nt], "or%u", i);
+        for( uint32_t id=1; id<2000 && num_postings[nt] < MAX_IDS; id++ )
+            if(next_rand() % 8 == 0)
+                postings[nt][num_postings[nt]++] = id;
+    }
+    /* 20 bm terms covering about a quarter of the ids below 1000 and an empty one */
+    for( uint32_t i=0; i<20; i++, nt++ ) {
+        sprintf(terms[nt], "bm%02u", i);
+        for( uint32_t id=1; id<1000 && num_postings[nt] < MAX_IDS; id++ )
+            if(next_rand() % 4 == 0)
+                postings[nt][num_postings[nt]++] = id;
+    }
+    strcpy(terms[nt++], "bmz");
+    /* 20 ar terms with a few ids spread up to 4000000000, all sharing 77777 */
+    for( uint32_t i=0; i<20; i++, nt++ ) {
+        sprintf(terms[nt], "ar%02u", i);
+        postings[nt][num_postings[nt]++] = 1 + next_rand() % 1000;
+        postings[nt][num_postings[nt]++] = 77777;
+        uint32_t id = 100000;
+        for( uint32_t j=0; j<5; j++ ) {
+            id += 1 + next_rand() * 15000u;
+            postings[nt][num_postings[nt]++] = id;
+        }
+        postings[nt][num_postings[nt]++] = 4000000000u - i;
+    }
+    strcpy(terms[nt++], "zz");
+
+    atl_cursor_terms_t *h = atl_cursor_terms_init();
+    /* added out of order, freeze sorts them */
+    for( uint32_t i=nt; i>0; i-- )
+        atl_cursor_terms_add(h, terms[i-1], postings[i-1], num_postings[i-1]);
+    atl_cursor_terms_freeze(h);
+
+    int failures = 0;
+    uint32_t index, start, end;
+    if(atl_cursor_terms_size(h) != nt || strcmp(atl_cursor_terms_term(h, 0), "ar00") ||
+       !atl_cursor_terms_find(h, "bm07", &index) || atl_cursor_terms_find(h, "bm7", &index) ||
+       atl_cursor_terms_prefix(h, "bm1", 3, &start, &end) != 10 ||
+       atl_cursor_terms_prefix(h, "c", 1, &start, &end) != 0) {
+        printf("FAIL dictionary\n");
+        failures++;
+    }
+    if(atl_cursor_terms_find(h, "bm07", &index)) {
+        uint32_t num_ids;
+        const uint32_t *ids = atl_cursor_terms_ids(h, index, &num_ids);
+        if(strcmp(atl_cursor_terms_term(h, index), "bm07") || num_ids != num_postings[15] ||
+           memcmp(ids, postings[15], sizeof(uint32_t) * num_ids)) {
+            printf("FAIL bm07 postings\n");
+            failures++;
+        }
+    }
+
+    aml_pool_t *pool = aml_pool_init(4096);
+    uint32_t num_patterns = sizeof(patterns) / sizeof(patterns[0]);
+    /* the number of patterns expanded with an OR cursor, a bitmap and an array */
+    uint32_t paths[3] = { 0, 0, 0 };
+    for( uint32_t p=0; p<num_patterns; p++ ) {
+        aml_pool_clear(pool);
+        uint32_t num_ids, num_matches, total;
+        uint32_t *ids = expected_ids(patterns[p], &num_ids, &num_matches, &total);
+        atl_cursor_t *c = atl_cursor_terms_open(pool, h, patterns[p]);
+        bool is_or = num_matches > 1 && num_matches <= 8;
+        uint32_t bad = (c->type == OR_CURSOR) != is_or;
+        if(is_or)
+            paths[0]++;
+        else if(num_matches > 8) {
+            /* a bitmap when its words take no more space than the ids */
+            uint64_t num_words = ((uint64_t)ids[num_ids-1] + 64) >> 6;
+            paths[num_words * sizeof(uint64_t) <= total * sizeof(uint32_t) ? 1 : 2]++;
+        }
+
+        bad += check_ids(c, ids, num_ids, 0);
+        for( uint32_t k=0; k<8 && num_ids; k++ ) {
+            /* a target on an id, just past it or before the first */
+            uint32_t i = next_rand() % num_ids;
+            uint32_t target = ids[i] + (k & 1);
+            if(k == 7)
+                target = ids[0] > 1 ? ids[0] - 1 : 1;
+            if(!atl_cursor_rewind(c))
+                bad++;
+            uint32_t from = 0;
+            while(from < num_ids && ids[from] < target)
+                from++;
+            bool r = c->advance_to(c, target);
+            if(r != (from < num_ids) || (r && c->id != ids[from]))
+                bad++;
+            else if(r)
+                bad += check_ids(c, ids, num_ids, from + 1);
+        }
+        if(!atl_cursor_rewind(c) || atl_cursor_count(c) != num_ids)
+            bad++;
+        if(!atl_cursor_rewind(c))
+            bad++;
+        bad += check_ids(c, ids, num_ids, 0);
+        if(bad) {
+            printf("FAIL %s (%u terms, %u ids): %u wrong\n", patterns[p], num_matches, num_ids,
+                   bad);
+            failures++;
+        }
+        free(ids);
+    }
+
+    if(!paths[0] || !paths[1] || !paths[2]) {
+        printf("FAIL expansions: %u OR, %u bitmap, %u array\n", paths[0], paths[1], paths[2]);
+        failures++;
+    }
+
+    /* wildcards within an expression through atl_cursor_terms_cb (the parser splits '?' into
+       its own token, so only '*' is used) */
+    const char *expressions[][3] = {
+        { "bm1* or*", "bm1*", "or*" }, { "or1 OR ar0*", "or1", "ar0*" },
+        { "bm0* OR zz*", "bm0*", "zz*" }
+    };
+    for( uint32_t e=0; e<3; e++ ) {
+        aml_pool_clear(pool);
+        uint32_t na, nb, num_matches, total;
+        uint32_t *a = expected_ids(expressions[e][1], &na, &num_matches, &total);
+        uint32_t *b = expected_ids(expressions[e][2], &nb, &num_matches, &total);
+        uint32_t *ids = (uint32_t *)malloc(sizeof(uint32_t) * (na + nb + 1));
+        uint32_t num_ids = 0, i = 0, j = 0;
+        while(i < na || j < nb) {
+            uint32_t id = j >= nb || (i < na && a[i] < b[j]) ? a[i] : b[j];
+            bool in_a = i < na && a[i] == id, in_b = j < nb && b[j] == id;
+            if(e ? (in_a || in_b) : (in_a && in_b))
+                ids[num_ids++] = id;
+            i += in_a;
+            j += in_b;
+        }
+        atl_token_t *t = atl_token_parse_expression(pool, expressions[e][0], NULL, NULL);
+        atl_cursor_t *c = atl_cursor_open(pool, atl_cursor_terms_cb, t, h);
+        uint32_t bad = check_ids(c, ids, num_ids, 0);
+        if(bad) {
+            printf("FAIL %s: %u wrong\n", expressions[e][0], bad);
+            failures++;
+        }
+        free(a);
+        free(b);
+        free(ids);
+    }
+
+    aml_pool_destroy(pool);
+    atl_cursor_terms_destroy(h);
+    printf("%s\n", failures ? "FAILED" : "passed");
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,365 @@
+// SPDX-FileCopyrightText:  2023 Andy Curtis <contactandyc@gmail.com>
+// SPDX-License-Identifier: Apache-2.0
+#include "a-tokenizer-library/atl_token.h"
+#include "a-memory-library/aml_buffer.h"
+
+#include <stdio.h>
+#include <string.h>
+
+/*
+    The trees built by atl_token_parse_expression are compared against the ones the parser
+    produced before nesting was tracked with counters and the OR/NOT passes were made linear
+    (written as type:token[attrs]{attr}(children)).  Large OR and NOT lists and deep nesting
+    are checked for their shape and links.  Parsing with ATL_TOKEN_PARSE_SPANS (with a
+    callback which shortens parameters) must build the same trees as parsing with copies, and
+    atl_token_clone must copy long lists, attr chains and dictionary trees.
+*/
+
+typedef struct {
+    const char *expression;
+    const char *expected;
+} parse_test_t;
+
+static
+void tree_string(aml_buffer_t *bh, atl_token_t *t) {
+    for( ; t; t=t->next ) {
+        aml_buffer_appendf(bh, "%d:%s", t->type, t->token);
+        if(t->attr_type || t->no_params)
+            aml_buffer_appendf(bh, "/%d%s", t->attr_type, t->no_params ? "n" : "");
+        for( uint32_t i=0; i<t->num_attrs; i++ )
+            aml_buffer_appendf(bh, "%c%s", i ? ',' : '[', t->attrs[i]);
+        if(t->num_attrs)
+            aml_buffer_appendc(bh, ']');
+        if(t->attr) {
+            aml_buffer_appendc(bh, '{');
+            tree_string(bh, t->attr);
+            aml_buffer_appendc(bh, '}');
+        }
+        if(t->child) {
+            aml_buffer_appendc(bh, '(');
+            tree_string(bh, t->child);
+            aml_buffer_appendc(bh, ')');
+        }
+        if(t->next)
+            aml_buffer_appendc(bh, ' ');
+    }
+}
+
+/* true if every prev link agrees with the next links */
+static
+bool links_ok(atl_token_t *t) {
+    atl_token_t *prev = NULL;
+    for( ; t; t=t->next ) {
+        if(t->prev != prev || !links_ok(t->child) || !links_ok(t->attr))
+            return false;
+        prev = t;
+    }
+    return true;
+}
+
+static
+uint32_t num_children(atl_token_t *t) {
+    uint32_t n = 0;
+    for( atl_token_t *c=t->child; c; c=c->next )
+        n++;
+    return n;
+}
+
+/* true if no token is read only and every attrs array is NULL terminated */
+static
+bool clone_ok(atl_token_t *t) {
+    for( ; t; t=t->next ) {
+        if(t->read_only || (t->num_attrs && t->attrs[t->num_attrs]) ||
+           !clone_ok(t->child) || !clone_ok(t->attr))
+            return false;
+    }
+    return true;
+}
+
+/* true if any token of t is read only */
+static
+bool has_read_only(atl_token_t *t) {
+    for( ; t; t=t->next )
+        if(t->read_only || has_read_only(t->child) || has_read_only(t->attr))
+            return true;
+    return false;
+}
+
+/* true if c is a copy of t which shares no tokens or strings with it */
+static
+bool is_copy(atl_token_t *c, atl_token_t *t) {
+    for( ; t && c; t=t->next, c=c->next ) {
+        if(c == t || c->token == t->token || (t->num_attrs && c->attrs == t->attrs) ||
+           !is_copy(c->child, t->child) || !is_copy(c->attr, t->attr))
+            return false;
+    }
+    return !t && !c;
+}
+
+/* compares the clone of t with t, returning false (after printing why) if they differ */
+static
+bool check_clone(aml_pool_t *pool, aml_buffer_t *bh, const char *what, atl_token_t *t) {
+    atl_token_t *c = atl_token_clone(pool, t);
+    aml_buffer_clear(bh);
+    tree_string(bh, t);
+    size_t len = aml_buffer_length(bh);
+    tree_string(bh, c);
+    char *s = aml_buffer_data(bh);
+    if(aml_buffer_length(bh) != len * 2 || memcmp(s, s + len, len)) {
+        printf("FAIL clone of %s\n  expected %.*s\n  got      %s\n", what, (int)len, s,
+               s + len);
+        return false;
+    }
+    if(!links_ok(c) || !clone_ok(c) || !is_copy(c, t)) {
+        printf("FAIL clone of %s is linked, read only or shared\n", what);
+        return false;
+    }
+    return true;
+}
+
+static const char *source = NULL;
+static uint32_t span_errors = 0;
+
+/* true if the span is within source (or the single space a run of whitespace becomes) */
+static
+bool in_source(const char *text, size_t len) {
+    if(len == 1 && text[0] == ' ')
+        return true;
+    return text >= source && text + len <= source + strlen(source);
+}
+
+/* a parameter loses its colon and one starting with @ becomes an attr of the next token,
+   using the spans of the expression */
+static
+atl_token_cb_t span_cb(void *arg, atl_token_cb_data_t *d) {
+    (void)arg;
+    if(d->param || d->attrs || !in_source(d->text, d->len))
+        span_errors++;
+    for( uint32_t i=0; i<d->num_attrs; i++ )
+        if(!d->attr_spans || !in_source(d->attr_spans[i].text, d->attr_spans[i].len))
+            span_errors++;
+    if(d->len < 2 || d->text[d->len-1] != ':')
+        return NORMAL;
+    d->len--;
+    return d->text[0] == '@' ? NEXT : NORMAL;
+}
+
+/* the same as span_cb using the copies */
+static
+atl_token_cb_t copy_cb(void *arg, atl_token_cb_data_t *d) {
+    (void)arg;
+    size_t len = strlen(d->param);
+    if(d->text != d->param || d->len != len || d->attr_spans)
+        span_errors++;
+    if(len < 2 || d->param[len-1] != ':')
+        return NORMAL;
+    d->param[len-1] = 0;
+    return d->param[0] == '@' ? NEXT : NORMAL;
+}
+
+/* "t0 <op> t1 ... <op> t<n-1>" */
+static
+char *list_expression(aml_pool_t *pool, const char *first, const char *op, uint32_t n) {
+    aml_buffer_t *bh = aml_buffer_pool_init(pool, n * 16);
+    aml_buffer_appends(bh, first);
+    for( uint32_t i=0; i<n; i++ )
+        aml_buffer_appendf(bh, " %s t%u", op, i);
+    return aml_buffer_data(bh);
+}
+
+int main(void) {
+    parse_test_t tests[] = {
+        { "a b c",
+          "90:((0:a 0:b 0:c)" },
+        { "a OR b",
+          "60:or(0:a 0:b)" },
+        { "a OR b OR c d",
+          "60:or(0:a 0:b 90:((0:c 0:d))" },
+        { "a b OR c d",
+          "60:or(90:((0:a 0:b) 90:((0:c 0:d))" },
+        { "NOT a",
+          "90:((0:NOT 0:a)" },
+        { "a NOT b",
+          "65:not(0:b 0:a)" },
+        { "a -b c",
+          "90:((0:a 20:- 0:b 0:c)" },
+        { "-a b",
+          "90:((20:- 0:a 0:b)" },
+        { "(a b) OR (c d)",
+          "60:or(90:((0:a 0:b) 90:((0:c 0:d))" },
+        { "((a OR b) c) NOT (d OR e)",
+          "65:not(90:((60:or(0:d 0:e)) 90:((90:((60:or(0:a 0:b)) 0:c))" },
+        { "\"a b c\"",
+          "94:\"(0:a 0:b 0:c)" },
+        { "\"a (b OR c)\" d",
+          "90:((94:\"(0:a 150:( 0:b 0:OR 0:c 150:)) 0:d)" },
+        { "'a b' c",
+          "90:((0:a 0:b 0:c)" },
+        { "title:hello",
+          "0:title:[hello]" },
+        { "title:[a,b] c",
+          "90:((0:title:[a,b] 0:c)" },
+        { "title:(a OR b) c",
+          "60:or(0:title:[(a] 90:((0:b 0:c))" },
+        { "price:>10",
+          "0:price:[>10]" },
+        { "price:>=10 price:<20",
+          "90:((0:price:[>=10] 0:price:[<20])" },
+        { "price:[10..20]",
+          "0:price:[10..20]" },
+        { "a:b:c",
+          "0:a:[b:c]" },
+        { "\"unterminated quote",
+          "94:\"(0:unterminated 0:quote)" },
+        { "(unclosed paren",
+          "90:((0:unclosed 0:paren)" },
+        { "closed paren) a",
+          "90:((0:closed 0:paren 0:a)" },
+        { "a OR OR b",
+          "60:or(0:a 0:b)" },
+        { "OR a",
+          "90:((0:OR 0:a)" },
+        { "a OR",
+          "0:a" },
+        { "NOT NOT a",
+          "65:not(0:NOT 0:a)" },
+        { "a (b (c (d (e))))",
+          "90:((0:a 90:((0:b 90:((0:c 90:((0:d 90:((0:e)))))" },
+        { "{a b} [c d]",
+          "90:((91:{(0:a 0:b) 92:[(0:c 0:d))" },
+        { "a, b; c",
+          "90:((0:a 0:b 150:; 0:c)" },
+        { "x:y OR \"z w\" NOT (q -r)",
+          "60:or(0:x:[y] 90:((65:not(90:((0:q 20:- 0:r) 94:\"(0:z 0:w))))" },
+        { "a AND b",
+          "90:((0:a 0:AND 0:b)" },
+        { "hello-world foo_bar",
+          "90:((0:hello 20:- 0:world 0:foo_bar)" },
+        { "a ( ) b",
+          "90:((0:a 90:((110:) 0:b)" },
+        { "\"\" a",
+          "94:\"(0:a)" },
+        { "a OR NOT b",
+          "60:or(0:a 90:((0:NOT 0:b))" },
+        { "(a OR b) (c OR d) NOT e NOT f",
+          "65:not(60:or(0:e 0:f) 90:((90:((60:or(0:a 0:b)) 90:((60:or(0:c 0:d))))" },
+        { "a NOT b NOT c NOT d",
+          "65:not(60:or(0:b 0:c 0:d) 0:a)" },
+        { "a OR b OR c NOT d NOT e",
+          "60:or(0:a 0:b 90:((65:not(60:or(0:d 0:e) 0:c)))" },
+        { "((((a))))",
+          "90:((90:((90:((90:((0:a))))" },
+    };
+    uint32_t num_tests = sizeof(tests) / sizeof(tests[0]);
+    int failures = 0;
+
+    aml_pool_t *pool = aml_pool_init(16384);
+    aml_buffer_t *bh = aml_buffer_init(1024);
+    for( uint32_t i=0; i<num_tests; i++ ) {
+        aml_pool_clear(pool);
+        aml_buffer_clear(bh);
+        atl_token_t *t = atl_token_parse_expression(pool, tests[i].expression, NULL, NULL);
+        tree_string(bh, t);
+        if(strcmp(aml_buffer_data(bh), tests[i].expected)) {
+            printf("FAIL %s\n  expected %s\n  got      %s\n", tests[i].expression,
+                   tests[i].expected, aml_buffer_data(bh));
+            failures++;
+        }
+    }
+
+    /* spans give the same trees as copies */
+    const char *span_tests[][2] = {
+        { "title:hello", "0:title[hello]" },
+        { "title:[a,b] c", "90:((0:title[a,b] 0:c)" },
+        { "price:>=10 x", "90:((0:price[>=10] 0:x)" },
+        { "a:b:c", "0:a[b:c]" },
+        { "@x:1 @y:2 a:b OR c", "60:or(0:a[b]{0:@y/2[2] 0:@x/2[1]} 0:c)" },
+        { "\"p @q:3 r\" s:", "90:((94:\"(0:p 0:r{0:@q/2[3]}) 0:s)" },
+        { "(t:[u..v] NOT w) @z:4", "90:((65:not(0:w 0:t[u..v]))" }
+    };
+    for( uint32_t i=0; i<sizeof(span_tests) / sizeof(span_tests[0]); i++ ) {
+        aml_pool_clear(pool);
+        aml_buffer_clear(bh);
+        source = span_tests[i][0];
+        span_errors = 0;
+        atl_token_t *t = atl_token_parse_expression_ex(pool, source, span_cb, NULL,
+                                                       ATL_TOKEN_PARSE_SPANS);
+        tree_string(bh, t);
+        char *spans = aml_pool_strdup(pool, aml_buffer_data(bh));
+        aml_buffer_clear(bh);
+        tree_string(bh, atl_token_parse_expression(pool, source, copy_cb, NULL));
+        if(span_errors || strcmp(spans, span_tests[i][1]) ||
+           strcmp(aml_buffer_data(bh), span_tests[i][1])) {
+            printf("FAIL spans of %s (%u bad spans)\n  expected %s\n  spans    %s\n"
+                   "  copies   %s\n", source, span_errors, span_tests[i][1], spans,
+                   (char *)aml_buffer_data(bh));
+            failures++;
+        }
+        if(t && !check_clone(pool, bh, source, t))
+            failures++;
+    }
+
+    /* a clone of a tree shared with a dictionary is not read only */
+    atl_token_dict_t *dict = atl_token_dict_init();
+    atl_token_dict_add(dict, "x normal (a OR b OR (c d)) NOT e");
+    atl_token_dict_add(dict, "title next x");
+    aml_pool_clear(pool);
+    atl_token_t *t = atl_token_parse_expression(pool, "title f:g x OR y", atl_token_dict_cb,
+                                                dict);
+    if(!has_read_only(t) || !check_clone(pool, bh, "a dictionary tree", t))
+        failures++;
+    atl_token_dict_destroy(dict);
+
+    const uint32_t n = 5000;
+
+    /* a synonym expansion sized OR list */
+    aml_pool_clear(pool);
+    char *expression = list_expression(pool, "a", "OR", n);
+    t = atl_token_parse_expression(pool, expression, NULL, NULL);
+    if(!t || t->type != ATL_TOKEN_OR || num_children(t) != n+1 || !links_ok(t)) {
+        printf("FAIL OR of %u terms\n", n+1);
+        failures++;
+    }
+    else if(!check_clone(pool, bh, "an OR of many terms", t))
+        failures++;
+
+    /* a NOT list becomes NOT(OR(the negated terms), a) */
+    aml_pool_clear(pool);
+    expression = list_expression(pool, "a", "NOT", n);
+    t = atl_token_parse_expression(pool, expression, NULL, NULL);
+    if(!t || t->type != ATL_TOKEN_NOT || !t->child || t->child->type != ATL_TOKEN_OR ||
+       num_children(t->child) != n || !t->child->next || strcmp(t->child->next->token, "a") ||
+       !links_ok(t)) {
+        printf("FAIL NOT of %u terms\n", n);
+        failures++;
+    }
+
+    /* deep nesting and a long phrase */
+    aml_pool_clear(pool);
+    aml_buffer_clear(bh);
+    for( uint32_t i=0; i<n; i++ )
+        aml_buffer_appendc(bh, '(');
+    aml_buffer_appends(bh, "a \"");
+    for( uint32_t i=0; i<n; i++ )
+        aml_buffer_appendf(bh, "p%u ", i);
+    aml_buffer_appendc(bh, '"');
+    for( uint32_t i=0; i<n; i++ )
+        aml_buffer_appendc(bh, ')');
+    t = atl_token_parse_expression(pool, aml_buffer_data(bh), NULL, NULL);
+    uint32_t depth = 0;
+    while(t && t->type == ATL_TOKEN_OPEN_PAREN && t->child &&
+          t->child->type == ATL_TOKEN_OPEN_PAREN) {
+        t = t->child;
+        depth++;
+    }
+    if(depth != n-1 || !t->child || !t->child->next || t->child->next->type != ATL_TOKEN_DQUOTE ||
+       num_children(t->child->next) != n) {
+        printf("FAIL %u nested groups\n", n);
+        failures++;
+    }
+
+    aml_buffer_destroy(bh);
+    aml_pool_destroy(pool);
+    printf("%s\n", failures ? "FAILED" : "passed");
+    return failures ? 1 : 0;
+}
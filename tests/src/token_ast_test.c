@@ -0,0 +1,230 @@
+// SPDX-FileCopyrightText:  2023 Andy Curtis <contactandyc@gmail.com>
+// SPDX-License-Identifier: Apache-2.0
+#include "a-tokenizer-library/atl_cursor.h"
+#include "a-tokenizer-library/atl_token_ast.h"
+#include "a-memory-library/aml_buffer.h"
+
+#include <stdio.h>
+#include <string.h>
+
+/*
+    Random expressions (with and without a dictionary and number parsing) are converted to an
+    ast, encoded, decoded and converted back to a tree which must match the parsed one.  The
+    encoding must reject truncated buffers and a changed magic, version or byte order, and any
+    other corruption must either be rejected or decode to a walkable tree.  Cursors opened
+    from the tree and from the ast must return the same ids, and atl_cursor_count must agree
+    with advancing.
+*/
+
+static const char *words[] = {
+    "a", "b", "c", "d", "e", "f", "cat", "dog", "title", "z", "x:y", "title:[a,b]", "title:c",
+    "f:", "12", "3.5", "1e3", "-", "OR", "OR", "NOT", "(", ")", "\"", "[", "]"
+};
+
+#define NUM_WORDS (sizeof(words) / sizeof(words[0]))
+#define NUM_IDS 64
+
+static const char *dict_lines[] = {
+    "cat normal feline",
+    "dog normal \"big dog\"",
+    "title next x",
+    "z global q",
+    "f: normal,no_params f",
+    "x normal (a OR b OR (c d)) NOT e",
+    "b normal (p OR q) r"
+};
+
+/* "title:" attaches itself (with its attrs) to the token which follows it */
+static
+atl_token_cb_t attr_cb(void *arg, atl_token_cb_data_t *d) {
+    if(d->len == 6 && !strncmp(d->text, "title:", 6))
+        return NEXT;
+    return atl_token_dict_cb(arg, d);
+}
+
+static uint32_t postings[26][NUM_IDS];
+static uint32_t num_postings[26];
+
+static uint32_t seed = 1;
+
+static
+uint32_t next_rand(void) {
+    seed = seed * 1103515245 + 12345;
+    return (seed >> 16) & 0x7FFF;
+}
+
+/* single letter tokens have postings, everything else is empty */
+static
+atl_cursor_t *leaf(aml_pool_t *pool, atl_token_t *t, void *arg) {
+    (void)arg;
+    if(t->token[0] >= 'a' && t->token[0] <= 'z' && !t->token[1]) {
+        uint32_t i = t->token[0] - 'a';
+        return atl_cursor_array(pool, postings[i], num_postings[i]);
+    }
+    return atl_cursor_init_empty(pool);
+}
+
+static
+void tree_string(aml_buffer_t *bh, atl_token_t *t) {
+    for( ; t; t=t->next ) {
+        aml_buffer_appendf(bh, "%d/%d%s@%zu+%zu:%s", t->type, t->attr_type,
+                           t->no_params ? "n" : "", t->pos, t->len, t->token);
+        if(t->type == ATL_TOKEN_NUMBER)
+            aml_buffer_appendf(bh, "=%d:%llx", t->is_double, (unsigned long long)t->value.i);
+        for( uint32_t i=0; i<t->num_attrs; i++ )
+            aml_buffer_appendf(bh, "%c%s", i ? ',' : '[', t->attrs[i]);
+        if(t->num_attrs)
+            aml_buffer_appendc(bh, ']');
+        /* attrs arrays are NULL terminated */
+        if(t->attrs && t->attrs[t->num_attrs])
+            aml_buffer_appendc(bh, '!');
+        if(t->attr) {
+            aml_buffer_appendc(bh, '{');
+            tree_string(bh, t->attr);
+            aml_buffer_appendc(bh, '}');
+        }
+        if(t->child) {
+            aml_buffer_appendc(bh, '(');
+            tree_string(bh, t->child);
+            aml_buffer_appendc(bh, ')');
+        }
+        if(t->next)
+            aml_buffer_appendc(bh, ' ');
+    }
+}
+
+static
+char *random_expression(aml_pool_t *pool) {
+    aml_buffer_t *bh = aml_buffer_pool_init(pool, 256);
+    uint32_t n = 1 + next_rand() % 12;
+    for( uint32_t i=0; i<n; i++ ) {
+        if(i)
+            aml_buffer_appendc(bh, ' ');
+        aml_buffer_appends(bh, words[next_rand() % NUM_WORDS]);
+    }
+    return aml_buffer_data(bh);
+}
+
+/* returns the number of ids c2 returned or -1 if they differ from c1 */
+static
+int compare_cursors(atl_cursor_t *c1, atl_cursor_t *c2) {
+    int n = 0;
+    while(true) {
+        bool a = c1->advance(c1);
+        bool b = c2->advance(c2);
+        if(a != b || (a && c1->id != c2->id))
+            return -1;
+        if(!a)
+            return n;
+        n++;
+    }
+}
+
+int main(void) {
+    for( uint32_t i=0; i<26; i++ )
+        for( uint32_t id=1; id<NUM_IDS; id++ )
+            if(next_rand() % 3 == 0)
+                postings[i][num_postings[i]++] = id;
+
+    atl_token_dict_t *dict = atl_token_dict_init();
+    for( uint32_t i=0; i<sizeof(dict_lines) / sizeof(dict_lines[0]); i++ )
+        atl_token_dict_add(dict, dict_lines[i]);
+
+    aml_pool_t *pool = aml_pool_init(16384);
+    aml_buffer_t *b1 = aml_buffer_init(1024);
+    aml_buffer_t *b2 = aml_buffer_init(1024);
+    int failures = 0;
+    uint32_t num_attr_chains = 0, num_numbers = 0, num_corrupt_decoded = 0;
+    for( uint32_t i=0; i<4000; i++ ) {
+        aml_pool_clear(pool);
+        const char *expression = random_expression(pool);
+        atl_token_t *t = atl_token_parse_expression_ex(pool, expression,
+                                                       (i & 1) ? attr_cb : NULL, dict,
+                                                       (i & 2) ? ATL_TOKEN_PARSE_NUMBERS : 0);
+        if(!t)
+            continue;
+        aml_buffer_clear(b1);
+        tree_string(b1, t);
+        if(strchr(aml_buffer_data(b1), '{'))
+            num_attr_chains++;
+        if(strchr(aml_buffer_data(b1), '='))
+            num_numbers++;
+
+        atl_token_ast_t *ast = atl_token_ast_init(pool, t);
+        size_t len = atl_token_ast_encoded_size(ast);
+        char *buf = (char *)aml_pool_alloc(pool, len);
+        atl_token_ast_t decoded;
+        if(atl_token_ast_encode(buf, ast) != len || !atl_token_ast_decode(&decoded, buf, len)) {
+            printf("FAIL encode/decode %s\n", expression);
+            failures++;
+            continue;
+        }
+        aml_buffer_clear(b2);
+        tree_string(b2, atl_token_ast_tree(pool, &decoded));
+        if(strcmp(aml_buffer_data(b1), aml_buffer_data(b2))) {
+            printf("FAIL round trip %s\n  %s\n  %s\n", expression, aml_buffer_data(b1),
+                   aml_buffer_data(b2));
+            failures++;
+        }
+        aml_buffer_clear(b2);
+        tree_string(b2, atl_token_ast_token(pool, &decoded, 0));
+        if(strchr(aml_buffer_data(b2), '!')) {
+            printf("FAIL atl_token_ast_token %s\n  %s\n", expression, aml_buffer_data(b2));
+            failures++;
+        }
+
+        char *copy = (char *)aml_pool_alloc(pool, len);
+        for( size_t cut=1; cut<=4 && cut<=len; cut++ ) {
+            if(atl_token_ast_decode(&decoded, buf, len-cut)) {
+                printf("FAIL decoded %s truncated by %zu bytes\n", expression, cut);
+                failures++;
+            }
+        }
+        for( uint32_t k=0; k<12; k++ ) {
+            memcpy(copy, buf, len);
+            size_t pos = k < 4 ? next_rand() % 12 : next_rand() % len;
+            copy[pos] ^= 1 << (next_rand() % 8);
+            bool ok = atl_token_ast_decode(&decoded, copy, len);
+            if(ok && pos < 12) {
+                printf("FAIL decoded %s with header byte %zu changed\n", expression, pos);
+                failures++;
+            }
+            else if(ok) {
+                aml_buffer_clear(b2);
+                tree_string(b2, atl_token_ast_tree(pool, &decoded));
+                num_corrupt_decoded++;
+            }
+        }
+
+        atl_cursor_t *c1 = atl_cursor_open(pool, leaf, t, NULL);
+        atl_cursor_t *c2 = atl_cursor_open_ast(pool, leaf, ast, NULL);
+        int n = compare_cursors(c1, c2);
+        if(n < 0) {
+            printf("FAIL open and open_ast differ for %s\n", expression);
+            failures++;
+            continue;
+        }
+        atl_cursor_rewind(c1);
+        uint32_t count = atl_cursor_count(c1);
+        atl_cursor_rewind(c2);
+        uint32_t limit = next_rand() % 8;
+        uint32_t count_upto = atl_cursor_count_upto(c2, limit);
+        if(count != (uint32_t)n || count_upto != (limit < count ? limit : count)) {
+            printf("FAIL count %s: advanced %d, counted %u, counted %u up to %u\n",
+                   expression, n, count, count_upto, limit);
+            failures++;
+        }
+    }
+    if(!num_attr_chains || !num_numbers || !num_corrupt_decoded) {
+        printf("FAIL expressions didn't cover attr chains (%u), numbers (%u) or corruptions "
+               "which decode (%u)\n", num_attr_chains, num_numbers, num_corrupt_decoded);
+        failures++;
+    }
+
+    aml_buffer_destroy(b2);
+    aml_buffer_destroy(b1);
+    aml_pool_destroy(pool);
+    atl_token_dict_destroy(dict);
+    printf("%s\n", failures ? "FAILED" : "passed");
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,245 @@
+// SPDX-FileCopyrightText:  2023 Andy Curtis <contactandyc@gmail.com>
+// SPDX-License-Identifier: Apache-2.0
+#include "a-tokenizer-library/atl_token.h"
+#include "a-memory-library/aml_alloc.h"
+#include "the-io-library/io.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/*
+    Measures tokenizer throughput.
+
+    token_benchmark [-f text_file] [-m megabytes] [-r repeat]
+
+    text_file (texts/google_story.txt by default) is repeated until it is megabytes long and
+    synthetic ASCII, UTF-8 and punctuation heavy corpora of the same size are generated.  A set
+    of queries is repeated until it has at least as many bytes.  atl_token_parse,
+    atl_token_count, atl_token_skip and atl_token_parse_expression are run over each corpus
+    repeat times reporting MB/s, tokens/s and the pool bytes allocated per input byte.
+*/
+
+typedef struct {
+    const char *name;
+    char **strings;
+    uint32_t num_strings;
+    size_t bytes;
+    size_t tokens;
+} corpus_t;
+
+static const char *queries[] = {
+    "new york pizza",
+    "\"machine learning\" OR \"deep learning\"",
+    "(cheap OR affordable) flights NOT \"red eye\"",
+    "title:google brand:pixel phone",
+    "best (coffee OR espresso) near me",
+    "how to fix a flat tire on a bike",
+    "\"a tokenizer library\" (c OR cpp) NOT java",
+    "price:[10 TO 100] (shoes OR sneakers) color:red",
+    "(((a OR b) c) OR (d e)) NOT f",
+    "weather tomorrow san francisco",
+    "site:example.com {filter} [range] -excluded +required",
+    "caf\xc3\xa9 m\xc3\xbcnchen \xe6\x97\xa5\xe6\x9c\xac OR tokyo",
+};
+
+/* results are accumulated here so the calls can't be optimized away */
+static volatile size_t sink;
+
+static uint64_t rng_state = 0x2545F4914F6CDD1DULL;
+
+static uint32_t rng(uint32_t n) {
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 7;
+    rng_state ^= rng_state << 17;
+    return (uint32_t)(rng_state % n);
+}
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void corpus_single(corpus_t *c, const char *name, char *s, size_t len) {
+    c->name = name;
+    c->strings = (char **)aml_malloc(sizeof(char *));
+    c->strings[0] = s;
+    c->num_strings = 1;
+    c->bytes = len;
+    c->tokens = atl_token_count(s);
+}
+
+static char *repeat_text(const char *text, size_t text_len, size_t size) {
+    char *s = (char *)aml_malloc(size + 1);
+    size_t len = 0;
+    while(len < size) {
+        size_t n = size - len < text_len ? size - len : text_len;
+        memcpy(s + len, text, n);
+        len += n;
+    }
+    s[size] = 0;
+    return s;
+}
+
+/* words built from pieces picked at random, separated by a space or a random separator */
+static char *synthetic(size_t size, const char **pieces, uint32_t num_pieces,
+                       const char **seps, uint32_t num_seps) {
+    char *s = (char *)aml_malloc(size + 64);
+    size_t len = 0;
+    while(len < size) {
+        uint32_t n = 1 + rng(6);
+        for( uint32_t i=0; i<n; i++ ) {
+            const char *p = pieces[rng(num_pieces)];
+            size_t plen = strlen(p);
+            memcpy(s + len, p, plen);
+            len += plen;
+        }
+        const char *sep = rng(4) ? " " : seps[rng(num_seps)];
+        size_t slen = strlen(sep);
+        memcpy(s + len, sep, slen);
+        len += slen;
+    }
+    s[size] = 0;
+    return s;
+}
+
+static void corpus_queries(corpus_t *c, size_t size) {
+    uint32_t num_queries = sizeof(queries) / sizeof(queries[0]);
+    size_t query_bytes = 0;
+    for( uint32_t i=0; i<num_queries; i++ )
+        query_bytes += strlen(queries[i]);
+    uint32_t num = (uint32_t)((size + query_bytes - 1) / query_bytes) * num_queries;
+
+    c->name = "queries";
+    c->strings = (char **)aml_malloc(sizeof(char *) * num);
+    c->num_strings = num;
+    c->bytes = 0;
+    c->tokens = 0;
+    for( uint32_t i=0; i<num; i++ ) {
+        c->strings[i] = (char *)queries[i % num_queries];
+        c->bytes += strlen(c->strings[i]);
+        c->tokens += atl_token_count(c->strings[i]);
+    }
+}
+
+static void report(corpus_t *c, const char *fn, double elapsed, uint32_t repeat, size_t pool_bytes) {
+    double mb = (double)c->bytes * repeat / (1024.0 * 1024.0);
+    printf( "%-12s %-26s %10.1f %14.0f", c->name, fn, mb / elapsed, c->tokens * repeat / elapsed );
+    if(pool_bytes)
+        printf( " %10.2f", (double)pool_bytes / c->bytes );
+    printf( "\n" );
+}
+
+static void run(aml_pool_t *pool, corpus_t *c, uint32_t repeat) {
+    size_t pool_bytes = 0;
+    size_t total = 0;
+    double start = now();
+    for( uint32_t r=0; r<repeat; r++ ) {
+        pool_bytes = 0;
+        for( uint32_t i=0; i<c->num_strings; i++ ) {
+            aml_pool_clear(pool);
+            atl_token_parse(pool, c->strings[i]);
+            pool_bytes += aml_pool_used(pool);
+        }
+    }
+    report(c, "atl_token_parse", now() - start, repeat, pool_bytes);
+
+    start = now();
+    for( uint32_t r=0; r<repeat; r++ ) {
+        for( uint32_t i=0; i<c->num_strings; i++ )
+            total += atl_token_count(c->strings[i]);
+    }
+    report(c, "atl_token_count", now() - start, repeat, 0);
+
+    /* ask for more tokens than there are so the whole input is scanned */
+    start = now();
+    for( uint32_t r=0; r<repeat; r++ ) {
+        for( uint32_t i=0; i<c->num_strings; i++ ) {
+            const char *p = atl_token_skip(c->strings[i], (size_t)-1);
+            total += (size_t)(p - c->strings[i]);
+        }
+    }
+    report(c, "atl_token_skip", now() - start, repeat, 0);
+
+    start = now();
+    for( uint32_t r=0; r<repeat; r++ ) {
+        pool_bytes = 0;
+        for( uint32_t i=0; i<c->num_strings; i++ ) {
+            aml_pool_clear(pool);
+            atl_token_parse_expression(pool, c->strings[i], NULL, NULL);
+            pool_bytes += aml_pool_used(pool);
+        }
+    }
+    report(c, "atl_token_parse_expression", now() - start, repeat, pool_bytes);
+    sink += total;
+}
+
+int main(int argc, char *argv[]) {
+    const char *filename = "texts/google_story.txt";
+    size_t size = 8;
+    uint32_t repeat = 3;
+    for( int i=1; i+1<argc; i+=2 ) {
+        if(!strcmp(argv[i], "-f"))
+            filename = argv[i+1];
+        else if(!strcmp(argv[i], "-m"))
+            size = atoi(argv[i+1]);
+        else if(!strcmp(argv[i], "-r"))
+            repeat = atoi(argv[i+1]);
+    }
+    size *= 1024 * 1024;
+    if(!size)
+        size = 1024 * 1024;
+    if(!repeat)
+        repeat = 1;
+
+    static const char *ascii[] = { "a", "b", "c", "d", "e", "s", "t", "th", "ing", "er", "on", "qu", "x", "z" };
+    static const char *utf8[] = { "a", "e", "n", "\xc3\xa9", "\xc3\xbc", "\xc3\x9f", "\xd0\xb4", "\xd0\xb0",
+                                  "\xe6\x97\xa5", "\xe6\x9c\xac", "\xf0\x9f\x98\x80", "\xe2\x82\xac" };
+    static const char *seps[] = { ", ", ". ", "\n", ": ", " - ", "; " };
+    static const char *punct_seps[] = { ".", ",", ":", "(", ")", "[", "]", "{", "}", "!", "=", "-",
+                                        "+", "*", "/", "#", "~", "'", "\"", "&", "|", "?" };
+
+    corpus_t corpora[5];
+    uint32_t num_corpora = 0;
+
+    size_t text_len = 0;
+    char *text = io_read_file(&text_len, filename);
+    if(text && text_len) {
+        corpus_single(corpora + num_corpora, "story", repeat_text(text, text_len, size), size);
+        num_corpora++;
+    }
+    else
+        fprintf(stderr, "%s could not be read, skipping it\n", filename);
+    if(text)
+        aml_free(text);
+
+    corpus_single(corpora + num_corpora, "ascii",
+                  synthetic(size, ascii, sizeof(ascii)/sizeof(ascii[0]), seps, sizeof(seps)/sizeof(seps[0])),
+                  size);
+    num_corpora++;
+    corpus_single(corpora + num_corpora, "utf8",
+                  synthetic(size, utf8, sizeof(utf8)/sizeof(utf8[0]), seps, sizeof(seps)/sizeof(seps[0])),
+                  size);
+    num_corpora++;
+    corpus_single(corpora + num_corpora, "punctuation",
+                  synthetic(size, ascii, sizeof(ascii)/sizeof(ascii[0]),
+                            punct_seps, sizeof(punct_seps)/sizeof(punct_seps[0])),
+                  size);
+    num_corpora++;
+    corpus_queries(corpora + num_corpora, size);
+    num_corpora++;
+
+    printf( "%-12s %-26s %10s %14s %10s\n", "corpus", "function", "MB/s", "tokens/s", "pool/byte" );
+    aml_pool_t *pool = aml_pool_init(1024 * 1024);
+    for( uint32_t i=0; i<num_corpora; i++ ) {
+        run(pool, corpora + i, repeat);
+        /* the query corpus points at the static queries */
+        if(corpora[i].num_strings == 1)
+            aml_free(corpora[i].strings[0]);
+        aml_free(corpora[i].strings);
+    }
+    aml_pool_destroy(pool);
+    return 0;
+}
@@ -0,0 +1,324 @@
+// SPDX-FileCopyrightText:  2023 Andy Curtis <contactandyc@gmail.com>
+// SPDX-License-Identifier: Apache-2.0
+#include "a-tokenizer-library/atl_token.h"
+#include "a-tokenizer-library/atl_token_dict_handle.h"
+#include "a-memory-library/aml_buffer.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+    A large dictionary must expand every key the same way before and after
+    atl_token_dict_freeze, after atl_token_dict_save and atl_token_dict_map and after
+    expressions using it have been optimized (which must leave its read only trees alone).
+    Keys which aren't in it must not expand.  Damaged images must either fail to map or give
+    trees which can be walked, and a handle must keep its dictionary when a reload fails.
+*/
+
+#define NUM_KEYS 5000
+
+static const char *image_file = "token_dict_test.img";
+static const char *config_file = "token_dict_test.txt";
+
+static uint32_t seed = 1;
+
+static
+uint32_t next_rand(void) {
+    seed = seed * 1103515245 + 12345;
+    return (seed >> 16) & 0x7FFF;
+}
+
+static
+void tree_string(aml_buffer_t *bh, atl_token_t *t) {
+    for( ; t; t=t->next ) {
+        aml_buffer_appendf(bh, "%d/%d%s%s:%s", t->type, t->attr_type, t->no_params ? "n" : "",
+                           t->read_only ? "r" : "", t->token);
+        for( uint32_t i=0; i<t->num_attrs; i++ )
+            aml_buffer_appendf(bh, "%c%s", i ? ',' : '[', t->attrs[i]);
+        if(t->num_attrs)
+            aml_buffer_appendc(bh, ']');
+        if(t->attrs && t->attrs[t->num_attrs])
+            aml_buffer_appendc(bh, '!');
+        if(t->attr) {
+            aml_buffer_appendc(bh, '{');
+            tree_string(bh, t->attr);
+            aml_buffer_appendc(bh, '}');
+        }
+        if(t->child) {
+            aml_buffer_appendc(bh, '(');
+            tree_string(bh, t->child);
+            aml_buffer_appendc(bh, ')');
+        }
+        if(t->next)
+            aml_buffer_appendc(bh, ' ');
+    }
+}
+
+static
+void config_line(char *line, uint32_t i) {
+    if(i % 5 == 0)
+        sprintf(line, "k%u normal,no_params [x%u,y] k%u", i, i, i);
+    else
+        sprintf(line, "k%u normal (a%u OR (b%u OR c%u)) \"d e%u\" NOT f", i, i, i, i, i);
+}
+
+/* the tree key expands to (or the key itself if it isn't in dict or dict is NULL) */
+static
+char *expand(aml_pool_t *pool, aml_buffer_t *bh, atl_token_dict_t *dict, const char *key) {
+    aml_buffer_clear(bh);
+    tree_string(bh, atl_token_parse_expression(pool, key, dict ? atl_token_dict_cb : NULL, dict));
+    return aml_pool_strdup(pool, aml_buffer_data(bh));
+}
+
+/* number of keys in dict which don't expand to expected[i] */
+static
+uint32_t check_keys(aml_pool_t *pool, aml_buffer_t *bh, atl_token_dict_t *dict,
+                    char **expected) {
+    uint32_t bad = 0;
+    char key[32];
+    for( uint32_t i=0; i<NUM_KEYS; i++ ) {
+        aml_pool_clear(pool);
+        sprintf(key, "k%u", i);
+        if(strcmp(expand(pool, bh, dict, key), expected[i]))
+            bad++;
+    }
+    return bad;
+}
+
+/* number of missing keys which expand anyway */
+static
+uint32_t check_missing(aml_pool_t *pool, aml_buffer_t *bh, atl_token_dict_t *dict) {
+    static const char *missing[] = {
+        "k", "k5000", "k00", "K1", "k1x", "x1", "a1", "k-1", "kk1", "k12345678901234567890"
+    };
+    uint32_t bad = 0;
+    for( uint32_t i=0; i<sizeof(missing) / sizeof(missing[0]); i++ ) {
+        aml_pool_clear(pool);
+        char *s = expand(pool, bh, dict, missing[i]);
+        if(strcmp(s, expand(pool, bh, NULL, missing[i])))
+            bad++;
+    }
+    return bad;
+}
+
+static
+bool write_file(const char *filename, const char *data, size_t len) {
+    FILE *out = fopen(filename, "wb");
+    if(!out)
+        return false;
+    bool ok = fwrite(data, 1, len, out) == len;
+    return !fclose(out) && ok;
+}
+
+static
+char *read_file(const char *filename, size_t *len) {
+    FILE *in = fopen(filename, "rb");
+    if(!in)
+        return NULL;
+    fseek(in, 0, SEEK_END);
+    *len = ftell(in);
+    fseek(in, 0, SEEK_SET);
+    char *data = (char *)malloc(*len);
+    if(fread(data, 1, *len, in) != *len) {
+        free(data);
+        data = NULL;
+    }
+    fclose(in);
+    return data;
+}
+
+/* the value k1 has in the dictionary the handle currently holds */
+static
+char *pinned_value(aml_pool_t *pool, aml_buffer_t *bh, atl_token_dict_handle_t *h) {
+    uint32_t pin;
+    atl_token_dict_t *dict = atl_token_dict_handle_pin(h, &pin);
+    char *s = expand(pool, bh, dict, "k1");
+    atl_token_dict_handle_unpin(h, pin);
+    return s;
+}
+
+int main(void) {
+    aml_pool_t *pool = aml_pool_init(16384);
+    aml_pool_t *expected_pool = aml_pool_init(65536);
+    aml_buffer_t *bh = aml_buffer_init(1024);
+    int failures = 0;
+    char line[256];
+
+    atl_token_dict_t *dict = atl_token_dict_init();
+    for( uint32_t i=0; i<NUM_KEYS; i++ ) {
+        config_line(line, i);
+        atl_token_dict_add(dict, line);
+    }
+    char **expected = (char **)aml_pool_alloc(expected_pool, sizeof(char *) * NUM_KEYS);
+    for( uint32_t i=0; i<NUM_KEYS; i++ ) {
+        sprintf(line, "k%u", i);
+        expected[i] = expand(expected_pool, bh, dict, line);
+    }
+    if(atl_token_dict_size(dict) != NUM_KEYS || check_missing(pool, bh, dict)) {
+        printf("FAIL dictionary has %u keys or expands missing keys\n",
+               atl_token_dict_size(dict));
+        failures++;
+    }
+
+    /* freezing must not change any lookup */
+    if(!atl_token_dict_freeze(dict) || !atl_token_dict_freeze(dict) ||
+       atl_token_dict_add(dict, "z normal z")) {
+        printf("FAIL freeze\n");
+        failures++;
+    }
+    uint32_t bad = check_keys(pool, bh, dict, expected) + check_missing(pool, bh, dict);
+    if(bad || atl_token_dict_size(dict) != NUM_KEYS) {
+        printf("FAIL %u lookups differ once frozen\n", bad);
+        failures++;
+    }
+    atl_token_dict_t *empty = atl_token_dict_init();
+    if(atl_token_dict_freeze(empty)) {
+        printf("FAIL froze an empty dictionary\n");
+        failures++;
+    }
+    atl_token_dict_destroy(empty);
+
+    /* optimizing expressions which share the dictionary's trees must leave them alone */
+    for( uint32_t i=0; i<2000; i++ ) {
+        aml_pool_clear(pool);
+        uint32_t k1 = next_rand() % NUM_KEYS, k2 = next_rand() % NUM_KEYS;
+        static const char *forms[] = { "k%u OR (k%u z)", "(k%u k%u) OR k%u", "k%u NOT k%u" };
+        sprintf(line, forms[i % 3], k1, k2, k1);
+        atl_token_t *t = atl_token_parse_expression(pool, line, atl_token_dict_cb, dict);
+        aml_buffer_clear(bh);
+        tree_string(bh, atl_token_optimize(pool, t));
+        char *first = aml_pool_strdup(pool, aml_buffer_data(bh));
+        t = atl_token_parse_expression(pool, line, atl_token_dict_cb, dict);
+        aml_buffer_clear(bh);
+        tree_string(bh, atl_token_optimize(pool, t));
+        if(strcmp(first, aml_buffer_data(bh))) {
+            printf("FAIL optimizing %s twice differs\n  %s\n  %s\n", line, first,
+                   aml_buffer_data(bh));
+            failures++;
+        }
+    }
+    bad = check_keys(pool, bh, dict, expected);
+    if(bad) {
+        printf("FAIL %u keys changed after optimizing expressions using them\n", bad);
+        failures++;
+    }
+
+    /* save and map */
+    if(!atl_token_dict_save(dict, image_file) || !atl_token_dict_is_image(image_file)) {
+        printf("FAIL save\n");
+        failures++;
+    }
+    atl_token_dict_t *mapped = atl_token_dict_map(image_file);
+    if(!mapped) {
+        printf("FAIL map\n");
+        failures++;
+    }
+    else {
+        bad = check_keys(pool, bh, mapped, expected) + check_missing(pool, bh, mapped);
+        if(bad || atl_token_dict_size(mapped) != NUM_KEYS ||
+           atl_token_dict_add(mapped, "z normal z")) {
+            printf("FAIL %u lookups differ once mapped\n", bad);
+            failures++;
+        }
+        atl_token_dict_destroy(mapped);
+    }
+
+    /* damaged images are rejected or still walkable */
+    size_t len;
+    char *image = read_file(image_file, &len);
+    char *copy = (char *)malloc(len ? len : 1);
+    uint32_t num_mapped = 0;
+    for( uint32_t i=0; image && i<100; i++ ) {
+        memcpy(copy, image, len);
+        size_t copy_len = len;
+        if(i < 8)
+            copy[i] ^= 1;                       /* magic */
+        else if(i < 16)
+            copy[8 + i % 8] ^= 0x10;            /* version and pointer size */
+        else if(i < 24)
+            copy_len = len - 1 - next_rand() % 64;
+        else {
+            for( uint32_t k=1+next_rand()%3; k; k-- ) {
+                size_t pos = 64 + (next_rand() * 32768 + next_rand()) % (len - 64);
+                copy[pos] ^= 1 << (next_rand() % 8);
+            }
+        }
+        write_file(image_file, copy, copy_len);
+        atl_token_dict_t *d = atl_token_dict_map(image_file);
+        if(d && i < 24) {
+            printf("FAIL mapped an image with a bad header or length (%u)\n", i);
+            failures++;
+        }
+        else if(d) {
+            /* whatever it now holds, every key must be walkable */
+            check_keys(pool, bh, d, expected);
+            check_missing(pool, bh, d);
+            num_mapped++;
+        }
+        if(d)
+            atl_token_dict_destroy(d);
+    }
+    if(!image || !num_mapped) {
+        printf("FAIL no damaged image mapped\n");
+        failures++;
+    }
+    free(copy);
+
+    /* a handle keeps its dictionary when a reload fails */
+    if(image)
+        write_file(image_file, image, len);
+    free(image);
+    atl_token_dict_handle_t *h = atl_token_dict_handle_init(atl_token_dict_map(image_file));
+    char *value = pinned_value(pool, bh, h);
+    uint64_t version = atl_token_dict_handle_version(h);
+    if(strcmp(value, expected[1])) {
+        printf("FAIL handle doesn't hold the mapped dictionary\n");
+        failures++;
+    }
+    FILE *out = fopen(config_file, "w");
+    if(out) {
+        fprintf(out, "k1 normal reloaded\n");
+        fclose(out);
+    }
+    if(!atl_token_dict_handle_reload(h, config_file) || !atl_token_dict_handle_wait(h) ||
+       atl_token_dict_handle_version(h) != version+1 ||
+       strcmp(pinned_value(pool, bh, h), expand(pool, bh, NULL, "reloaded"))) {
+        printf("FAIL reload of a config\n");
+        failures++;
+    }
+    version = atl_token_dict_handle_version(h);
+    value = pinned_value(pool, bh, h);
+
+    const char *bad_files[] = { "token_dict_test.missing", config_file, image_file };
+    out = fopen(config_file, "w");
+    if(out) {
+        fprintf(out, "\n# no entries\n");
+        fclose(out);
+    }
+    write_file(image_file, "ATLDICT\0", 8);
+    for( uint32_t i=0; i<3; i++ ) {
+        if(!atl_token_dict_handle_reload(h, bad_files[i]) || atl_token_dict_handle_wait(h) ||
+           atl_token_dict_handle_version(h) != version ||
+           strcmp(pinned_value(pool, bh, h), value)) {
+            printf("FAIL failed reload of %s replaced the dictionary\n", bad_files[i]);
+            failures++;
+        }
+    }
+
+    atl_token_dict_handle_publish(h, dict);
+    if(atl_token_dict_handle_version(h) != version+1 ||
+       strcmp(pinned_value(pool, bh, h), expected[1])) {
+        printf("FAIL publish\n");
+        failures++;
+    }
+    atl_token_dict_handle_destroy(h);
+    remove(image_file);
+    remove(config_file);
+
+    aml_buffer_destroy(bh);
+    aml_pool_destroy(expected_pool);
+    aml_pool_destroy(pool);
+    printf("%s\n", failures ? "FAILED" : "passed");
+    return failures ? 1 : 0;
+}